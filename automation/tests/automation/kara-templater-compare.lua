@@ -0,0 +1,111 @@
+﻿-- Automation 4 test file
+-- Apply the templates in kara-templater-compare.ass with both the native
+-- subs.apply_karaoke_templates and the Lua implementation it replaced, and
+-- check that they generate the same lines
+
+script_name = "TEST native karaoke templater"
+script_description = "Compare subs.apply_karaoke_templates with the Lua karaoke templater"
+script_author = "Aegisub CLI contributors"
+script_version = "1"
+
+-- Both templaters register a macro and a filter when loaded, but only the
+-- functions they define are wanted here
+local register_macro, register_filter = aegisub.register_macro, aegisub.register_filter
+aegisub.register_macro = function() end
+aegisub.register_filter = function() end
+include("../../autoload/kara-templater.lua")
+local make_template_env = make_template_env
+-- kara-templater 2.1.7, the last version which applied the templates in Lua
+include("./kara-templater-reference.lua")
+local parse_templates, apply_templates = parse_templates, apply_templates
+aegisub.register_macro, aegisub.register_filter = register_macro, register_filter
+
+local fields = {"comment", "layer", "start_time", "end_time", "style", "actor",
+	"margin_l", "margin_r", "margin_t", "effect", "text"}
+
+function dump_events(subs)
+	local events = {}
+	for i = 1, #subs do
+		local l = subs[i]
+		if l.class == "dialogue" then
+			local values = {}
+			for _, field in ipairs(fields) do
+				values[#values + 1] = tostring(l[field])
+			end
+			events[#events + 1] = table.concat(values, ",")
+		end
+	end
+	return events
+end
+
+function replace_events(subs, events)
+	local dialogue = {}
+	for i = 1, #subs do
+		if subs[i].class == "dialogue" then
+			dialogue[#dialogue + 1] = i
+		end
+	end
+	subs.delete(dialogue)
+	for _, l in ipairs(events) do
+		subs.append(l)
+	end
+end
+
+function compare_templaters(subs)
+	local original = {}
+	for i = 1, #subs do
+		local l = subs[i]
+		if l.class == "dialogue" then
+			original[#original + 1] = l
+		end
+	end
+
+	aegisub.progress.task("Applying templates in Lua")
+	local meta, styles = karaskel.collect_head(subs, true)
+	apply_templates(meta, styles, subs, parse_templates(meta, styles, subs))
+	local expected = dump_events(subs)
+
+	replace_events(subs, original)
+
+	aegisub.progress.task("Applying templates natively")
+	meta, styles = karaskel.collect_head(subs, true)
+	subs.apply_karaoke_templates(meta, styles, make_template_env(meta, styles))
+	local actual = dump_events(subs)
+
+	local failures = 0
+	for i = 1, math.max(#expected, #actual) do
+		if expected[i] ~= actual[i] then
+			failures = failures + 1
+			aegisub.debug.out(1, "Event %d differs:\n  Lua:    %s\n  native: %s\n", i, tostring(expected[i]), tostring(actual[i]))
+		end
+	end
+
+	-- Each kind of template is on its own layer, so check that every one of
+	-- them generated something and that the stale fx lines are gone
+	local layers = {}
+	for i = 1, #subs do
+		local l = subs[i]
+		if l.class == "dialogue" and l.effect == "fx" then
+			layers[l.layer] = true
+			if l.text:match("stale") then
+				failures = failures + 1
+				aegisub.debug.out(1, "Previously generated line was not deleted: %s\n", l.text)
+			end
+		end
+	end
+	for layer = 1, 9 do
+		if not layers[layer] then
+			failures = failures + 1
+			aegisub.debug.out(1, "Template on layer %d generated no lines\n", layer)
+		end
+	end
+
+	if failures == 0 then
+		aegisub.debug.out(3, "All %d events match\n", #actual)
+	else
+		aegisub.debug.out(1, "%d failures\n", failures)
+	end
+	aegisub.set_undo_point("compare karaoke templaters")
+end
+
+aegisub.register_macro("Compare karaoke templaters", "Applies the templates natively and in Lua and compares the results", compare_templaters)
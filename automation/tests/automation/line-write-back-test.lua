@@ -0,0 +1,47 @@
+﻿-- Automation 4 test file
+-- Test that changes to a line table are kept when it's written back, both
+-- for fields which were read and then modified and for fields which were
+-- assigned without being read
+
+script_name = "TEST line write back"
+script_description = "Test writing modified line tables back to the subtitles"
+script_author = "Aegisub CLI contributors"
+script_version = "1"
+
+function check(subs, i, expected, what)
+	if subs[i].text ~= expected then
+		aegisub.debug.out(1, "%s: expected '%s', got '%s'\n", what, expected, subs[i].text)
+		return false
+	end
+	return true
+end
+
+function write_back_test(subs, sel)
+	local ok = true
+	for _, i in ipairs(sel) do
+		local text = subs[i].text
+
+		-- Read, modify and write back the field
+		local line = subs[i]
+		line.text = line.text .. "x"
+		subs[i] = line
+		ok = check(subs, i, text .. "x", "read-modify-write") and ok
+
+		-- Assign without reading first
+		line = subs[i]
+		line.text = text
+		subs[i] = line
+		ok = check(subs, i, text, "assignment") and ok
+
+		-- Writing back an unmodified table leaves the line alone
+		subs[i] = subs[i]
+		ok = check(subs, i, text, "unmodified") and ok
+	end
+
+	if ok then
+		aegisub.debug.out(3, "All line write back tests passed\n")
+	end
+	aegisub.set_undo_point("line write back test")
+end
+
+aegisub.register_macro("Line write back test", "Modifies the selected lines and writes them back", write_back_test)
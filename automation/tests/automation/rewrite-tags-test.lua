@@ -0,0 +1,48 @@
+﻿-- Automation 4 test file
+-- Check the result of applying rewrite-tags-test.json to
+-- rewrite-tags-test.ass with the built-in tool/rewrite-tags command:
+--
+--   aegisub-cli --file rewrite-tags-test.json rewrite-tags-test.ass out.ass tool/rewrite-tags
+--   aegisub-cli --automation rewrite-tags-test.lua out.ass out2.ass "Rewrite tags test"
+
+script_name = "TEST rewrite tags"
+script_description = "Check the lines of rewrite-tags-test.ass after rewriting their tags"
+script_author = "Aegisub CLI contributors"
+script_version = "1"
+
+local expected = {
+	"{\\t(100,600,0.5,\\fs40)}accel with times",
+	"{\\t(2,\\fs40)}accel only",
+	"{\\t(100,600,\\fs40)}times only",
+	"{\\t(\\fs40)}no times",
+	"{\\t(100,600,0.5,\\fs40\\bord2)\\t(200,300,\\fs60)}two transforms",
+	"{\\move(20,40,60,80)}move without times",
+	"{\\move(21,40,60,80,100,1100)}move with times",
+	"{\\fad(600,600)}fade",
+	"{\\fs20\\bord2}other tags",
+	"{\\bord2}untouched",
+}
+
+function check_rewritten_tags(subs)
+	local failures, n = 0, 0
+	for i = 1, #subs do
+		local l = subs[i]
+		if l.class == "dialogue" then
+			n = n + 1
+			if l.text ~= expected[n] then
+				failures = failures + 1
+				aegisub.debug.out(1, "Line %d: expected '%s', got '%s'\n", n, tostring(expected[n]), l.text)
+			end
+		end
+	end
+	if n ~= #expected then
+		failures = failures + 1
+		aegisub.debug.out(1, "Expected %d lines, got %d\n", #expected, n)
+	end
+
+	if failures == 0 then
+		aegisub.debug.out(3, "All tag rewriting tests passed\n")
+	end
+end
+
+aegisub.register_macro("Rewrite tags test", "Checks the lines of rewrite-tags-test.ass after rewriting their tags", check_rewritten_tags)
@@ -0,0 +1,246 @@
+// Copyright (c) 2026, Aegisub CLI contributors
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+// Aegisub Project http://www.aegisub.org/
+
+#include <libaegisub/ass/drawing.h>
+
+#include <algorithm>
+#include <boost/math/constants/constants.hpp>
+#include <boost/spirit/include/qi_numeric.hpp>
+#include <boost/spirit/include/qi_parse.hpp>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+bool is_command(char c) {
+	return c == 'm' || c == 'n' || c == 'l' || c == 'b' || c == 's' || c == 'p' || c == 'c';
+}
+
+/// Append a number formatted as "%.3f" with the trailing zeros and decimal
+/// point removed, except that negative zero is written as "0"
+void append_number(std::string& out, double value) {
+	double scaled = std::abs(value) * 1000;
+	double whole = std::floor(scaled);
+	double frac = scaled - whole;
+
+	// Rounding the scaled value is only certain to match printf's rounding
+	// of the exact decimal value when it is small enough for the
+	// multiplication to be precise and not close to halfway. Everything
+	// else, including infinities and NaN, goes through printf itself.
+	if (!(scaled < 1e8) || std::abs(frac - 0.5) < 1e-6) {
+		char buf[512];
+		int len = snprintf(buf, sizeof buf, "%.3f", value);
+		if (len <= 0 || len >= static_cast<int>(sizeof buf)) return;
+		if (auto point = static_cast<char *>(memchr(buf, '.', len))) {
+			while (buf[len - 1] == '0') --len;
+			if (buf + len - 1 == point) --len;
+		}
+		if (len == 2 && buf[0] == '-' && buf[1] == '0')
+			out += '0';
+		else
+			out.append(buf, len);
+		return;
+	}
+
+	auto thousandths = static_cast<uint64_t>(whole) + (frac > 0.5);
+	if (thousandths == 0) {
+		out += '0';
+		return;
+	}
+
+	char buf[32];
+	char *end = buf + sizeof buf;
+	char *p = end;
+	auto fraction = thousandths % 1000;
+	if (fraction) {
+		int digits = 3;
+		while (fraction % 10 == 0) {
+			fraction /= 10;
+			--digits;
+		}
+		while (digits--) {
+			*--p = '0' + fraction % 10;
+			fraction /= 10;
+		}
+		*--p = '.';
+	}
+	auto integer = thousandths / 1000;
+	do {
+		*--p = '0' + integer % 10;
+		integer /= 10;
+	} while (integer);
+	if (value < 0)
+		*--p = '-';
+	out.append(p, end);
+}
+}
+
+namespace agi { namespace ass {
+Transform Transform::Translate(double x, double y) {
+	Transform t;
+	t.dx = x;
+	t.dy = y;
+	return t;
+}
+
+Transform Transform::Scale(double x, double y) {
+	Transform t;
+	t.xx = x;
+	t.yy = y;
+	return t;
+}
+
+Transform Transform::Rotate(double degrees) {
+	// y points down, so a counterclockwise turn on screen takes (1, 0)
+	// towards (0, -1)
+	double angle = degrees * boost::math::constants::pi<double>() / 180;
+	double c = std::cos(angle), s = std::sin(angle);
+	Transform t;
+	t.xx = c;
+	t.xy = s;
+	t.yx = -s;
+	t.yy = c;
+	return t;
+}
+
+Transform Transform::Shear(double x, double y) {
+	Transform t;
+	t.xy = x;
+	t.yx = y;
+	return t;
+}
+
+Transform Transform::Then(Transform const& next) const {
+	Transform t;
+	t.xx = next.xx * xx + next.xy * yx;
+	t.xy = next.xx * xy + next.xy * yy;
+	t.dx = next.xx * dx + next.xy * dy + next.dx;
+	t.yx = next.yx * xx + next.yy * yx;
+	t.yy = next.yx * xy + next.yy * yy;
+	t.dy = next.yx * dx + next.yy * dy + next.dy;
+	return t;
+}
+
+void Drawing::Parse(const char *begin, const char *end) {
+	commands.clear();
+	coords.clear();
+
+	for (const char *token = begin; token < end; ) {
+		if (*token == ' ') {
+			++token;
+			continue;
+		}
+
+		auto token_end = static_cast<const char *>(memchr(token, ' ', end - token));
+		if (!token_end) token_end = end;
+
+		// Numbers are parsed in place; the token has to be entirely a number
+		double value;
+		const char *number_end = token;
+		if (boost::spirit::qi::parse(number_end, token_end, boost::spirit::qi::double_, value) && number_end == token_end) {
+			if (commands.empty())
+				commands.push_back(Command{0, 0});
+			coords.push_back(value);
+			++commands.back().count;
+		}
+		else if (token_end - token == 1) {
+			char c = static_cast<char>(tolower(static_cast<unsigned char>(*token)));
+			if (is_command(c))
+				commands.push_back(Command{c, 0});
+		}
+
+		token = token_end;
+	}
+}
+
+void Drawing::Apply(Transform const& t) {
+	double *coord = coords.data();
+	for (auto const& command : commands) {
+		double *command_end = coord + command.count;
+		if (t.xy == 0 && t.yx == 0) {
+			// Keep each axis independent of the other so that a value
+			// which isn't finite doesn't spread to the other coordinate
+			for (bool is_x = true; coord < command_end; ++coord, is_x = !is_x)
+				*coord = is_x ? t.xx * *coord + t.dx : t.yy * *coord + t.dy;
+			continue;
+		}
+
+		for (; coord + 1 < command_end; coord += 2) {
+			double x = coord[0], y = coord[1];
+			coord[0] = t.xx * x + t.xy * y + t.dx;
+			coord[1] = t.yx * x + t.yy * y + t.dy;
+		}
+		if (coord < command_end) {
+			*coord = t.xx * *coord + t.dx;
+			++coord;
+		}
+	}
+}
+
+void Drawing::Round(double step) {
+	for (auto& coord : coords)
+		coord = std::round(coord / step) * step;
+}
+
+bool Drawing::BoundingBox(double& x1, double& y1, double& x2, double& y2) const {
+	bool found = false;
+	const double *coord = coords.data();
+	for (auto const& command : commands) {
+		const double *command_end = coord + command.count;
+		for (; coord + 1 < command_end; coord += 2) {
+			if (!found) {
+				x1 = x2 = coord[0];
+				y1 = y2 = coord[1];
+				found = true;
+				continue;
+			}
+			x1 = std::min(x1, coord[0]);
+			x2 = std::max(x2, coord[0]);
+			y1 = std::min(y1, coord[1]);
+			y2 = std::max(y2, coord[1]);
+		}
+		// A lone trailing x has no point to go with it
+		coord = command_end;
+	}
+	return found;
+}
+
+void Drawing::Serialize(std::string& out) const {
+	auto start = out.size();
+	const double *coord = coords.data();
+	for (auto const& command : commands) {
+		if (command.type) {
+			out += command.type;
+			out += ' ';
+		}
+		for (size_t i = 0; i < command.count; ++i) {
+			append_number(out, *coord++);
+			out += ' ';
+		}
+	}
+	if (out.size() > start)
+		out.pop_back();
+}
+
+std::string Drawing::Serialize() const {
+	std::string out;
+	out.reserve(coords.size() * 6 + commands.size() * 2);
+	Serialize(out);
+	return out;
+}
+} }
@@ -22,7 +22,6 @@
 #include <unicode/uchar.h>
 #include <unicode/utf8.h>
 
-#include <mutex>
 #include <unicode/brkiter.h>
 
 namespace {
@@ -34,13 +33,13 @@ using utext_ptr = std::unique_ptr<UText, utext_deleter>;
 UChar32 ass_special_chars[] = {'n', 'N', 'h'};
 
 icu::BreakIterator& get_break_iterator(const char *ptr, size_t len) {
-	static std::unique_ptr<icu::BreakIterator> bi;
-	static std::once_flag token;
-	std::call_once(token, [&] {
+	// The iterator holds the text being counted, so each thread needs its own
+	thread_local std::unique_ptr<icu::BreakIterator> bi;
+	if (!bi) {
 		UErrorCode status = U_ZERO_ERROR;
 		bi.reset(icu::BreakIterator::createCharacterInstance(icu::Locale::getDefault(), status));
 		if (U_FAILURE(status)) throw agi::InternalError("Failed to create character iterator");
-	});
+	}
 
 	UErrorCode err = U_ZERO_ERROR;
 	utext_ptr ut(utext_openUTF8(nullptr, ptr, len, &err));
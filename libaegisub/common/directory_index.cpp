@@ -0,0 +1,157 @@
+// Copyright (c) 2026, Aegisub CLI contributors
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+// Aegisub Project http://www.aegisub.org/
+
+#include "libaegisub/directory_index.h"
+
+#include "libaegisub/fs.h"
+
+#include <algorithm>
+#include <unordered_set>
+#include <boost/algorithm/string/predicate.hpp>
+#define BOOST_NO_SCOPED_ENUMS
+#include <boost/filesystem/operations.hpp>
+#undef BOOST_NO_SCOPED_ENUMS
+
+namespace bfs = boost::filesystem;
+
+namespace {
+/// Maximum depth to descend to, as symlinked directories are followed and
+/// may form loops
+const int max_depth = 16;
+
+/// Is the key of a path under the key of an indexed directory?
+bool is_under(std::string const& key, std::string const& root) {
+	return key.size() > root.size() && boost::starts_with(key, root) && (root.back() == '/' || key[root.size()] == '/');
+}
+}
+
+namespace agi { namespace fs {
+std::string DirectoryIndex::Key(path const& p) {
+	// Collapse repeated separators and "." components so that paths built by
+	// substituting into package.path match the paths found by iterating
+	auto str = p.generic_string();
+	std::string key;
+	key.reserve(str.size());
+	for (size_t i = 0; i < str.size(); ++i) {
+		if (str[i] == '/') {
+			if (!key.empty() && key.back() == '/') continue;
+			if (str.compare(i, 3, "/./") == 0 || str.compare(i, std::string::npos, "/.") == 0) {
+				++i;
+				continue;
+			}
+		}
+		key += str[i];
+	}
+	if (key.size() > 1 && key.back() == '/')
+		key.pop_back();
+#if defined(_WIN32) || defined(__APPLE__)
+	// Their filesystems are case-insensitive, so a module required with
+	// different case from its filename still has to be found
+	for (auto& c : key) {
+		if (c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+	}
+#endif
+	return key;
+}
+
+void DirectoryIndex::Add(path const& dir) {
+	auto root = Key(dir);
+	if (find(roots.begin(), roots.end(), root) != roots.end()) return;
+	if (!DirectoryExists(dir)) return;
+	roots.push_back(root);
+	Scan(dir);
+}
+
+void DirectoryIndex::Scan(path const& dir) {
+	// Symlinked directories are followed, but not into a directory which has
+	// already been visited, so links which form loops aren't walked again
+	std::unordered_set<std::string> visited;
+	boost::system::error_code ec;
+	auto canonical = bfs::canonical(dir, ec);
+	if (!ec)
+		visited.insert(canonical.string());
+
+	bfs::recursive_directory_iterator it(dir, bfs::symlink_option::recurse, ec), end;
+	for (; !ec && it != end; it.increment(ec)) {
+		if (it.level() >= max_depth)
+			it.no_push();
+
+		auto status = it->status(ec);
+		if (ec) {
+			ec.clear();
+			continue;
+		}
+		if (bfs::is_directory(status)) {
+			if (bfs::is_symlink(it->symlink_status(ec))) {
+				canonical = bfs::canonical(it->path(), ec);
+				if (ec || !visited.insert(canonical.string()).second)
+					it.no_push();
+			}
+			ec.clear();
+			continue;
+		}
+		if (!bfs::is_regular_file(status))
+			continue;
+
+		auto size = bfs::file_size(it->path(), ec);
+		if (ec) { ec.clear(); continue; }
+		auto modified = bfs::last_write_time(it->path(), ec);
+		if (ec) { ec.clear(); continue; }
+
+		files[Key(it->path())] = FileInfo{modified, size};
+	}
+}
+
+bool DirectoryIndex::Covers(path const& p) const {
+	auto key = Key(p);
+	return any_of(roots.begin(), roots.end(), [&](std::string const& root) { return is_under(key, root); });
+}
+
+DirectoryIndex::FileInfo const* DirectoryIndex::Find(path const& p) const {
+	auto it = files.find(Key(p));
+	return it == files.end() ? nullptr : &it->second;
+}
+
+bool DirectoryIndex::FileExists(path const& p) {
+	if (!Covers(p))
+		return fs::FileExists(p);
+	if (Find(p))
+		return true;
+	if (!fs::FileExists(p))
+		return false;
+
+	// The file was created after its directory was indexed, so the rest of
+	// the index for that directory may be out of date too
+	auto key = Key(p);
+	for (auto const& root : roots) {
+		if (!is_under(key, root)) continue;
+		for (auto it = files.begin(); it != files.end(); ) {
+			if (is_under(it->first, root))
+				it = files.erase(it);
+			else
+				++it;
+		}
+		Scan(root);
+		break;
+	}
+	return true;
+}
+
+void DirectoryIndex::Remove(path const& p) {
+	files.erase(Key(p));
+}
+} }
@@ -24,8 +24,10 @@
 #include <boost/locale/boundary.hpp>
 #include <boost/locale/collator.hpp>
 #include <boost/range/algorithm/copy.hpp>
+#include <cstring>
 #include <unicode/uchar.h>
 #include <unicode/utf8.h>
+#include <unordered_map>
 
 namespace {
 int32_t next_codepoint(const char *str, size_t *i) {
@@ -46,29 +48,102 @@ bool is_whitespace(std::string const& str) {
 	}
 	return true;
 }
-
-// strcmp but ignoring case and accents
-int compare(std::string const& a, std::string const& b) {
-	using namespace boost::locale;
-	return std::use_facet<collator<char>>(std::locale()).compare(collator_base::primary, a, b);
-}
-
 }
 
 namespace agi {
+namespace {
+/// The source and destination of a line's karaoke, split into the pieces
+/// matching looks at
+class line_matcher {
+	struct dest_character {
+		size_t offset;
+		size_t length;
+		bool whitespace;
+		/// Primary strength collation key, so that characters which only
+		/// differ in case or accents have the same key
+		std::string key;
+	};
 
-karaoke_match_result auto_match_karaoke(std::vector<std::string> const& source_strings, std::string const& dest_string) {
+	std::vector<std::string> const& source;
+	std::vector<std::string> lower_source;
+	std::vector<bool> blank_source;
+
+	std::string const& dest;
+	std::vector<dest_character> dest_chars;
+
+	boost::locale::collator<char> const& collator;
+	/// Keys of the source characters compared so far
+	std::unordered_map<std::string, std::string> source_keys;
+
+	std::string dest_str(size_t i) const {
+		return dest.substr(dest_chars[i].offset, dest_chars[i].length);
+	}
+
+	/// Get the first grapheme cluster of a string
+	static std::string first_character(std::string const& str) {
+		// Romaji is nearly all ASCII, and an ASCII character followed by
+		// another one is always a character of its own other than for CRLF,
+		// so only look for boundaries when that isn't the case
+		if (!(str[0] & 0x80) && (str.size() == 1 || (!(str[1] & 0x80) && !(str[0] == '\r' && str[1] == '\n'))))
+			return str.substr(0, 1);
+
+		using namespace boost::locale::boundary;
+		return ssegment_index(character, begin(str), end(str)).begin()->str();
+	}
+
+	std::string const& source_key(std::string const& chr) {
+		auto it = source_keys.find(chr);
+		if (it == source_keys.end())
+			it = source_keys.emplace(chr, collator.transform(boost::locale::collator_base::primary, chr)).first;
+		return it->second;
+	}
+
+public:
+	line_matcher(std::vector<std::string> const& source, std::string const& dest)
+	: source(source)
+	, dest(dest)
+	, collator(std::use_facet<boost::locale::collator<char>>(std::locale()))
+	{
+		lower_source.reserve(source.size());
+		blank_source.reserve(source.size());
+		for (auto const& syl : source) {
+			lower_source.push_back(boost::to_lower_copy(syl));
+			blank_source.push_back(is_whitespace(syl));
+		}
+
+		using namespace boost::locale::boundary;
+		ssegment_index characters(character, begin(dest), end(dest));
+		for (auto const& chr : characters) {
+			auto str = chr.str();
+			dest_chars.push_back(dest_character{
+				static_cast<size_t>(chr.begin() - dest.begin()), str.size(), is_whitespace(str),
+				collator.transform(boost::locale::collator_base::primary, str)});
+		}
+	}
+
+	size_t dest_size() const { return dest_chars.size(); }
+
+	/// The byte offset of the destination character, or the length of the
+	/// destination for the end
+	size_t dest_offset(size_t i) const {
+		return i < dest_chars.size() ? dest_chars[i].offset : dest.size();
+	}
+
+	/// Match the source strings from first onwards to the destination
+	/// characters from dst onwards
+	karaoke_match_result match(size_t first, size_t dst);
+};
+
+karaoke_match_result line_matcher::match(size_t first, size_t dst) {
 	karaoke_match_result result = { 0, 0 };
-	if (source_strings.empty()) return result;
+	if (first >= source.size()) return result;
 
-	using namespace boost::locale::boundary;
 	using boost::starts_with;
 
+	size_t source_count = source.size() - first;
 	result.source_length = 1;
-	ssegment_index destination_characters(character, begin(dest_string), end(dest_string));
-	auto src = boost::to_lower_copy(source_strings[0]);
-	auto dst = destination_characters.begin();
-	auto dst_end = destination_characters.end();
+	auto src = lower_source[first];
+	size_t dst_end = dest_chars.size();
 
 	// Eat all the whitespace at the beginning of the source and destination
 	// syllables and exit if either ran out.
@@ -79,7 +154,7 @@ karaoke_match_result auto_match_karaoke(std::vector<std::string> const& source_s
 		if (first_non_whitespace)
 			src = src.substr(first_non_whitespace);
 
-		while (dst != dst_end && is_whitespace(dst->str())) {
+		while (dst != dst_end && dest_chars[dst].whitespace) {
 			++dst;
 			++result.destination_length;
 		}
@@ -87,7 +162,7 @@ karaoke_match_result auto_match_karaoke(std::vector<std::string> const& source_s
 		// If we ran out of dest then this needs to match the rest of the
 		// source syllables (this probably means the user did something wrong)
 		if (dst == dst_end) {
-			result.source_length = source_strings.size();
+			result.source_length = source_count;
 			return true;
 		}
 
@@ -102,8 +177,8 @@ karaoke_match_result auto_match_karaoke(std::vector<std::string> const& source_s
 	// character. If it does, match them and repeat.
 	while (!src.empty()) {
 		// First check for a basic match of the first character of the source and dest
-		auto first_src_char = ssegment_index(character, begin(src), end(src)).begin()->str();
-		if (compare(first_src_char, dst->str()) == 0) {
+		auto first_src_char = first_character(src);
+		if (source_key(first_src_char) == dest_chars[dst].key) {
 			++dst;
 			++result.destination_length;
 			src.erase(0, first_src_char.size());
@@ -112,11 +187,11 @@ karaoke_match_result auto_match_karaoke(std::vector<std::string> const& source_s
 		}
 
 		auto check = [&](kana_pair const& kp) -> bool {
-			if (!starts_with(&*dst->begin(), kp.kana)) return false;
+			if (!starts_with(dest.c_str() + dest_chars[dst].offset, kp.kana)) return false;
 
 			src = src.substr(strlen(kp.romaji));
-			for (size_t i = 0; kp.kana[i]; ) {
-				i += dst->length();
+			for (size_t i = 0, len = strlen(kp.kana); i < len; ) {
+				i += dest_chars[dst].length;
 				++result.destination_length;
 				++dst;
 			}
@@ -137,8 +212,8 @@ karaoke_match_result auto_match_karaoke(std::vector<std::string> const& source_s
 	// Source and dest are now non-empty and start with non-whitespace.
 	// If there's only one character left in the dest, it obviously needs to
 	// match all of the source syllables left.
-	if (std::distance(dst, dst_end) == 1) {
-		result.source_length = source_strings.size();
+	if (dst_end - dst == 1) {
+		result.source_length = source_count;
 		++result.destination_length;
 		return result;
 	}
@@ -165,22 +240,22 @@ karaoke_match_result auto_match_karaoke(std::vector<std::string> const& source_s
 
 		// Transliterate this character if it's a known hiragana or katakana character
 		std::vector<const char *> translit;
-		auto next = std::next(dst);
-		if (next != dst_end)
-			boost::copy(kana_to_romaji(dst->str() + next->str()), back_inserter(translit));
-		boost::copy(kana_to_romaji(dst->str()), back_inserter(translit));
+		auto dst_char = dest_str(dst);
+		if (dst + 1 != dst_end)
+			boost::copy(kana_to_romaji(dst_char + dest_str(dst + 1)), back_inserter(translit));
+		boost::copy(kana_to_romaji(dst_char), back_inserter(translit));
 
 		// Search for it and the transliterated version in the source
 		int src_lookahead_max = (lookahead + 1) * max_character_length;
 		int src_lookahead_pos = 0;
-		for (auto const& syl : source_strings) {
+		for (size_t i = first; i < source.size(); ++i) {
 			// Don't count blank syllables in the max search distance
-			if (is_whitespace(syl)) continue;
+			if (blank_source[i]) continue;
 			if (++src_lookahead_pos == 1) continue;
 			if (src_lookahead_pos > src_lookahead_max) break;
 
-			std::string lsyl = boost::to_lower_copy(syl);
-			if (!(starts_with(syl, dst->str()) || util::any_of(translit, [&](const char *str) { return starts_with(lsyl, str); })))
+			auto const& lsyl = lower_source[i];
+			if (!(starts_with(source[i], dst_char) || util::any_of(translit, [&](const char *str) { return starts_with(lsyl, str); })))
 				continue;
 
 			// The syllable immediately after the current one matched, so
@@ -205,3 +280,29 @@ karaoke_match_result auto_match_karaoke(std::vector<std::string> const& source_s
 	return result;
 }
 }
+
+karaoke_match_result auto_match_karaoke(std::vector<std::string> const& source_strings, std::string const& dest_string) {
+	return line_matcher(source_strings, dest_string).match(0, 0);
+}
+
+std::vector<karaoke_match_group> match_karaoke_line(std::vector<std::string> const& source_strings, std::string const& dest_string) {
+	std::vector<karaoke_match_group> groups;
+	line_matcher matcher(source_strings, dest_string);
+
+	size_t src = 0, dst = 0;
+	while (src < source_strings.size()) {
+		auto result = matcher.match(src, dst);
+		size_t dst_next = std::min(dst + result.destination_length, matcher.dest_size());
+		size_t begin = matcher.dest_offset(dst);
+		groups.push_back(karaoke_match_group{result.source_length,
+			dest_string.substr(begin, matcher.dest_offset(dst_next) - begin)});
+		src += result.source_length;
+		dst = dst_next;
+	}
+
+	if (!groups.empty() && dst < matcher.dest_size())
+		groups.back().destination += dest_string.substr(matcher.dest_offset(dst));
+
+	return groups;
+}
+}
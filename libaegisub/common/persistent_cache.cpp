@@ -0,0 +1,285 @@
+// Copyright (c) 2026, Aegisub CLI contributors
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+// Aegisub Project http://www.aegisub.org/
+
+#include "libaegisub/persistent_cache.h"
+
+#include "libaegisub/file_mapping.h"
+#include "libaegisub/fs.h"
+#include "libaegisub/make_unique.h"
+
+#include <algorithm>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/interprocess/sync/file_lock.hpp>
+#include <boost/interprocess/sync/scoped_lock.hpp>
+#include <boost/interprocess/sync/sharable_lock.hpp>
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+using namespace boost::interprocess;
+
+namespace {
+const char magic[8] = {'A', 'G', 'I', 'C', 'A', 'C', 'H', 'E'};
+const uint32_t version = 1;
+
+struct FileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	/// Changed whenever existing records are moved or removed, so that
+	/// other processes know to rebuild their index
+	uint64_t generation;
+	/// Offset of the end of the last complete record
+	uint64_t end;
+};
+
+/// Records are followed by the key and then the value, and padded so that
+/// the next record is 8-byte aligned
+struct RecordHeader {
+	uint32_t key_size;
+	uint32_t value_size;
+	/// Time of the last read or write, for choosing what to keep when
+	/// compacting
+	uint64_t last_used;
+};
+
+/// Files start at this size and double as needed up to the maximum size
+const uint64_t min_file_size = 64 * 1024;
+
+uint64_t record_size(uint64_t key_size, uint64_t value_size) {
+	return (sizeof(RecordHeader) + key_size + value_size + 7) & ~7ULL;
+}
+
+uint64_t record_size(RecordHeader const* record) {
+	return record_size(record->key_size, record->value_size);
+}
+
+uint64_t now() {
+	using namespace std::chrono;
+	return duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
+}
+}
+
+namespace agi {
+PersistentCache::PersistentCache(fs::path const& filename, uint64_t max_size)
+: filename(filename)
+, max_size(std::max(max_size, min_file_size))
+{
+	fs::CreateDirectory(filename.parent_path());
+
+	// The lock is on a separate file because POSIX locks are released when
+	// any descriptor for the file is closed, including the one used for
+	// mapping it
+	auto lock_filename = filename;
+	lock_filename += ".lock";
+	{ file_mapping create(lock_filename, true); }
+
+	try {
+		lock = agi::make_unique<file_lock>(lock_filename.string().c_str());
+	}
+	catch (interprocess_exception const&) {
+		throw fs::FileSystemUnknownError("Failed to open cache lock file: " + lock_filename.string());
+	}
+
+	file = agi::make_unique<file_mapping>(filename, true);
+	if (file->get_mapping_handle().handle == ipcdetail::invalid_file())
+		throw fs::FileSystemUnknownError("Failed to open cache file: " + filename.string());
+
+	scoped_lock<file_lock> guard(*lock);
+	if (file_size() < sizeof(FileHeader))
+		Reset();
+	else {
+		Remap();
+		if (!IsValid())
+			Reset();
+	}
+}
+
+PersistentCache::~PersistentCache() { }
+
+char *PersistentCache::data() const {
+	return static_cast<char *>(region->get_address());
+}
+
+uint64_t PersistentCache::mapped_size() const {
+	return region ? region->get_size() : 0;
+}
+
+uint64_t PersistentCache::file_size() const {
+	offset_t size = 0;
+	ipcdetail::get_file_size(file->get_mapping_handle().handle, size);
+	return static_cast<uint64_t>(size);
+}
+
+void PersistentCache::Remap() {
+	try {
+		region = agi::make_unique<mapped_region>(*file, read_write, 0, static_cast<size_t>(file_size()));
+	}
+	catch (interprocess_exception const&) {
+		throw fs::FileSystemUnknownError("Failed mapping a view of the cache file");
+	}
+}
+
+bool PersistentCache::IsValid() const {
+	if (mapped_size() < sizeof(FileHeader)) return false;
+	auto header = reinterpret_cast<FileHeader const*>(data());
+	return memcmp(header->magic, magic, sizeof(magic)) == 0
+		&& header->version == version
+		&& header->end >= sizeof(FileHeader)
+		&& header->end <= file_size();
+}
+
+void PersistentCache::Reset() {
+	if (file_size() < min_file_size && !ipcdetail::truncate_file(file->get_mapping_handle().handle, min_file_size))
+		throw fs::FileSystemUnknownError("Failed to resize cache file: " + filename.string());
+	Remap();
+
+	auto header = reinterpret_cast<FileHeader *>(data());
+	memcpy(header->magic, magic, sizeof(magic));
+	header->version = version;
+	header->reserved = 0;
+	header->generation = now();
+	header->end = sizeof(FileHeader);
+}
+
+void PersistentCache::Update() {
+	auto header = reinterpret_cast<FileHeader const*>(data());
+	if (header->generation != generation) {
+		index.clear();
+		generation = header->generation;
+		indexed_end = sizeof(FileHeader);
+	}
+
+	// Another process may have grown the file
+	if (header->end > mapped_size()) {
+		Remap();
+		header = reinterpret_cast<FileHeader const*>(data());
+	}
+
+	while (indexed_end < header->end) {
+		auto record = reinterpret_cast<RecordHeader const*>(data() + indexed_end);
+		auto size = record_size(record);
+		if (indexed_end + size > header->end) break;
+		index[std::string(reinterpret_cast<const char *>(record + 1), record->key_size)] = indexed_end;
+		indexed_end += size;
+	}
+}
+
+void PersistentCache::Compact(uint64_t needed) {
+	std::vector<std::pair<uint64_t, uint64_t>> by_last_use;
+	by_last_use.reserve(index.size());
+	for (auto const& entry : index) {
+		auto record = reinterpret_cast<RecordHeader const*>(data() + entry.second);
+		by_last_use.emplace_back(record->last_used, entry.second);
+	}
+	std::sort(by_last_use.rbegin(), by_last_use.rend());
+
+	// Compact to three quarters of the maximum size so that the next few
+	// writes don't immediately need another compaction
+	uint64_t budget = (max_size - sizeof(FileHeader)) / 4 * 3;
+	budget = budget > needed ? budget - needed : 0;
+
+	std::vector<uint64_t> kept;
+	uint64_t kept_size = 0;
+	for (auto const& entry : by_last_use) {
+		auto size = record_size(reinterpret_cast<RecordHeader const*>(data() + entry.second));
+		if (kept_size + size > budget) break;
+		kept_size += size;
+		kept.push_back(entry.second);
+	}
+	std::sort(kept.begin(), kept.end());
+
+	std::string records;
+	records.reserve(kept_size);
+	for (auto offset : kept)
+		records.append(data() + offset, record_size(reinterpret_cast<RecordHeader const*>(data() + offset)));
+
+	// Empty the cache before moving records, so that if the process dies
+	// part way through the file is left empty rather than corrupt
+	auto header = reinterpret_cast<FileHeader *>(data());
+	header->end = sizeof(FileHeader);
+	++header->generation;
+	memcpy(data() + sizeof(FileHeader), records.data(), records.size());
+	header->end = sizeof(FileHeader) + records.size();
+
+	Update();
+}
+
+bool PersistentCache::Get(std::string const& key, std::string& value) {
+	std::lock_guard<std::mutex> lock_thread(mutex);
+	sharable_lock<file_lock> guard(*lock);
+	if (!IsValid()) return false;
+	Update();
+
+	auto it = index.find(key);
+	if (it == index.end()) return false;
+
+	auto record = reinterpret_cast<RecordHeader *>(data() + it->second);
+	value.assign(reinterpret_cast<const char *>(record + 1) + record->key_size, record->value_size);
+	// Concurrent readers may race on this, but any of their times will do
+	record->last_used = now();
+	return true;
+}
+
+void PersistentCache::Put(std::string const& key, std::string const& value) {
+	auto size = record_size(key.size(), value.size());
+	if (size > max_size - sizeof(FileHeader)) return;
+
+	std::lock_guard<std::mutex> lock_thread(mutex);
+	scoped_lock<file_lock> guard(*lock);
+	if (!IsValid()) Reset();
+	Update();
+
+	// Rewriting the same value is common when rerunning over unchanged
+	// input, and shouldn't grow the file
+	auto it = index.find(key);
+	if (it != index.end()) {
+		auto record = reinterpret_cast<RecordHeader *>(data() + it->second);
+		auto existing = reinterpret_cast<const char *>(record + 1) + record->key_size;
+		if (record->value_size == value.size() && memcmp(existing, value.data(), value.size()) == 0) {
+			record->last_used = now();
+			return;
+		}
+	}
+
+	auto header = reinterpret_cast<FileHeader *>(data());
+	if (header->end + size > max_size)
+		Compact(size);
+
+	auto end = header->end + size;
+	if (end > file_size()) {
+		auto new_size = std::min(max_size, std::max(end, file_size() * 2));
+		if (!ipcdetail::truncate_file(file->get_mapping_handle().handle, new_size))
+			throw fs::FileSystemUnknownError("Failed to resize cache file: " + filename.string());
+	}
+	if (end > mapped_size()) {
+		Remap();
+		header = reinterpret_cast<FileHeader *>(data());
+	}
+
+	auto record = reinterpret_cast<RecordHeader *>(data() + header->end);
+	record->key_size = key.size();
+	record->value_size = value.size();
+	record->last_used = now();
+	memcpy(record + 1, key.data(), key.size());
+	memcpy(reinterpret_cast<char *>(record + 1) + key.size(), value.data(), value.size());
+
+	// Only make the record visible to other processes once it's complete
+	index[key] = header->end;
+	header->end = end;
+	indexed_end = end;
+}
+}
@@ -0,0 +1,93 @@
+// Copyright (c) 2026, Aegisub CLI contributors
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+// Aegisub Project http://www.aegisub.org/
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace agi { namespace ass {
+/// An affine transform of the plane, mapping (x, y) to
+/// (xx * x + xy * y + dx, yx * x + yy * y + dy)
+struct Transform {
+	double xx = 1, xy = 0, dx = 0;
+	double yx = 0, yy = 1, dy = 0;
+
+	static Transform Translate(double x, double y);
+	static Transform Scale(double x, double y);
+	/// Rotate by an angle in degrees, counterclockwise on screen as \frz does
+	static Transform Rotate(double degrees);
+	/// Shear by the given factors, as \fax and \fay do
+	static Transform Shear(double x, double y);
+
+	/// Get the transform which applies this one and then next
+	Transform Then(Transform const& next) const;
+};
+
+/// @class Drawing
+/// @brief A parsed vector drawing, as used by \p and \clip
+///
+/// Commands are stored apart from a flat array of coordinates, so that
+/// transforming a drawing is a single pass over the coordinates and
+/// serializing it is a single pass over both.
+class Drawing {
+public:
+	struct Command {
+		/// Lower-case command letter, or 0 for coordinates which came before
+		/// any command
+		char type;
+		/// Number of coordinates (not points) belonging to the command
+		size_t count;
+	};
+
+private:
+	std::vector<Command> commands;
+	/// The coordinates of each command in turn, alternating x and y
+	std::vector<double> coords;
+
+public:
+	Drawing() = default;
+	explicit Drawing(std::string const& text) { Parse(text); }
+
+	/// Replace the drawing with one parsed from text. Tokens are separated
+	/// by spaces, and tokens which are neither numbers nor one of the
+	/// command letters m, n, l, b, s, p and c are ignored.
+	void Parse(const char *begin, const char *end);
+	void Parse(std::string const& text) { Parse(text.data(), text.data() + text.size()); }
+
+	/// Transform every point of the drawing. A command with an odd number
+	/// of coordinates has its last x transformed as if its y were 0.
+	void Apply(Transform const& transform);
+
+	/// Round every coordinate to the nearest multiple of step
+	void Round(double step);
+
+	/// Get the bounding box of the drawing's points. Curves lie within the
+	/// box of their control points, so this contains the whole drawing,
+	/// though it may not be the tightest box that does.
+	/// @return false if the drawing has no points
+	bool BoundingBox(double& x1, double& y1, double& x2, double& y2) const;
+
+	/// Append the drawing to a string, with numbers written to at most
+	/// three decimal places
+	void Serialize(std::string& out) const;
+	std::string Serialize() const;
+
+	std::vector<Command> const& Commands() const { return commands; }
+	std::vector<double> const& Coords() const { return coords; }
+	std::vector<double>& Coords() { return coords; }
+};
+} }
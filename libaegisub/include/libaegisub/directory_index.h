@@ -0,0 +1,81 @@
+// Copyright (c) 2026, Aegisub CLI contributors
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+// Aegisub Project http://www.aegisub.org/
+
+#pragma once
+
+#include <libaegisub/fs_fwd.h>
+
+#include <boost/filesystem/path.hpp>
+#include <ctime>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace agi { namespace fs {
+/// @class DirectoryIndex
+/// @brief Snapshot of the files under a set of directories
+///
+/// Looking up files in the index avoids a stat call for every candidate path
+/// which is in it when searching several directories for a file. Paths are
+/// compared case-insensitively on Windows and macOS, as their filesystems
+/// are. The index isn't updated when files are created or modified after the
+/// directory is added, so FileExists checks the filesystem before reporting
+/// a miss and rescans the directory if the file has appeared since, and
+/// Remove drops files which turn out to be gone.
+class DirectoryIndex {
+public:
+	struct FileInfo {
+		time_t modified;
+		uintmax_t size;
+	};
+
+private:
+	/// Indexed directories, as normalized generic strings
+	std::vector<std::string> roots;
+	/// Files under the indexed directories, by normalized generic path
+	std::unordered_map<std::string, FileInfo> files;
+
+	static std::string Key(path const& p);
+
+	/// Add the files under an indexed directory to the index
+	void Scan(path const& dir);
+
+public:
+	/// Add all of the files under a directory to the index, recursively
+	///
+	/// Adding a directory which is already in the index or doesn't exist
+	/// does nothing.
+	void Add(path const& dir);
+
+	/// Is the path inside one of the indexed directories?
+	bool Covers(path const& p) const;
+
+	/// Get the information about a file when it was indexed
+	/// @return nullptr if the file is not in the index
+	FileInfo const* Find(path const& p) const;
+
+	/// Check if a regular file exists, using the index for paths it covers
+	/// and the filesystem for others
+	///
+	/// A covered path which isn't in the index is checked on the filesystem
+	/// too, and if it exists the directory containing it is indexed again.
+	bool FileExists(path const& p);
+
+	/// Drop a file which was found to no longer exist from the index
+	void Remove(path const& p);
+};
+} }
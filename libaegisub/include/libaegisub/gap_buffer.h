@@ -0,0 +1,123 @@
+// Copyright (c) 2026, Aegisub CLI contributors
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+// Aegisub Project http://www.aegisub.org/
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <vector>
+
+namespace agi {
+
+/// @class gap_buffer
+/// @brief Sequence with amortized O(1) insertion and removal near the
+///        previous edit
+///
+/// The elements are stored in a single array with a hole at the position of
+/// the most recent edit. Inserting or erasing moves the hole to the edit
+/// position, so runs of edits at or near the same place (appending to one
+/// section, deleting in a loop) cost O(1) each rather than shifting
+/// everything after them. Random access is O(1).
+template<typename T>
+class gap_buffer {
+	std::vector<T> buf;
+	size_t gap_begin = 0;
+	size_t gap_end = 0;
+
+	size_t gap_size() const { return gap_end - gap_begin; }
+
+	/// Move the gap so that it begins at the given logical position
+	void move_gap(size_t pos) {
+		if (pos < gap_begin) {
+			std::move_backward(buf.begin() + pos, buf.begin() + gap_begin, buf.begin() + gap_end);
+			gap_end -= gap_begin - pos;
+			gap_begin = pos;
+		}
+		else if (pos > gap_begin) {
+			size_t count = pos - gap_begin;
+			std::move(buf.begin() + gap_end, buf.begin() + gap_end + count, buf.begin() + gap_begin);
+			gap_begin += count;
+			gap_end += count;
+		}
+	}
+
+	/// Ensure that the gap can hold at least count more elements
+	void reserve_gap(size_t count) {
+		if (gap_size() >= count) return;
+
+		size_t old_size = size();
+		size_t new_capacity = std::max<size_t>(std::max<size_t>(old_size * 2, old_size + count), 16);
+		std::vector<T> new_buf(new_capacity);
+		std::move(buf.begin(), buf.begin() + gap_begin, new_buf.begin());
+		size_t new_gap_end = new_capacity - (buf.size() - gap_end);
+		std::move(buf.begin() + gap_end, buf.end(), new_buf.begin() + new_gap_end);
+		buf = std::move(new_buf);
+		gap_end = new_gap_end;
+	}
+
+public:
+	gap_buffer() = default;
+
+	size_t size() const { return buf.size() - gap_size(); }
+	bool empty() const { return size() == 0; }
+
+	T& operator[](size_t i) { return buf[i < gap_begin ? i : i + gap_size()]; }
+	T const& operator[](size_t i) const { return buf[i < gap_begin ? i : i + gap_size()]; }
+
+	/// Insert a value before the element at pos
+	void insert(size_t pos, T value) {
+		reserve_gap(1);
+		move_gap(pos);
+		buf[gap_begin++] = std::move(value);
+	}
+
+	/// Insert a range of values before the element at pos
+	template<typename InputIterator>
+	void insert(size_t pos, InputIterator first, InputIterator last) {
+		reserve_gap(std::distance(first, last));
+		move_gap(pos);
+		for (; first != last; ++first)
+			buf[gap_begin++] = *first;
+	}
+
+	void push_back(T value) { insert(size(), std::move(value)); }
+
+	/// Remove the elements in [first, last)
+	void erase(size_t first, size_t last) {
+		if (first >= last) return;
+		move_gap(last);
+		gap_begin = first;
+	}
+
+	void erase(size_t pos) { erase(pos, pos + 1); }
+
+	void clear() {
+		buf.clear();
+		gap_begin = gap_end = 0;
+	}
+
+	/// Get the elements as a contiguous array
+	std::vector<T> to_vector() const {
+		std::vector<T> ret;
+		ret.reserve(size());
+		ret.insert(ret.end(), buf.begin(), buf.begin() + gap_begin);
+		ret.insert(ret.end(), buf.begin() + gap_end, buf.end());
+		return ret;
+	}
+};
+
+}
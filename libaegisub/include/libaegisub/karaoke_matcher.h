@@ -25,6 +25,22 @@ namespace agi {
 		size_t destination_length;
 	};
 
+	/// A group of source strings and the portion of the destination matched to them
+	struct karaoke_match_group {
+		/// The number of strings in the source in the group
+		size_t source_length;
+		/// The matched portion of the destination string
+		std::string destination;
+	};
+
 	/// Try to automatically select the portion of dst which corresponds to the first string in src
 	karaoke_match_result auto_match_karaoke(std::vector<std::string> const& src, std::string const& dst);
+
+	/// Split all of dst between the strings in src, matching groups as
+	/// auto_match_karaoke does. Any of dst left over once src runs out goes
+	/// to the last group.
+	///
+	/// This is much faster than calling auto_match_karaoke once per group, as
+	/// the characters of dst and their collation keys are only found once.
+	std::vector<karaoke_match_group> match_karaoke_line(std::vector<std::string> const& src, std::string const& dst);
 }
@@ -26,4 +26,10 @@ namespace agi { namespace lua {
 	/// Install our module loader and add include_path to the module search
 	/// path of the given lua state
 	bool Install(lua_State *L, std::vector<fs::path> const& include_path);
+	/// Set the directory to store the compiled Lua code of MoonScript files
+	/// and the bytecode of Lua files in. If this is never called, compiled
+	/// code is only cached in memory. Entries for files which have changed or
+	/// been deleted are removed, as are the least recently used entries once
+	/// there are too many.
+	void SetCacheDirectory(agi::fs::path const& dir);
 } }
@@ -0,0 +1,98 @@
+// Copyright (c) 2026, Aegisub CLI contributors
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+// Aegisub Project http://www.aegisub.org/
+
+#pragma once
+
+#include <libaegisub/fs_fwd.h>
+
+#include <boost/filesystem/path.hpp>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace boost { namespace interprocess {
+	class file_lock;
+	class mapped_region;
+} }
+
+namespace agi {
+class file_mapping;
+
+/// @class PersistentCache
+/// @brief Key-value store kept in a file which may be shared by several
+///        processes
+///
+/// Records are appended to a memory-mapped file, with a later record for a
+/// key replacing any earlier ones. Each record stores when it was last
+/// read, and when appending would take the file past its maximum size the
+/// most recently used records are kept and the rest discarded.
+///
+/// Reads take a shared lock on a lock file next to the cache and writes an
+/// exclusive one, so processes using the same file see each other's
+/// writes. Within a process the cache may be used from any thread.
+class PersistentCache {
+	fs::path filename;
+	uint64_t max_size;
+
+	std::mutex mutex;
+	std::unique_ptr<boost::interprocess::file_lock> lock;
+	std::unique_ptr<file_mapping> file;
+	std::unique_ptr<boost::interprocess::mapped_region> region;
+
+	/// Offset of the most recent record for each key
+	std::unordered_map<std::string, uint64_t> index;
+	/// Generation of the file which the index was built from
+	uint64_t generation = 0;
+	/// Offset up to which the records have been added to the index
+	uint64_t indexed_end = 0;
+
+	char *data() const;
+	uint64_t mapped_size() const;
+	uint64_t file_size() const;
+
+	/// Map the whole file, after another process has grown it
+	void Remap();
+	/// Does the file have a valid header?
+	bool IsValid() const;
+	/// Replace the contents of the file with an empty cache
+	void Reset();
+	/// Bring the index up to date with the records in the file
+	void Update();
+	/// Discard the least recently used records until there is room for
+	/// a new record of the given size
+	void Compact(uint64_t needed);
+
+public:
+	/// Open a cache file, creating it if it doesn't exist
+	/// @param filename File to store the cache in
+	/// @param max_size Maximum size of the file in bytes
+	PersistentCache(fs::path const& filename, uint64_t max_size);
+	~PersistentCache();
+
+	/// Look up the value for a key
+	/// @param[out] value Value if found
+	/// @return Was the key found?
+	bool Get(std::string const& key, std::string& value);
+
+	/// Store the value for a key, replacing any existing value
+	///
+	/// Values which are too large to fit in the cache at all are not
+	/// stored.
+	void Put(std::string const& key, std::string const& value);
+};
+}
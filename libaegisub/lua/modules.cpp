@@ -20,8 +20,10 @@
 #include "libaegisub/lua/utils.h"
 
 extern "C" int luaopen_luabins(lua_State *L);
+extern "C" int luaopen_drawing_impl(lua_State *L);
 extern "C" int luaopen_re_impl(lua_State *L);
 extern "C" int luaopen_unicode_impl(lua_State *L);
+extern "C" int luaopen_util_impl(lua_State *L);
 extern "C" int luaopen_lfs_impl(lua_State *L);
 extern "C" int luaopen_lpeg(lua_State *L);
 
@@ -36,7 +38,9 @@ void preload_modules(lua_State *L) {
 
 	set_field(L, "aegisub.__re_impl", luaopen_re_impl);
 	set_field(L, "aegisub.__unicode_impl", luaopen_unicode_impl);
+	set_field(L, "aegisub.__util_impl", luaopen_util_impl);
 	set_field(L, "aegisub.__lfs_impl", luaopen_lfs_impl);
+	set_field(L, "aegisub.__drawing_impl", luaopen_drawing_impl);
 	set_field(L, "lpeg", luaopen_lpeg);
 	set_field(L, "luabins", luaopen_luabins);
 
@@ -0,0 +1,114 @@
+// Copyright (c) 2026, Aegisub CLI contributors
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+// Aegisub Project http://www.aegisub.org/
+
+// Bindings for agi::ass::Drawing, so that shape libraries can transform
+// drawings without splitting and reformatting them in Lua. The coordinates
+// are exposed as a pointer into the drawing so that scripts can also read
+// and modify them directly.
+
+#include "libaegisub/ass/drawing.h"
+#include "libaegisub/lua/ffi.h"
+
+#include <string>
+
+namespace {
+struct agi_drawing {
+	agi::ass::Drawing drawing;
+};
+}
+
+namespace agi {
+	AGI_DEFINE_TYPE_NAME(agi_drawing);
+}
+
+namespace {
+// Strings returned to Lua point into this buffer, which is reused by the
+// next call on the same thread
+thread_local std::string result;
+
+agi_drawing *drawing_parse(const char *str, size_t len) {
+	auto drawing = new agi_drawing;
+	drawing->drawing.Parse(str, str + len);
+	return drawing;
+}
+
+void drawing_free(agi_drawing *drawing) {
+	delete drawing;
+}
+
+void drawing_transform(agi_drawing *drawing, double xx, double xy, double dx, double yx, double yy, double dy) {
+	agi::ass::Transform t;
+	t.xx = xx;
+	t.xy = xy;
+	t.dx = dx;
+	t.yx = yx;
+	t.yy = yy;
+	t.dy = dy;
+	drawing->drawing.Apply(t);
+}
+
+void drawing_round(agi_drawing *drawing, double step) {
+	drawing->drawing.Round(step);
+}
+
+/// @param[out] out x1, y1, x2 and y2
+bool drawing_bounds(agi_drawing *drawing, double *out) {
+	return drawing->drawing.BoundingBox(out[0], out[1], out[2], out[3]);
+}
+
+const char *drawing_serialize(agi_drawing *drawing) {
+	result.clear();
+	drawing->drawing.Serialize(result);
+	return result.c_str();
+}
+
+int drawing_command_count(agi_drawing *drawing) {
+	return static_cast<int>(drawing->drawing.Commands().size());
+}
+
+/// @return The command letter, or 0 for coordinates before any command
+char drawing_command_type(agi_drawing *drawing, int i) {
+	return drawing->drawing.Commands()[i].type;
+}
+
+int drawing_command_length(agi_drawing *drawing, int i) {
+	return static_cast<int>(drawing->drawing.Commands()[i].count);
+}
+
+int drawing_coord_count(agi_drawing *drawing) {
+	return static_cast<int>(drawing->drawing.Coords().size());
+}
+
+double *drawing_coords(agi_drawing *drawing) {
+	return drawing->drawing.Coords().data();
+}
+}
+
+extern "C" int luaopen_drawing_impl(lua_State *L) {
+	agi::lua::register_lib_table(L, {"agi_drawing"},
+		"parse", drawing_parse,
+		"free", drawing_free,
+		"transform", drawing_transform,
+		"round", drawing_round,
+		"bounds", drawing_bounds,
+		"serialize", drawing_serialize,
+		"command_count", drawing_command_count,
+		"command_type", drawing_command_type,
+		"command_length", drawing_command_length,
+		"coord_count", drawing_coord_count,
+		"coords", drawing_coords);
+	return 1;
+}
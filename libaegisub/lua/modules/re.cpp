@@ -18,6 +18,12 @@
 #include "libaegisub/make_unique.h"
 
 #include <boost/regex/icu.hpp>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 using boost::u32regex;
 namespace {
@@ -43,6 +49,83 @@ namespace agi {
 
 namespace {
 using match = agi_re_match;
+
+/// Compiled regexes shared by all Lua states, most recently used first.
+/// Scripts mostly use the module-level functions which compile the pattern
+/// on every call, so recompiling the same handful of patterns would
+/// otherwise dominate regex-heavy scripts.
+class regex_cache {
+	static const size_t max_size = 128;
+
+	typedef std::pair<std::string, std::shared_ptr<u32regex>> entry;
+
+	std::mutex mutex;
+	std::list<entry> lru;
+	std::unordered_map<std::string, std::list<entry>::iterator> index;
+	/// Regexes returned to Lua which haven't been freed yet, with the
+	/// number of references to each. These may have been evicted from the
+	/// cache, but can't be destroyed until Lua is done with them.
+	std::unordered_map<u32regex *, std::pair<std::shared_ptr<u32regex>, size_t>> live;
+
+	u32regex *add_reference(std::shared_ptr<u32regex> const& re) {
+		auto& ref = live[re.get()];
+		ref.first = re;
+		++ref.second;
+		return re.get();
+	}
+
+public:
+	/// Get a compiled regex for the pattern and flags, compiling it if it
+	/// isn't cached. The caller must call release() when done with it.
+	u32regex *acquire(const char *pattern, int flags) {
+		auto key = std::to_string(flags) + ':' + pattern;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto it = index.find(key);
+			if (it != index.end()) {
+				lru.splice(lru.begin(), lru, it->second);
+				return add_reference(it->second->second);
+			}
+		}
+
+		// Compile without holding the lock; if another thread compiles the
+		// same pattern in the meantime, one of the copies just goes unused
+		auto re = std::make_shared<u32regex>(boost::make_u32regex(pattern, boost::u32regex::perl | flags));
+
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = index.find(key);
+		if (it != index.end())
+			return add_reference(it->second->second);
+
+		lru.emplace_front(key, re);
+		index[key] = lru.begin();
+		if (lru.size() > max_size) {
+			index.erase(lru.back().first);
+			lru.pop_back();
+		}
+		return add_reference(re);
+	}
+
+	void release(u32regex *re) {
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = live.find(re);
+		if (it != live.end() && --it->second.second == 0)
+			live.erase(it);
+	}
+};
+
+regex_cache& cache() {
+	static regex_cache cache;
+	return cache;
+}
+
+// Results returned to Lua point into these per-thread buffers rather than
+// being allocated for each call. They're only valid until the next call on
+// the same thread, so the Lua side copies them out immediately.
+thread_local boost::cmatch search_result;
+thread_local int search_range[2];
+thread_local std::vector<int> match_ranges;
+
 bool search(u32regex& re, const char *str, size_t len, int start, boost::cmatch& result) {
 	return u32regex_search(str + start, str + len, result, re,
 		start > 0 ? boost::match_prev_avail | boost::match_not_bob : boost::match_default);
@@ -64,14 +147,75 @@ int *regex_get_match(match& match, size_t idx) {
 }
 
 int *regex_search(u32regex& re, const char *str, size_t len, size_t start) {
-	boost::cmatch result;
+	auto& result = search_result;
 	if (!search(re, str, len, start, result))
 		return nullptr;
 
-	auto ret = static_cast<int *>(malloc(sizeof(int) * 2));
-	ret[0] = start + result.position() + 1;
-	ret[1] = start + result.position() + result.length();
-	return ret;
+	search_range[0] = start + result.position() + 1;
+	search_range[1] = start + result.position() + result.length();
+	return search_range;
+}
+
+/// Find up to max_count non-overlapping matches, advancing past empty
+/// matches as RegEx:gfind does
+/// @return The one-based inclusive range of each match, as consecutive pairs
+int *regex_find_all(u32regex& re, const char *str, size_t len, int max_count, int *count) {
+	auto& result = search_result;
+	auto& ranges = match_ranges;
+	ranges.clear();
+
+	*count = 0;
+	size_t start = 0;
+	while (start <= len && *count < max_count && search(re, str, len, start, result)) {
+		int first = start + result.position() + 1;
+		int last = start + result.position() + result.length();
+		ranges.push_back(first);
+		ranges.push_back(last);
+		++*count;
+		start = static_cast<size_t>(last) > start ? last : start + 1;
+	}
+	return ranges.data();
+}
+
+/// Find the matches and capture groups for up to max_count rounds of
+/// replacement with a function, following the same rules for where to
+/// resume searching as replacing one match at a time with RegEx:match does
+/// @return For each match, the number of groups followed by the one-based
+///         inclusive range of each group, stopping at the first group which
+///         didn't participate in the match
+int *regex_match_all(u32regex& re, const char *str, size_t len, int max_count, int *count) {
+	auto& result = search_result;
+	auto& ranges = match_ranges;
+	ranges.clear();
+
+	*count = 0;
+	size_t pos = 0;
+	while (pos <= len && *count < max_count && search(re, str, len, pos, result)) {
+		++*count;
+		size_t header = ranges.size();
+		ranges.push_back(0);
+
+		int first = 0, last = 0;
+		for (size_t i = 0; i < result.size() && result[i].matched; ++i) {
+			first = pos + std::distance(result.prefix().first, result[i].first) + 1;
+			last = pos + std::distance(result.prefix().first, result[i].second);
+			ranges.push_back(first);
+			ranges.push_back(last);
+			++ranges[header];
+		}
+
+		// Resume after the last group replaced, always consuming at least
+		// one character
+		size_t next = last;
+		if (first == last + 1)
+			++next;
+
+		// Stop once a match is past the end of the string
+		if (ranges[header + 1] > static_cast<int>(len))
+			break;
+		pos = next;
+	}
+	return ranges.data();
 }
 
 char *regex_replace(u32regex& re, const char *replacement, const char *str, size_t len, int max_count) {
@@ -96,10 +240,8 @@ char *regex_replace(u32regex& re, const char *replacement, const char *str, size
 }
 
 u32regex *regex_compile(const char *pattern, int flags, char **err) {
-	auto re = agi::make_unique<u32regex>();
 	try {
-		*re = boost::make_u32regex(pattern, boost::u32regex::perl | flags);
-		return re.release();
+		return cache().acquire(pattern, flags);
 	}
 	catch (std::exception const& e) {
 		*err = strdup(e.what());
@@ -107,7 +249,7 @@ u32regex *regex_compile(const char *pattern, int flags, char **err) {
 	}
 }
 
-void regex_free(u32regex *re) { delete re; }
+void regex_free(u32regex *re) { cache().release(re); }
 void match_free(match *m) { delete m; }
 
 const agi_re_flag *get_regex_flags() {
@@ -130,6 +272,8 @@ const agi_re_flag *get_regex_flags() {
 extern "C" int luaopen_re_impl(lua_State *L) {
 	agi::lua::register_lib_table(L, {"agi_re_match", "u32regex"},
 		"search", regex_search,
+		"find_all", regex_find_all,
+		"match_all", regex_match_all,
 		"match", regex_match,
 		"get_match", regex_get_match,
 		"replace", regex_replace,
@@ -16,24 +16,162 @@
 
 #include <libaegisub/lua/ffi.h>
 
+#include <algorithm>
 #include <boost/locale/conversion.hpp>
+#include <memory>
+#include <vector>
+
+#include <unicode/brkiter.h>
+#include <unicode/normalizer2.h>
+#include <unicode/unistr.h>
+#include <unicode/utext.h>
 
 namespace {
+/// The global locale is set once at startup, and copying it for each call
+/// is a measurable part of converting short strings
+std::locale const& locale() {
+	static const std::locale loc;
+	return loc;
+}
+
 template<std::string (*func)(const char *, std::locale const&)>
 char *wrap(const char *str, char **err) {
 	try {
-		return agi::lua::strndup(func(str, std::locale()));
+		return agi::lua::strndup(func(str, locale()));
 	} catch (std::exception const& e) {
 		*err = strdup(e.what());
 		return nullptr;
 	}
 }
+
+/// Width in bytes of the character starting with the given byte, treating
+/// invalid lead bytes the same way as unicode.charwidth does
+size_t char_width(unsigned char b) {
+	return b < 128 ? 1 : b < 224 ? 2 : b < 240 ? 3 : 4;
+}
+
+size_t utf8_len(const char *str, size_t len) {
+	size_t count = 0;
+	for (size_t i = 0; i < len; i += char_width(str[i]))
+		++count;
+	return count;
+}
+
+struct utext_deleter {
+	void operator()(UText *ut) { if (ut) utext_close(ut); }
+};
+
+/// Offsets returned to Lua point into this buffer, which is reused by the
+/// next call on the same thread
+thread_local std::vector<size_t> offsets;
+
+void grapheme_offsets(const char *str, size_t len) {
+	// The iterator holds the text being iterated, so each thread needs its own
+	thread_local std::unique_ptr<icu::BreakIterator> bi;
+	UErrorCode status = U_ZERO_ERROR;
+	if (!bi) {
+		bi.reset(icu::BreakIterator::createCharacterInstance(icu::Locale::getDefault(), status));
+		if (U_FAILURE(status)) throw std::runtime_error("Failed to create character iterator");
+	}
+
+	std::unique_ptr<UText, utext_deleter> ut(utext_openUTF8(nullptr, str, len, &status));
+	if (U_FAILURE(status)) throw std::runtime_error("Failed to open utext");
+	bi->setText(ut.get(), status);
+	if (U_FAILURE(status)) throw std::runtime_error("Failed to set break iterator text");
+
+	for (auto pos = bi->first(); pos != icu::BreakIterator::DONE && static_cast<size_t>(pos) < len; pos = bi->next())
+		offsets.push_back(pos);
+}
+
+/// Get the byte offset of the start of each character or grapheme cluster
+/// in the string, followed by the length of the string
+/// @param count Set to the number of characters
+size_t *utf8_offsets(const char *str, size_t len, bool graphemes, size_t *count, char **err) {
+	offsets.clear();
+	try {
+		if (graphemes)
+			grapheme_offsets(str, len);
+		else {
+			for (size_t i = 0; i < len; i += char_width(str[i]))
+				offsets.push_back(i);
+		}
+	}
+	catch (std::exception const& e) {
+		*err = strdup(e.what());
+		return nullptr;
+	}
+	*count = offsets.size();
+	offsets.push_back(len);
+	return offsets.data();
+}
+
+/// Get the byte range [range[0], range[1]) of characters first through last,
+/// with negative indices counting from the end as with string.sub
+void utf8_sub(const char *str, size_t len, long first, long last, size_t *range) {
+	if (first < 0 || last < 0) {
+		long count = utf8_len(str, len);
+		if (first < 0) first = std::max(count + first + 1, 0L);
+		if (last < 0) last = count + last + 1;
+	}
+	first = std::max(first, 1L);
+
+	range[0] = range[1] = 0;
+	if (first > last) return;
+
+	size_t pos = 0;
+	long idx = 1;
+	for (; pos < len && idx < first; ++idx)
+		pos += char_width(str[pos]);
+	range[0] = std::min(pos, len);
+	for (; pos < len && idx <= last; ++idx)
+		pos += char_width(str[pos]);
+	range[1] = std::min(pos, len);
+}
+
+/// Normalize the string to NFC, NFD, NFKC or NFKD for forms 0-3
+char *utf8_normalize(const char *str, size_t len, int form, char **err) {
+	UErrorCode status = U_ZERO_ERROR;
+	const icu::Normalizer2 *norm = nullptr;
+	switch (form) {
+		case 0: norm = icu::Normalizer2::getNFCInstance(status); break;
+		case 1: norm = icu::Normalizer2::getNFDInstance(status); break;
+		case 2: norm = icu::Normalizer2::getNFKCInstance(status); break;
+		case 3: norm = icu::Normalizer2::getNFKDInstance(status); break;
+		default:
+			*err = strdup("Invalid normalization form");
+			return nullptr;
+	}
+	if (U_FAILURE(status)) {
+		*err = strdup(u_errorName(status));
+		return nullptr;
+	}
+
+	auto ustr = icu::UnicodeString::fromUTF8(icu::StringPiece(str, len));
+	// Most text is already normalized, so check first to skip re-encoding it
+	if (norm->isNormalized(ustr, status) && U_SUCCESS(status))
+		return agi::lua::strndup(std::string(str, len));
+
+	status = U_ZERO_ERROR;
+	auto normalized = norm->normalize(ustr, status);
+	if (U_FAILURE(status)) {
+		*err = strdup(u_errorName(status));
+		return nullptr;
+	}
+
+	std::string ret;
+	normalized.toUTF8String(ret);
+	return agi::lua::strndup(ret);
+}
 }
 
 extern "C" int luaopen_unicode_impl(lua_State *L) {
 	agi::lua::register_lib_table(L, {},
 		"to_upper_case", wrap<boost::locale::to_upper<char>>,
 		"to_lower_case", wrap<boost::locale::to_lower<char>>,
-		"to_fold_case", wrap<boost::locale::fold_case<char>>);
+		"to_fold_case", wrap<boost::locale::fold_case<char>>,
+		"len", utf8_len,
+		"offsets", utf8_offsets,
+		"sub", utf8_sub,
+		"normalize", utf8_normalize);
 	return 1;
 }
@@ -0,0 +1,278 @@
+// Copyright (c) 2026, Aegisub CLI contributors
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+// Aegisub Project http://www.aegisub.org/
+
+// Native implementations of the color and table helpers in aegisub.util.
+// string.format isn't compiled by LuaJIT, so scripts which build a color
+// for every character fall back to the interpreter for their whole loop;
+// calling these through the FFI instead keeps the loop compiled.
+
+#include "libaegisub/lua/ffi.h"
+#include "libaegisub/lua/utils.h"
+
+#include <cctype>
+#include <string>
+
+namespace {
+// Strings returned to Lua point into this buffer, which is reused by the
+// next call on the same thread
+thread_local std::string result;
+
+int hex_value(char c) {
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	return c - 'A' + 10;
+}
+
+bool is_hex(const char *str, size_t len, size_t pos, size_t count) {
+	if (pos + count > len) return false;
+	for (size_t i = pos; i < pos + count; ++i) {
+		if (!isxdigit(static_cast<unsigned char>(str[i])))
+			return false;
+	}
+	return true;
+}
+
+int hex_pair(const char *str) {
+	return hex_value(str[0]) * 16 + hex_value(str[1]);
+}
+
+/// Append a byte as two upper-case hex digits, as %02X does
+void append_hex(std::string &str, int value) {
+	static const char digits[] = "0123456789ABCDEF";
+	str += digits[(value >> 4) & 0xF];
+	str += digits[value & 0xF];
+}
+
+void append_ass_color(std::string &str, int r, int g, int b) {
+	str += "&H";
+	append_hex(str, b);
+	append_hex(str, g);
+	append_hex(str, r);
+	str += '&';
+}
+
+void append_ass_alpha(std::string &str, int a) {
+	str += "&H";
+	append_hex(str, a);
+	str += '&';
+}
+
+/// Find the first "&H" followed by the given number of pairs of hex digits
+/// and optionally a trailing "&", as the Lua patterns in extract_color did
+const char *find_ass_color(const char *str, size_t len, size_t pairs, bool trailing_amp) {
+	for (size_t i = 0; i + 1 < len; ++i) {
+		if (str[i] != '&' || str[i + 1] != 'H') continue;
+		if (!is_hex(str, len, i + 2, pairs * 2)) continue;
+		if (trailing_amp && (i + 2 + pairs * 2 >= len || str[i + 2 + pairs * 2] != '&')) continue;
+		return str + i + 2;
+	}
+	return nullptr;
+}
+
+/// Parse a color in any of the formats accepted by util.extract_color
+/// @param out r, g, b, a
+bool extract_color(const char *str, size_t len, int *out) {
+	// Style definition, &HAABBGGRR
+	if (auto p = find_ass_color(str, len, 4, false)) {
+		out[3] = hex_pair(p);
+		out[2] = hex_pair(p + 2);
+		out[1] = hex_pair(p + 4);
+		out[0] = hex_pair(p + 6);
+		return true;
+	}
+
+	// Color override, &HBBGGRR&
+	if (auto p = find_ass_color(str, len, 3, true)) {
+		out[2] = hex_pair(p);
+		out[1] = hex_pair(p + 2);
+		out[0] = hex_pair(p + 4);
+		out[3] = 0;
+		return true;
+	}
+
+	// Alpha override, &HAA&
+	if (auto p = find_ass_color(str, len, 1, true)) {
+		out[0] = out[1] = out[2] = 0;
+		out[3] = hex_pair(p);
+		return true;
+	}
+
+	// HTML, #RRGGBBAA with each component after the first having zero to
+	// two digits
+	for (size_t i = 0; i < len; ++i) {
+		if (str[i] != '#' || !is_hex(str, len, i + 1, 2)) continue;
+		out[0] = hex_pair(str + i + 1);
+		size_t pos = i + 3;
+		for (int c = 1; c < 4; ++c) {
+			int value = 0;
+			size_t digits = 0;
+			for (; digits < 2 && is_hex(str, len, pos, 1); ++digits, ++pos)
+				value = value * 16 + hex_value(str[pos]);
+			out[c] = value;
+		}
+		return true;
+	}
+
+	return false;
+}
+
+/// Interpolate as util.interpolate does, then truncate to a byte as
+/// string.format's %X does
+unsigned char interpolate(double pct, int first, int last) {
+	double value = pct <= 0 ? first : pct >= 1 ? last : pct * (last - first) + first;
+	return static_cast<unsigned char>(static_cast<int>(value));
+}
+
+/// Get the fraction for the ith of count evenly spaced steps from 0 to 1
+double step(size_t i, size_t count) {
+	return count > 1 ? static_cast<double>(i) / (count - 1) : 0;
+}
+
+const char *ass_color(int r, int g, int b) {
+	result.clear();
+	append_ass_color(result, r, g, b);
+	return result.c_str();
+}
+
+const char *ass_alpha(int a) {
+	result.clear();
+	append_ass_alpha(result, a);
+	return result.c_str();
+}
+
+const char *ass_style_color(int r, int g, int b, int a) {
+	result = "&H";
+	append_hex(result, a);
+	append_hex(result, b);
+	append_hex(result, g);
+	append_hex(result, r);
+	return result.c_str();
+}
+
+/// Interpolate between the colors count times, at the fractions in pcts if
+/// given and evenly spaced from first to last otherwise
+/// @return The override-formatted colors concatenated, or nullptr if either
+///         input isn't a color
+const char *interpolate_colors(const double *pcts, size_t count, const char *first, size_t first_len, const char *last, size_t last_len) {
+	int c1[4], c2[4];
+	if (!extract_color(first, first_len, c1) || !extract_color(last, last_len, c2))
+		return nullptr;
+
+	result.clear();
+	result.reserve(count * 9);
+	for (size_t i = 0; i < count; ++i) {
+		double pct = pcts ? pcts[i] : step(i, count);
+		append_ass_color(result, interpolate(pct, c1[0], c2[0]),
+			interpolate(pct, c1[1], c2[1]),
+			interpolate(pct, c1[2], c2[2]));
+	}
+	return result.c_str();
+}
+
+/// As interpolate_colors, but for the alpha channel in the &HAA& format
+const char *interpolate_alphas(const double *pcts, size_t count, const char *first, size_t first_len, const char *last, size_t last_len) {
+	int c1[4], c2[4];
+	if (!extract_color(first, first_len, c1) || !extract_color(last, last_len, c2))
+		return nullptr;
+
+	result.clear();
+	result.reserve(count * 5);
+	for (size_t i = 0; i < count; ++i) {
+		double pct = pcts ? pcts[i] : step(i, count);
+		append_ass_alpha(result, interpolate(pct, c1[3], c2[3]));
+	}
+	return result.c_str();
+}
+
+/// Tables with a __pairs metamethod may not iterate the same way as
+/// lua_next, so those are left to the Lua implementations
+bool has_pairs_metamethod(lua_State *L, int idx) {
+	if (!luaL_getmetafield(L, idx, "__pairs")) return false;
+	lua_pop(L, 1);
+	return true;
+}
+
+/// util.deep_copy: values are copied recursively, but a table seen a
+/// second time (including the table being copied) is the original rather
+/// than its copy
+/// @return false if a table with a __pairs metamethod was found
+bool deep_copy(lua_State *L, int seen) {
+	if (!lua_istable(L, -1)) return true;
+	if (has_pairs_metamethod(L, -1)) return false;
+
+	lua_pushvalue(L, -1);
+	lua_rawget(L, seen);
+	if (!lua_isnil(L, -1)) {
+		lua_remove(L, -2);
+		return true;
+	}
+	lua_pop(L, 1);
+
+	lua_pushvalue(L, -1);
+	lua_pushvalue(L, -1);
+	lua_rawset(L, seen);
+
+	int src = lua_gettop(L);
+	lua_newtable(L);
+	lua_pushnil(L);
+	while (lua_next(L, src)) {
+		luaL_checkstack(L, 4, "table too deeply nested");
+		if (!deep_copy(L, seen)) return false;
+		lua_pushvalue(L, -2);
+		lua_insert(L, -2);
+		lua_rawset(L, -4);
+	}
+	lua_remove(L, src);
+	return true;
+}
+
+/// @return The copy, or nil if the Lua implementation should be used
+int lua_copy(lua_State *L) {
+	luaL_checktype(L, 1, LUA_TTABLE);
+	if (has_pairs_metamethod(L, 1)) return 0;
+	lua_newtable(L);
+	lua_pushnil(L);
+	while (lua_next(L, 1)) {
+		lua_pushvalue(L, -2);
+		lua_insert(L, -2);
+		lua_rawset(L, 2);
+	}
+	return 1;
+}
+
+/// @return The copy, or nil if the Lua implementation should be used
+int lua_deep_copy(lua_State *L) {
+	luaL_checktype(L, 1, LUA_TTABLE);
+	lua_settop(L, 1);
+	lua_newtable(L);
+	lua_pushvalue(L, 1);
+	if (!deep_copy(L, 2)) return 0;
+	return 1;
+}
+}
+
+extern "C" int luaopen_util_impl(lua_State *L) {
+	agi::lua::register_lib_table(L, {},
+		"extract_color", extract_color,
+		"ass_color", ass_color,
+		"ass_alpha", ass_alpha,
+		"ass_style_color", ass_style_color,
+		"interpolate_colors", interpolate_colors,
+		"interpolate_alphas", interpolate_alphas);
+	agi::lua::set_field(L, "copy", lua_copy);
+	agi::lua::set_field(L, "deep_copy", lua_deep_copy);
+	return 1;
+}
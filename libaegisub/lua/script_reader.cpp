@@ -16,15 +16,370 @@
 
 #include "libaegisub/lua/script_reader.h"
 
+#include "libaegisub/directory_index.h"
 #include "libaegisub/file_mapping.h"
+#include "libaegisub/format.h"
+#include "libaegisub/io.h"
 #include "libaegisub/log.h"
 #include "libaegisub/lua/utils.h"
 #include "libaegisub/split.h"
 
+#include <algorithm>
 #include <boost/algorithm/string/replace.hpp>
+#include <cstdio>
 #include <lauxlib.h>
+#include <luajit.h>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+
+namespace {
+/// The result of compiling a MoonScript file
+struct CompiledMoonScript {
+	/// Cache entry header for the source file it was compiled from
+	std::string header;
+	/// Lua source code
+	std::string code;
+	/// MoonScript's map from Lua line numbers to positions in the original
+	/// file, used to rewrite the line numbers in error messages
+	std::vector<std::pair<int, int>> line_table;
+};
+
+/// Compiled files are cached by their canonical path, in memory for all Lua
+/// states in the process and on disk if a cache directory has been set, and
+/// are discarded if the file or the version of MoonScript has changed
+std::mutex moon_cache_mutex;
+std::unordered_map<std::string, std::shared_ptr<const CompiledMoonScript>> moon_cache;
+agi::fs::path moon_cache_dir;
+
+/// LuaJIT bytecode of a Lua file, along with the modification time and size
+/// of the file it was compiled from
+struct CompiledLua {
+	time_t modified;
+	uintmax_t size;
+	std::string bytecode;
+};
+
+/// Compiled Lua files are cached by their canonical path, in memory and on
+/// disk if a cache directory has been set, and are discarded if the file's
+/// modification time or size has changed
+std::mutex bytecode_cache_mutex;
+std::unordered_map<std::string, std::shared_ptr<const CompiledLua>> bytecode_cache;
+agi::fs::path bytecode_cache_dir;
+
+/// Largest size of each of the cache directories in bytes, past which the
+/// least recently used entries are removed
+const uintmax_t max_cache_dir_size = 32 << 20;
+
+/// Index of the files in the module include directories, built when a
+/// directory is first added to the include path so that searching
+/// package.path doesn't need to stat the files which are found
+std::mutex index_mutex;
+agi::fs::DirectoryIndex include_index;
+
+/// 64-bit FNV-1a
+uint64_t hash(const char *data, size_t len, uint64_t hash = 14695981039346656037ULL) {
+	for (size_t i = 0; i < len; ++i) {
+		hash ^= static_cast<unsigned char>(data[i]);
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+/// Get the modification time and size of a file
+bool file_info(agi::fs::path const& filename, time_t& modified, uintmax_t& size) {
+	try {
+		modified = agi::fs::ModifiedTime(filename);
+		size = agi::fs::Size(filename);
+		return true;
+	}
+	catch (agi::fs::FileSystemError const&) {
+		return false;
+	}
+}
+
+// Cache entries start with a header of two lines: the modification time,
+// size and path of the source file, and then something identifying what it
+// was compiled with. The path detects collisions in the hash used as the
+// entry's name, and lets entries for files which have since changed or been
+// deleted be found.
+
+std::string cache_header(std::string const& filename, time_t modified, uintmax_t size, std::string const& compiler) {
+	return agi::format("%lld %llu %s\n%s\n", (long long)modified, (unsigned long long)size, filename, compiler);
+}
+
+agi::fs::path cache_path(agi::fs::path const& dir, std::string const& filename, const char *extension) {
+	return dir/agi::format("%016llx%s", (unsigned long long)hash(filename.data(), filename.size()), extension);
+}
+
+/// Read a cache entry, touching it so that it counts as recently used
+/// @return Does the entry exist with the given header?
+bool read_cache_entry(agi::fs::path const& path, std::string const& header, std::string& data) {
+	if (!agi::fs::FileExists(path)) return false;
+
+	try {
+		{
+			agi::read_file_mapping file(path);
+			auto size = static_cast<size_t>(file.size());
+			// A mismatched header is just a stale entry which will be replaced
+			if (size < header.size() || header.compare(0, header.size(), file.read(), header.size()) != 0)
+				return false;
+			data.assign(file.read() + header.size(), size - header.size());
+		}
+		agi::fs::Touch(path);
+		return true;
+	}
+	catch (agi::Exception const& e) {
+		LOG_W("auto4/lua") << "Error reading compiled script cache file: " << e.GetMessage();
+		return false;
+	}
+}
+
+/// Remove the entries of a cache directory whose source files have changed
+/// or been deleted, and then the least recently used entries until the
+/// directory is no larger than max_cache_dir_size
+void clean_cache_dir(agi::fs::path const& dir, std::string const& filter) {
+	if (!agi::fs::DirectoryExists(dir)) return;
+
+	std::vector<std::string> files;
+	agi::fs::DirectoryIterator(dir, filter).GetAll(files);
+
+	using cache_item = std::pair<time_t, agi::fs::path>;
+	std::vector<cache_item> entries;
+	uintmax_t total_size = 0;
+	for (auto const& file : files) {
+		auto path = dir/file;
+		try {
+			std::string line;
+			getline(*agi::io::Open(path, true), line);
+
+			long long modified = 0;
+			unsigned long long size = 0;
+			int path_start = 0;
+			time_t source_modified;
+			uintmax_t source_size;
+			if (sscanf(line.c_str(), "%lld %llu %n", &modified, &size, &path_start) != 2 || !path_start
+				|| !file_info(line.substr(path_start), source_modified, source_size)
+				|| source_modified != modified || source_size != size) {
+				agi::fs::Remove(path);
+				continue;
+			}
+
+			entries.emplace_back(agi::fs::ModifiedTime(path), path);
+			total_size += agi::fs::Size(path);
+		}
+		catch (agi::Exception const& e) {
+			LOG_W("auto4/lua") << "Error cleaning compiled script cache file: " << e.GetMessage();
+		}
+	}
+
+	if (total_size <= max_cache_dir_size) return;
+
+	sort(begin(entries), end(entries), [](cache_item const& a, cache_item const& b) {
+		return a.first < b.first;
+	});
+	for (auto const& entry : entries) {
+		if (total_size <= max_cache_dir_size) break;
+		try {
+			auto size = agi::fs::Size(entry.second);
+			agi::fs::Remove(entry.second);
+			total_size -= size;
+		}
+		catch (agi::Exception const& e) {
+			LOG_W("auto4/lua") << "Error cleaning compiled script cache file: " << e.GetMessage();
+		}
+	}
+}
+
+/// The compiler part of a MoonScript cache entry's header, which is a hash of
+/// the file's contents and the version of MoonScript
+std::string moon_compiler(const char *buff, size_t size, std::string const& version) {
+	auto h = hash(version.c_str(), version.size() + 1);
+	h = hash(buff, size, h);
+	return agi::format("moonscript %016llx", (unsigned long long)h);
+}
+
+// After the header, a MoonScript entry has the number of line table
+// entries, then each entry on its own line, then the Lua code
+
+std::shared_ptr<const CompiledMoonScript> read_cached_moon(std::string const& filename, std::string const& header) {
+	if (moon_cache_dir.empty()) return nullptr;
+	auto path = cache_path(moon_cache_dir, filename, ".lua");
+	std::string data;
+	if (!read_cache_entry(path, header, data)) return nullptr;
+
+	std::istringstream ss(data);
+	auto compiled = std::make_shared<CompiledMoonScript>();
+	compiled->header = header;
+	size_t count = 0;
+	ss >> count;
+	compiled->line_table.resize(count);
+	for (auto& entry : compiled->line_table)
+		ss >> entry.first >> entry.second;
+	if (!ss || ss.get() != '\n') {
+		LOG_W("auto4/lua") << "Ignoring invalid MoonScript cache file " << path;
+		return nullptr;
+	}
+	compiled->code = data.substr(static_cast<size_t>(ss.tellg()));
+	return compiled;
+}
+
+void write_cached_moon(std::string const& filename, CompiledMoonScript const& compiled) {
+	if (moon_cache_dir.empty()) return;
+	try {
+		agi::fs::CreateDirectory(moon_cache_dir);
+		agi::io::Save file(cache_path(moon_cache_dir, filename, ".lua"), true);
+		auto& out = file.Get();
+		out << compiled.header;
+		out << compiled.line_table.size() << '\n';
+		for (auto const& entry : compiled.line_table)
+			out << entry.first << ' ' << entry.second << '\n';
+		out << compiled.code;
+	}
+	catch (agi::Exception const& e) {
+		LOG_W("auto4/lua") << "Error writing MoonScript cache file: " << e.GetMessage();
+	}
+}
+
+// After the header, a bytecode entry is just the bytecode. The LuaJIT
+// version is the compiler as bytecode is not portable between LuaJIT
+// versions or builds.
+
+std::shared_ptr<const CompiledLua> read_cached_bytecode(std::string const& filename, time_t modified, uintmax_t size) {
+	if (bytecode_cache_dir.empty()) return nullptr;
+	auto compiled = std::make_shared<CompiledLua>();
+	if (!read_cache_entry(cache_path(bytecode_cache_dir, filename, ".ljbc"), cache_header(filename, modified, size, LUAJIT_VERSION), compiled->bytecode)
+		|| compiled->bytecode.empty())
+		return nullptr;
+	compiled->modified = modified;
+	compiled->size = size;
+	return compiled;
+}
+
+void write_cached_bytecode(std::string const& filename, CompiledLua const& compiled) {
+	if (bytecode_cache_dir.empty()) return;
+	try {
+		agi::fs::CreateDirectory(bytecode_cache_dir);
+		agi::io::Save file(cache_path(bytecode_cache_dir, filename, ".ljbc"), true);
+		auto& out = file.Get();
+		out << cache_header(filename, compiled.modified, compiled.size, LUAJIT_VERSION);
+		out.write(compiled.bytecode.data(), compiled.bytecode.size());
+	}
+	catch (agi::Exception const& e) {
+		LOG_W("auto4/lua") << "Error writing Lua bytecode cache file: " << e.GetMessage();
+	}
+}
+
+int bytecode_writer(lua_State *, const void *p, size_t sz, void *ud) {
+	static_cast<std::string *>(ud)->append(static_cast<const char *>(p), sz);
+	return 0;
+}
+
+/// Load a Lua file, using cached bytecode if the file hasn't changed since
+/// it was compiled
+bool load_lua(lua_State *L, std::string const& filename, const char *buff, size_t size) {
+	time_t file_modified;
+	uintmax_t file_size;
+	if (!file_info(filename, file_modified, file_size))
+		return luaL_loadbuffer(L, buff, size, filename.c_str()) == 0;
+
+	std::shared_ptr<const CompiledLua> compiled;
+	{
+		std::lock_guard<std::mutex> lock(bytecode_cache_mutex);
+		auto it = bytecode_cache.find(filename);
+		if (it != bytecode_cache.end() && it->second->modified == file_modified && it->second->size == file_size)
+			compiled = it->second;
+		else if ((compiled = read_cached_bytecode(filename, file_modified, file_size)))
+			bytecode_cache[filename] = compiled;
+	}
+
+	if (compiled) {
+		if (luaL_loadbuffer(L, compiled->bytecode.data(), compiled->bytecode.size(), filename.c_str()) == 0)
+			return true;
+		// Fall back to the source if the bytecode is somehow unloadable
+		lua_pop(L, 1);
+	}
+
+	if (luaL_loadbuffer(L, buff, size, filename.c_str()))
+		return false;
+
+	auto fresh = std::make_shared<CompiledLua>();
+	fresh->modified = file_modified;
+	fresh->size = file_size;
+	if (lua_dump(L, bytecode_writer, &fresh->bytecode) != 0 || fresh->bytecode.empty())
+		return true;
+
+	std::lock_guard<std::mutex> lock(bytecode_cache_mutex);
+	bytecode_cache[filename] = fresh;
+	write_cached_bytecode(filename, *fresh);
+	return true;
+}
+
+/// Split a package.path into its templates, reusing the previous result for
+/// the same path as it's rarely modified
+std::vector<std::string> const& split_package_path(std::string const& package_path) {
+	thread_local std::string last_path;
+	thread_local std::vector<std::string> templates;
+	if (package_path != last_path || templates.empty()) {
+		templates.clear();
+		for (auto tok : agi::Split(package_path, ';'))
+			templates.emplace_back(begin(tok), end(tok));
+		last_path = package_path;
+	}
+	return templates;
+}
+
+/// Check if a module file exists, using the include directory index for the
+/// directories it covers
+bool module_exists(agi::fs::path const& path) {
+	std::lock_guard<std::mutex> lock(index_mutex);
+	return include_index.FileExists(path);
+}
+
+/// Compile MoonScript source with the compiler loaded into L
+/// @return The compiled code, or nullptr with an error message pushed
+std::shared_ptr<CompiledMoonScript> compile_moon(lua_State *L, const char *buff, size_t size) {
+	lua_getfield(L, LUA_REGISTRYINDEX, "moonscript");
+	lua_pushlstring(L, buff, size);
+	if (lua_pcall(L, 1, 2, 0))
+		return nullptr; // Leaves error message on stack
+
+	// to_lua returns nil, error on error or code, line table on success
+	if (lua_isnil(L, -2)) {
+		lua_remove(L, -2);
+		return nullptr;
+	}
+
+	auto compiled = std::make_shared<CompiledMoonScript>();
+	compiled->code = agi::lua::get_string(L, -2);
+	if (lua_istable(L, -1)) {
+		lua_pushnil(L);
+		while (lua_next(L, -2)) {
+			if (lua_type(L, -2) == LUA_TNUMBER && lua_type(L, -1) == LUA_TNUMBER)
+				compiled->line_table.emplace_back(lua_tointeger(L, -2), lua_tointeger(L, -1));
+			lua_pop(L, 1);
+		}
+	}
+	lua_pop(L, 2);
+	return compiled;
+}
+}
 
 namespace agi { namespace lua {
+	void SetCacheDirectory(agi::fs::path const& dir) {
+		{
+			std::lock_guard<std::mutex> lock(moon_cache_mutex);
+			moon_cache_dir = dir.empty() ? dir : dir/"moonscript";
+			if (!dir.empty())
+				clean_cache_dir(moon_cache_dir, "*.lua");
+		}
+		std::lock_guard<std::mutex> lock(bytecode_cache_mutex);
+		bytecode_cache_dir = dir.empty() ? dir : dir/"bytecode";
+		if (!dir.empty())
+			clean_cache_dir(bytecode_cache_dir, "*.ljbc");
+	}
+
 	bool LoadFile(lua_State *L, agi::fs::path const& raw_filename) {
 		auto filename = raw_filename;
 		try {
@@ -45,31 +400,59 @@ namespace agi { namespace lua {
 		}
 
 		if (!agi::fs::HasExtension(filename, "moon"))
-			return luaL_loadbuffer(L, buff, size, filename.string().c_str()) == 0;
+			return load_lua(L, filename.string(), buff, size);
 
-		// We have a MoonScript file, so we need to load it with that
-		// It might be nice to have a dedicated lua state for compiling
-		// MoonScript to Lua
-		lua_getfield(L, LUA_REGISTRYINDEX, "moonscript");
+		// We have a MoonScript file, so we need to compile it to Lua unless
+		// that's already been done for the file as it is now
+		std::string header;
+		time_t file_modified;
+		uintmax_t file_size;
+		if (file_info(filename, file_modified, file_size)) {
+			lua_getfield(L, LUA_REGISTRYINDEX, "moonscript version");
+			header = cache_header(filename.string(), file_modified, file_size, moon_compiler(buff, size, get_string(L, -1)));
+			lua_pop(L, 1);
+		}
+
+		std::shared_ptr<const CompiledMoonScript> compiled;
+		if (!header.empty()) {
+			std::lock_guard<std::mutex> lock(moon_cache_mutex);
+			auto it = moon_cache.find(filename.string());
+			if (it != moon_cache.end() && it->second->header == header)
+				compiled = it->second;
+			else if ((compiled = read_cached_moon(filename.string(), header)))
+				moon_cache[filename.string()] = compiled;
+		}
+
+		if (!compiled) {
+			auto fresh = compile_moon(L, buff, size);
+			if (!fresh)
+				return false; // Leaves error message on stack
+			compiled = fresh;
+
+			if (!header.empty()) {
+				fresh->header = header;
+				std::lock_guard<std::mutex> lock(moon_cache_mutex);
+				moon_cache[filename.string()] = compiled;
+				write_cached_moon(filename.string(), *compiled);
+			}
+		}
 
 		// Save the text we'll be loading for the line number rewriting in the
 		// error handling
 		lua_pushlstring(L, buff, size);
-		lua_pushvalue(L, -1);
 		lua_setfield(L, LUA_REGISTRYINDEX, ("raw moonscript: " + filename.string()).c_str());
 
-		push_value(L, filename);
-		if (lua_pcall(L, 2, 2, 0))
-			return false; // Leaves error message on stack
-
-		// loadstring returns nil, error on error or a function on success
-		if (lua_isnil(L, 1)) {
-			lua_remove(L, 1);
-			return false;
+		// Register the line table as moonscript.loadstring would have
+		lua_getfield(L, LUA_REGISTRYINDEX, "moonscript line tables");
+		lua_createtable(L, compiled->line_table.size(), 0);
+		for (auto const& entry : compiled->line_table) {
+			lua_pushinteger(L, entry.second);
+			lua_rawseti(L, -2, entry.first);
 		}
+		lua_setfield(L, -2, filename.string().c_str());
+		lua_pop(L, 1);
 
-		lua_pop(L, 1); // Remove the extra nil for the stackchecker
-		return true;
+		return luaL_loadbuffer(L, compiled->code.data(), compiled->code.size(), filename.string().c_str()) == 0;
 	}
 
 	static int module_loader(lua_State *L) {
@@ -83,7 +466,7 @@ namespace agi { namespace lua {
 		std::string package_paths(check_string(L, -1));
 		lua_pop(L, 2);
 
-		for (auto tok : agi::Split(package_paths, ';')) {
+		for (auto const& tok : split_package_path(package_paths)) {
 			std::string filename;
 			boost::replace_all_copy(std::back_inserter(filename), tok, "?", module);
 
@@ -93,11 +476,11 @@ namespace agi { namespace lua {
 			if (agi::fs::HasExtension(path, "lua")) {
 				agi::fs::path moonpath = path;
 				moonpath.replace_extension("moon");
-				if (agi::fs::FileExists(moonpath))
+				if (module_exists(moonpath))
 					path = moonpath;
 			}
 
-			if (!agi::fs::FileExists(path))
+			if (!module_exists(path))
 				continue;
 
 			try {
@@ -106,7 +489,10 @@ namespace agi { namespace lua {
 				break;
 			}
 			catch (agi::fs::FileNotFound const&) {
-				// Not an error so swallow and continue on
+				// Not an error so swallow and continue on, but the file may
+				// have been deleted since the index was built
+				std::lock_guard<std::mutex> lock(index_mutex);
+				include_index.Remove(path);
 			}
 			catch (agi::fs::NotAFile const&) {
 				// Not an error so swallow and continue on
@@ -120,6 +506,12 @@ namespace agi { namespace lua {
 	}
 
 	bool Install(lua_State *L, std::vector<fs::path> const& include_path) {
+		{
+			std::lock_guard<std::mutex> lock(index_mutex);
+			for (auto const& path : include_path)
+				include_index.Add(path);
+		}
+
 		// set the module load path to include_path
 		lua_getglobal(L, "package");
 		push_value(L, "path");
@@ -146,10 +538,12 @@ namespace agi { namespace lua {
 		lua_rawseti(L, -2, 2);
 		lua_pop(L, 2); // loaders, package
 
-		luaL_loadstring(L, "return require('moonscript').loadstring");
-		if (lua_pcall(L, 0, 1, 0)) {
+		luaL_loadstring(L, "return require('moonscript').to_lua, require('moonscript.version').version, require('moonscript.line_tables')");
+		if (lua_pcall(L, 0, 3, 0)) {
 			return false; // leave error message
 		}
+		lua_setfield(L, LUA_REGISTRYINDEX, "moonscript line tables");
+		lua_setfield(L, LUA_REGISTRYINDEX, "moonscript version");
 		lua_setfield(L, LUA_REGISTRYINDEX, "moonscript");
 
 		return true;
@@ -35,19 +35,16 @@
 #include "subtitle_format.h"
 #include "utils.h"
 
-#include <libaegisub/of_type_adaptor.h>
 #include <libaegisub/split.h>
 #include <libaegisub/make_unique.h>
 
 #include <boost/algorithm/string/predicate.hpp>
-#include <boost/algorithm/string/join.hpp>
 #include <boost/algorithm/string/trim.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/regex.hpp>
 #include <boost/spirit/include/karma_generate.hpp>
 #include <boost/spirit/include/karma_int.hpp>
-
-using namespace boost::adaptors;
+#include <cstring>
 
 static int next_id = 0;
 
@@ -196,72 +193,85 @@ std::string AssDialogue::GetEntryData() const {
 	return str;
 }
 
-std::vector<std::unique_ptr<AssDialogueBlock>> AssDialogue::ParseTags() const {
-	std::vector<std::unique_ptr<AssDialogueBlock>> Blocks;
-
-	// Empty line, make an empty block
-	if (Text.get().empty()) {
-		Blocks.push_back(agi::make_unique<AssDialogueBlockPlain>());
-		return Blocks;
-	}
-
-	int drawingLevel = 0;
-	std::string const& text(Text.get());
+namespace {
+/// Split a line's text into blocks in the way VSFilter does, calling
+/// block(type, offset, length, drawing level) for each, with the offset and
+/// length including the braces of comment and override blocks
+template<typename Func>
+void scan_blocks(std::string const& text, Func&& block) {
+	const char *str = text.data();
+	int drawing_level = 0;
 
 	for (size_t len = text.size(), cur = 0; cur < len; ) {
 		// Overrides block
-		if (text[cur] == '{') {
-			size_t end = text.find('}', cur);
+		if (str[cur] == '{') {
+			auto close = static_cast<const char *>(memchr(str + cur, '}', len - cur));
 
 			// VSFilter requires that override blocks be closed, while libass
 			// does not. We match VSFilter here.
-			if (end == std::string::npos)
-				goto plain;
-
-			++cur;
-			// Get contents of block
-			std::string work = text.substr(cur, end - cur);
-			cur = end + 1;
-
-			if (work.size() && work.find('\\') == std::string::npos) {
-				//We've found an override block with no backslashes
-				//We're going to assume it's a comment and not consider it an override block
-				Blocks.push_back(agi::make_unique<AssDialogueBlockComment>(work));
-			}
-			else {
-				// Create block
-				auto block = agi::make_unique<AssDialogueBlockOverride>(work);
-				block->ParseTags();
-
-				// Look for \p in block
-				for (auto const& tag : block->Tags) {
-					if (tag.Name == "\\p")
-						drawingLevel = tag.Params[0].Get<int>(0);
+			if (close) {
+				size_t end = close - str + 1;
+				size_t contents = end - cur - 2;
+
+				// An override block with no backslashes is assumed to be a
+				// comment rather than an override block
+				if (contents && !memchr(str + cur + 1, '\\', contents))
+					block(AssBlockType::COMMENT, cur, end - cur, 0);
+				else {
+					drawing_level = AssDialogueBlockOverride::GetDrawingLevel(
+						text.begin() + cur + 1, text.begin() + end - 1, drawing_level);
+					block(AssBlockType::OVERRIDE, cur, end - cur, 0);
 				}
-				Blocks.push_back(std::move(block));
-			}
 
-			continue;
+				cur = end;
+				continue;
+			}
 		}
 
 		// Plain-text/drawing block
-plain:
-		std::string work;
-		size_t end = text.find('{', cur + 1);
-		if (end == std::string::npos) {
-			work = text.substr(cur);
-			cur = len;
-		}
-		else {
-			work = text.substr(cur, end - cur);
-			cur = end;
-		}
-
-		if (drawingLevel == 0)
-			Blocks.push_back(agi::make_unique<AssDialogueBlockPlain>(work));
+		auto next = cur + 1 < len ? static_cast<const char *>(memchr(str + cur + 1, '{', len - cur - 1)) : nullptr;
+		size_t end = next ? next - str : len;
+		if (drawing_level == 0)
+			block(AssBlockType::PLAIN, cur, end - cur, 0);
 		else
-			Blocks.push_back(agi::make_unique<AssDialogueBlockDrawing>(work, drawingLevel));
+			block(AssBlockType::DRAWING, cur, end - cur, drawing_level);
+		cur = end;
 	}
+}
+}
+
+std::vector<std::unique_ptr<AssDialogueBlock>> AssDialogue::ParseTags() const {
+	return ParseTags(Text.get());
+}
+
+std::vector<std::unique_ptr<AssDialogueBlock>> AssDialogue::ParseTags(std::string const& text) {
+	std::vector<std::unique_ptr<AssDialogueBlock>> Blocks;
+
+	// Empty line, make an empty block
+	if (text.empty()) {
+		Blocks.push_back(agi::make_unique<AssDialogueBlockPlain>());
+		return Blocks;
+	}
+
+	scan_blocks(text, [&](AssBlockType type, size_t offset, size_t length, int scale) {
+		switch (type) {
+			case AssBlockType::PLAIN:
+				Blocks.push_back(agi::make_unique<AssDialogueBlockPlain>(text.substr(offset, length)));
+				break;
+			case AssBlockType::DRAWING:
+				Blocks.push_back(agi::make_unique<AssDialogueBlockDrawing>(text.substr(offset, length), scale));
+				break;
+			case AssBlockType::COMMENT:
+				Blocks.push_back(agi::make_unique<AssDialogueBlockComment>(text.substr(offset + 1, length - 2)));
+				break;
+			case AssBlockType::OVERRIDE: {
+				auto block = agi::make_unique<AssDialogueBlockOverride>(text.substr(offset + 1, length - 2));
+				block->ParseTags();
+				Blocks.push_back(std::move(block));
+				break;
+			}
+		}
+	});
 
 	return Blocks;
 }
@@ -270,10 +280,12 @@ void AssDialogue::StripTags() {
 	Text = GetStrippedText();
 }
 
-static std::string get_text(std::unique_ptr<AssDialogueBlock> &d) { return d->GetText(); }
 void AssDialogue::UpdateText(std::vector<std::unique_ptr<AssDialogueBlock>>& blocks) {
 	if (blocks.empty()) return;
-	Text = join(blocks | transformed(get_text), "");
+	std::string text;
+	for (auto const& block : blocks)
+		text += block->GetText();
+	Text = text;
 }
 
 bool AssDialogue::CollidesWith(const AssDialogue *target) const {
@@ -281,8 +293,78 @@ bool AssDialogue::CollidesWith(const AssDialogue *target) const {
 	return ((Start < target->Start) ? (target->Start < End) : (Start < target->End));
 }
 
-static std::string get_text_p(AssDialogueBlock *d) { return d->GetText(); }
 std::string AssDialogue::GetStrippedText() const {
-	auto blocks = ParseTags();
-	return join(blocks | agi::of_type<AssDialogueBlockPlain>() | transformed(get_text_p), "");
+	return GetStrippedText(Text.get());
+}
+
+std::string AssDialogue::GetStrippedText(std::string const& text) {
+	std::string stripped;
+	scan_blocks(text, [&](AssBlockType type, size_t offset, size_t length, int) {
+		if (type == AssBlockType::PLAIN)
+			stripped.append(text, offset, length);
+	});
+	return stripped;
+}
+
+bool AssDialogue::IsPlainText() const {
+	// Only a closed brace can start anything other than plain text, and
+	// drawings need an override block before them
+	auto const& text = Text.get();
+	auto open = text.find('{');
+	return open == std::string::npos || text.find('}', open) == std::string::npos;
+}
+
+void AssBlockList::Parse(std::string const& text) {
+	this->text = &text;
+	blocks.clear();
+	tags_used = 0;
+	tags_parsed = false;
+
+	if (text.empty()) {
+		blocks.push_back(Block{AssBlockType::PLAIN, 0, 0, 0, 0, 0});
+		return;
+	}
+
+	scan_blocks(text, [&](AssBlockType type, size_t offset, size_t length, int scale) {
+		blocks.push_back(Block{type, offset, length, scale, 0, 0});
+	});
+}
+
+std::string AssBlockList::Text(size_t i) const {
+	return text->substr(blocks[i].offset, blocks[i].length);
+}
+
+std::string AssBlockList::Contents(size_t i) const {
+	auto const& block = blocks[i];
+	if (block.type == AssBlockType::COMMENT || block.type == AssBlockType::OVERRIDE)
+		return text->substr(block.offset + 1, block.length - 2);
+	return text->substr(block.offset, block.length);
+}
+
+void AssBlockList::ParseAllTags() {
+	tags_parsed = true;
+	for (auto& block : blocks) {
+		if (block.type != AssBlockType::OVERRIDE) continue;
+
+		block.first_tag = tags_used;
+		auto begin = text->begin() + block.offset + 1;
+		AssDialogueBlockOverride::SplitTags(begin, begin + block.length - 2, [&](std::string::const_iterator b, std::string::const_iterator e) {
+			// Reuse the tags left from earlier texts, along with their
+			// parameter vectors
+			if (tags_used < tags.size()) {
+				tags[tags_used].Clear();
+				tags[tags_used].SetText(b, e);
+			}
+			else
+				tags.emplace_back(b, e);
+			++tags_used;
+		});
+		block.tag_count = tags_used - block.first_tag;
+	}
+}
+
+boost::iterator_range<AssOverrideTag *> AssBlockList::Tags(size_t i) {
+	if (!tags_parsed) ParseAllTags();
+	auto first = tags.data() + blocks[i].first_tag;
+	return boost::make_iterator_range(first, first + blocks[i].tag_count);
 }
@@ -34,6 +34,7 @@
 
 #include <array>
 #include <boost/flyweight.hpp>
+#include <boost/range/iterator_range.hpp>
 #include <vector>
 
 enum class AssBlockType {
@@ -108,6 +109,34 @@ public:
 	void ParseTags();
 	void AddTag(std::string const& tag);
 
+	/// Split the text of an override block into tags, calling
+	/// tag(begin, end) with the text of each
+	template<typename Func>
+	static void SplitTags(std::string::const_iterator begin, std::string::const_iterator end, Func&& tag) {
+		if (begin == end) return;
+
+		int depth = 0;
+		auto start = begin;
+		for (auto it = begin + 1; it != end; ++it) {
+			if (depth > 0) {
+				if (*it == ')')
+					--depth;
+			}
+			else if (*it == '\\') {
+				tag(start, it);
+				start = it;
+			}
+			else if (*it == '(')
+				++depth;
+		}
+		tag(start, end);
+	}
+
+	/// Get the drawing mode after an override block, which is set by its
+	/// last \p tag, without parsing the block's other tags
+	/// @param level Drawing mode before the block
+	static int GetDrawingLevel(std::string::const_iterator begin, std::string::const_iterator end, int level);
+
 	/// Type of callback function passed to ProcessParameters
 	typedef void (*ProcessParametersCallback)(std::string const&, AssOverrideParameter *, void *);
 	/// @brief Process parameters via callback
@@ -116,6 +145,60 @@ public:
 	void ProcessParameters(ProcessParametersCallback callback, void *userData);
 };
 
+/// @class AssBlockList
+/// @brief Flat representation of the blocks of a line's text
+///
+/// Each block is a record of where it is in the text rather than an object
+/// holding a copy of it, and the tags of the override blocks are only
+/// parsed the first time they're asked for. Reusing a list for many lines
+/// reuses its storage, including the tag objects.
+class AssBlockList {
+public:
+	struct Block {
+		AssBlockType type;
+		/// Position of the block in the text, including the braces of
+		/// comment and override blocks
+		size_t offset;
+		size_t length;
+		/// Scale of drawing blocks
+		int scale;
+		/// Position of an override block's tags in the tag table
+		size_t first_tag;
+		size_t tag_count;
+	};
+
+private:
+	std::string const* text = nullptr;
+	std::vector<Block> blocks;
+	/// Tags of all of the override blocks, in order
+	std::vector<AssOverrideTag> tags;
+	/// Number of the entries of tags which belong to the current text
+	size_t tags_used = 0;
+	bool tags_parsed = false;
+
+	void ParseAllTags();
+
+public:
+	/// Split text into blocks. The text must outlive any use of the list
+	/// until the next call.
+	void Parse(std::string const& text);
+
+	size_t size() const { return blocks.size(); }
+	Block const& operator[](size_t i) const { return blocks[i]; }
+	std::vector<Block>::const_iterator begin() const { return blocks.begin(); }
+	std::vector<Block>::const_iterator end() const { return blocks.end(); }
+
+	/// Get the text of a block, including any braces
+	std::string Text(size_t i) const;
+	/// Get the text of a block without the braces of comment and override
+	/// blocks
+	std::string Contents(size_t i) const;
+
+	/// Get the tags of an override block, parsing the tags of all of the
+	/// override blocks the first time this is called for a text
+	boost::iterator_range<AssOverrideTag *> Tags(size_t i);
+};
+
 struct AssDialogueBase {
 	/// Unique ID of this line. Copies of the line for Undo/Redo purposes
 	/// preserve the unique ID, so that the equivalent lines can be found in
@@ -155,12 +238,20 @@ public:
 
 	/// Parse text as ASS and return block information
 	std::vector<std::unique_ptr<AssDialogueBlock>> ParseTags() const;
+	/// Parse the given text as ASS and return block information, without
+	/// needing a line to hold it
+	static std::vector<std::unique_ptr<AssDialogueBlock>> ParseTags(std::string const& text);
 
 	/// Strip all ASS tags from the text
 	void StripTags();
 	/// Strip a specific ASS tag from the text
 	/// Get text without tags
 	std::string GetStrippedText() const;
+	/// Get the given text without tags, comments or drawings
+	static std::string GetStrippedText(std::string const& text);
+	/// Is the text free of tags, comments and drawings, so that
+	/// GetStrippedText() would return it unchanged?
+	bool IsPlainText() const;
 
 	/// Update the text of the line from parsed blocks
 	void UpdateText(std::vector<std::unique_ptr<AssDialogueBlock>>& blocks);
@@ -27,6 +27,8 @@
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/filesystem/path.hpp>
 #include <cassert>
+#include <future>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -191,30 +193,96 @@ bool AssFile::CompLayer(AssDialogue const& lft, AssDialogue const& rgt) {
 	return lft.Layer < rgt.Layer;
 }
 
+AssFile::CompFunc AssFile::GetSortKey(std::string const& name) {
+	if (name == "start")  return CompStart;
+	if (name == "end")    return CompEnd;
+	if (name == "style")  return CompStyle;
+	if (name == "actor")  return CompActor;
+	if (name == "effect") return CompEffect;
+	if (name == "layer")  return CompLayer;
+	return nullptr;
+}
+
 void AssFile::Sort(CompFunc comp, std::set<AssDialogue*> const& limit) {
 	Sort(Events, comp, limit);
 }
 
+void AssFile::Sort(SortKeys const& keys, std::set<AssDialogue*> const& limit) {
+	Sort(Events, keys, limit);
+}
+
 void AssFile::Sort(EntryList<AssDialogue> &lst, CompFunc comp, std::set<AssDialogue*> const& limit) {
-	if (limit.empty()) {
-		lst.sort(comp);
+	Sort(lst, SortKeys{comp}, limit);
+}
+
+namespace {
+/// Below this many lines sorting on a single thread is faster than
+/// spinning up more
+const size_t parallel_sort_threshold = 8192;
+
+struct multi_key_comp {
+	AssFile::SortKeys const& keys;
+	bool operator()(const AssDialogue *lft, const AssDialogue *rgt) const {
+		for (auto comp : keys) {
+			if (comp(*lft, *rgt)) return true;
+			if (comp(*rgt, *lft)) return false;
+		}
+		return false;
+	}
+};
+
+template<typename Iter, typename Comp>
+void parallel_stable_sort(Iter begin, Iter end, Comp comp, unsigned depth) {
+	size_t size = end - begin;
+	if (depth == 0 || size < parallel_sort_threshold) {
+		std::stable_sort(begin, end, comp);
 		return;
 	}
 
-	// Sort each selected block separately, leaving everything else untouched
-	for (auto begin = lst.begin(); begin != lst.end(); ++begin) {
-		if (!limit.count(&*begin)) continue;
-		auto end = begin;
-		while (end != lst.end() && limit.count(&*end)) ++end;
+	auto mid = begin + size / 2;
+	auto left = std::async(std::launch::async, [=] {
+		parallel_stable_sort(begin, mid, comp, depth - 1);
+	});
+	parallel_stable_sort(mid, end, comp, depth - 1);
+	left.get();
+	std::inplace_merge(begin, mid, end, comp);
+}
+}
 
-		// sort doesn't support only sorting a sublist, so move them to a temp list
-		EntryList<AssDialogue> tmp;
-		tmp.splice(tmp.begin(), lst, begin, end);
-		tmp.sort(comp);
-		lst.splice(end, tmp);
+void AssFile::Sort(std::vector<AssDialogue*>& lines, SortKeys const& keys) {
+	if (keys.empty() || lines.size() < 2) return;
 
-		begin = --end;
+	unsigned depth = 0;
+	for (unsigned threads = std::thread::hardware_concurrency(); threads > 1; threads /= 2)
+		++depth;
+	parallel_stable_sort(lines.begin(), lines.end(), multi_key_comp{keys}, depth);
+}
+
+void AssFile::Sort(EntryList<AssDialogue> &lst, SortKeys const& keys, std::set<AssDialogue*> const& limit) {
+	std::vector<AssDialogue*> lines;
+	for (auto& line : lst)
+		lines.push_back(&line);
+
+	if (limit.empty())
+		Sort(lines, keys);
+	else {
+		// Sort each selected block separately, leaving everything else untouched
+		for (size_t begin = 0; begin < lines.size(); ++begin) {
+			if (!limit.count(lines[begin])) continue;
+			size_t end = begin;
+			while (end < lines.size() && limit.count(lines[end])) ++end;
+
+			std::vector<AssDialogue*> block(lines.begin() + begin, lines.begin() + end);
+			Sort(block, keys);
+			std::copy(block.begin(), block.end(), lines.begin() + begin);
+			begin = end;
+		}
 	}
+
+	// Relink the list in the new order; unlinking entries doesn't free them
+	lst.clear();
+	for (auto line : lines)
+		lst.push_back(*line);
 }
 
 uint32_t AssFile::AddExtradata(std::string const& key, std::string const& value) {
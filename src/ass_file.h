@@ -193,14 +193,35 @@ public:
 	/// Compare based on layer
 	static bool CompLayer(AssDialogue const& lft, AssDialogue const& rgt);
 
+	/// Comparison functions to sort by, in order of priority
+	typedef std::vector<CompFunc> SortKeys;
+
+	/// @brief Get the comparison function for a named sort key
+	/// @param name One of start, end, style, actor, effect or layer
+	/// @return Comparison function, or nullptr if the name is not a sort key
+	static CompFunc GetSortKey(std::string const& name);
+
 	/// @brief Sort the dialogue lines in this file
 	/// @param comp Comparison function to use. Defaults to sorting by start time.
 	/// @param limit If non-empty, only lines in this set are sorted
 	void Sort(CompFunc comp = CompStart, std::set<AssDialogue*> const& limit = std::set<AssDialogue*>());
+	/// @brief Sort the dialogue lines in this file by several keys
+	/// @param keys Comparison functions, with each one breaking ties in the previous
+	/// @param limit If non-empty, only lines in this set are sorted
+	void Sort(SortKeys const& keys, std::set<AssDialogue*> const& limit = std::set<AssDialogue*>());
 	/// @brief Sort the dialogue lines in the given list
 	/// @param comp Comparison function to use. Defaults to sorting by start time.
 	/// @param limit If non-empty, only lines in this set are sorted
 	static void Sort(EntryList<AssDialogue>& lst, CompFunc comp = CompStart, std::set<AssDialogue*> const& limit = std::set<AssDialogue*>());
+	/// @brief Sort the dialogue lines in the given list by several keys
+	/// @param keys Comparison functions, with each one breaking ties in the previous
+	/// @param limit If non-empty, only lines in this set are sorted. Each
+	///              contiguous run of lines in the set is sorted separately.
+	static void Sort(EntryList<AssDialogue>& lst, SortKeys const& keys, std::set<AssDialogue*> const& limit = std::set<AssDialogue*>());
+	/// @brief Stable sort of an array of dialogue lines by several keys
+	///
+	/// Large inputs are split across threads and merged.
+	static void Sort(std::vector<AssDialogue*>& lines, SortKeys const& keys);
 };
 
 #endif // ASS_FILE_H_INCLUDED
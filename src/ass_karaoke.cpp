@@ -21,7 +21,6 @@
 #include <libaegisub/format.h>
 
 #include <boost/algorithm/string/predicate.hpp>
-#include <boost/algorithm/string/trim.hpp>
 
 std::string AssKaraoke::Syllable::GetText(bool k_tag) const {
 	std::string ret;
@@ -45,17 +44,25 @@ AssKaraoke::AssKaraoke(const AssDialogue *line, bool auto_split, bool normalize)
 
 void AssKaraoke::SetLine(const AssDialogue *line, bool auto_split, bool normalize) {
 	syls.clear();
-	Syllable syl;
-	syl.start_time = line->Start;
-	syl.duration = 0;
-	syl.tag_type = "\\k";
 
-	ParseSyllables(line, syl);
+	// Kept between lines so that its storage is reused
+	thread_local AssKaraokeSyllables parsed;
+	parsed.Parse(line->Text);
+	for (auto const& parsed_syl : parsed) {
+		Syllable syl;
+		syl.start_time = line->Start + parsed_syl.start_time;
+		syl.duration = parsed_syl.duration;
+		syl.text = parsed.str(parsed_syl.stripped);
+		syl.tag_type = parsed.str(parsed_syl.tag_type);
+		for (auto const& tags : parsed.GetTags(parsed_syl))
+			syl.ovr_tags[tags.pos] = parsed.str(tags.text);
+		syls.push_back(std::move(syl));
+	}
 
 	if (normalize) {
 		// Normalize the syllables so that the total duration is equal to the line length
 		int end_time = line->End;
-		int last_end = syl.start_time + syl.duration;
+		int last_end = syls.back().start_time + syls.back().duration;
 
 		// Total duration is shorter than the line length so just extend the last
 		// syllable; this has no effect on rendering but is easier to work with
@@ -87,66 +94,6 @@ void AssKaraoke::SetLine(const AssDialogue *line, bool auto_split, bool normaliz
 	AnnounceSyllablesChanged();
 }
 
-void AssKaraoke::ParseSyllables(const AssDialogue *line, Syllable &syl) {
-	for (auto& block : line->ParseTags()) {
-		std::string text = block->GetText();
-
-		switch (block->GetType()) {
-		case AssBlockType::PLAIN:
-			syl.text += text;
-			break;
-		case AssBlockType::COMMENT:
-		// drawings aren't override tags but they shouldn't show up in the
-		// stripped text so pretend they are
-		case AssBlockType::DRAWING:
-			syl.ovr_tags[syl.text.size()] += text;
-			break;
-		case AssBlockType::OVERRIDE:
-			auto ovr = static_cast<AssDialogueBlockOverride*>(block.get());
-			bool in_tag = false;
-			for (auto& tag : ovr->Tags) {
-				if (tag.IsValid() && boost::istarts_with(tag.Name, "\\k")) {
-					if (in_tag) {
-						syl.ovr_tags[syl.text.size()] += "}";
-						in_tag = false;
-					}
-
-					// Dealing with both \K and \kf is mildly annoying so just
-					// convert them both to \kf
-					if (tag.Name == "\\K") tag.Name = "\\kf";
-
-					// Don't bother including zero duration zero length syls
-					if (syl.duration > 0 || !syl.text.empty()) {
-						syls.push_back(syl);
-						syl.text.clear();
-						syl.ovr_tags.clear();
-					}
-
-					syl.tag_type = tag.Name;
-					syl.start_time += syl.duration;
-					syl.duration = tag.Params[0].Get(0) * 10;
-				}
-				else {
-					std::string& otext = syl.ovr_tags[syl.text.size()];
-					// Merge adjacent override tags
-					boost::trim_right_if(text, [](char c) { return c == '}'; });
-					if (!in_tag)
-						otext += "{";
-
-					in_tag = true;
-					otext += tag;
-				}
-			}
-
-			if (in_tag)
-				syl.ovr_tags[syl.text.size()] += "}";
-			break;
-		}
-	}
-
-	syls.push_back(syl);
-}
-
 std::string AssKaraoke::GetText() const {
 	std::string text;
 	text.reserve(size() * 10);
@@ -262,3 +209,93 @@ void AssKaraoke::SetLineTimes(int start_time, int end_time) {
 	}
 	syls[idx].duration = end_time - syls[idx].start_time;
 }
+
+void AssKaraokeSyllables::Parse(std::string const& text) {
+	syls.clear();
+	tags.clear();
+	buffer.clear();
+
+	// Kept between lines so that its storage is reused
+	thread_local AssBlockList blocks;
+	blocks.Parse(text);
+
+	// The syllable being read. The offsets of its tags are relative to
+	// syl_text until it's added to the buffer.
+	std::string syl_text, stripped, tag_type = "\\k";
+	int start_time = 0, duration = 0;
+	size_t first_tags = 0;
+	auto finish_syllable = [&] {
+		auto add = [&](std::string const& str) -> Span {
+			Span span{buffer.size(), str.size()};
+			buffer += str;
+			return span;
+		};
+		auto tag_type_span = add(tag_type);
+		auto text_span = add(syl_text);
+		for (size_t i = first_tags; i < tags.size(); ++i)
+			tags[i].text.offset += text_span.offset;
+		syls.push_back(Syllable{start_time, duration, tag_type_span, text_span, add(stripped), first_tags, tags.size() - first_tags});
+		syl_text.clear();
+		stripped.clear();
+		first_tags = tags.size();
+	};
+	// Add non-text to the syllable, merging it with any tags directly
+	// before it
+	auto add_tags = [&](std::string const& str) {
+		if (tags.size() > first_tags && tags.back().pos == stripped.size())
+			tags.back().text.length += str.size();
+		else
+			tags.push_back(Tags{stripped.size(), Span{syl_text.size(), str.size()}});
+		syl_text += str;
+	};
+
+	for (size_t i = 0; i < blocks.size(); ++i) {
+		auto const& block = blocks[i];
+		switch (block.type) {
+		case AssBlockType::PLAIN:
+			syl_text.append(text, block.offset, block.length);
+			stripped.append(text, block.offset, block.length);
+			break;
+		case AssBlockType::COMMENT:
+		// drawings aren't override tags but they shouldn't show up in the
+		// stripped text so pretend they are
+		case AssBlockType::DRAWING:
+			add_tags(text.substr(block.offset, block.length));
+			break;
+		case AssBlockType::OVERRIDE:
+			bool in_tag = false;
+			for (auto& tag : blocks.Tags(i)) {
+				if (tag.IsValid() && boost::istarts_with(tag.Name, "\\k")) {
+					if (in_tag) {
+						add_tags("}");
+						in_tag = false;
+					}
+
+					// Don't bother including zero duration zero length syls.
+					// Their override tags go to the next syllable.
+					if (duration > 0 || !stripped.empty())
+						finish_syllable();
+
+					// Dealing with both \K and \kf is mildly annoying so just
+					// convert them both to \kf
+					tag_type = tag.Name == "\\K" ? "\\kf" : tag.Name;
+					start_time += duration;
+					duration = tag.Params[0].Get(0) * 10;
+				}
+				else {
+					// Merge adjacent override tags
+					if (!in_tag)
+						add_tags("{");
+					in_tag = true;
+					add_tags(tag);
+				}
+			}
+
+			if (in_tag)
+				add_tags("}");
+			break;
+		}
+	}
+
+	finish_syllable();
+}
@@ -20,6 +20,8 @@
 
 #include <libaegisub/signal.h>
 
+#include <boost/range/iterator_range.hpp>
+
 namespace agi { struct Context; }
 class AssDialogue;
 
@@ -46,7 +48,6 @@ private:
 	bool no_announce = false;
 
 	agi::signal::Signal<> AnnounceSyllablesChanged;
-	void ParseSyllables(const AssDialogue *line, Syllable &syl);
 
 public:
 	/// Constructor
@@ -84,3 +85,59 @@ public:
 
 	DEFINE_SIGNAL_ADDERS(AnnounceSyllablesChanged, AddSyllablesChangedListener)
 };
+
+/// @class AssKaraokeSyllables
+/// @brief The syllables of a line's text without splitting or normalizing,
+///        in a compact read-only form
+///
+/// The strings of all of the syllables are stored in one buffer, and the
+/// text is split into blocks without building block objects, so parsing a
+/// line makes a handful of allocations rather than several per syllable.
+/// AssKaraoke is built from this.
+class AssKaraokeSyllables {
+public:
+	/// A string in the buffer
+	struct Span {
+		size_t offset;
+		size_t length;
+	};
+
+	struct Syllable {
+		int start_time; ///< Start time relative to the line start in milliseconds
+		int duration;   ///< Duration in milliseconds
+		Span tag_type;  ///< \k, \kf or \ko
+		Span text;      ///< Syllable text with its non-karaoke override tags
+		Span stripped;  ///< Syllable text without any tags
+		/// Position of the syllable's override tags in the tag table
+		size_t first_tags;
+		size_t tags_count;
+	};
+
+	/// A run of override tags, comments and drawings in a syllable's text
+	struct Tags {
+		size_t pos; ///< Index in the stripped text before which they go
+		Span text;
+	};
+
+private:
+	std::vector<Syllable> syls;
+	std::vector<Tags> tags;
+	std::string buffer;
+
+public:
+	/// Parse the text of a line
+	void Parse(std::string const& text);
+
+	size_t size() const { return syls.size(); }
+	Syllable const& operator[](size_t i) const { return syls[i]; }
+	std::vector<Syllable>::const_iterator begin() const { return syls.begin(); }
+	std::vector<Syllable>::const_iterator end() const { return syls.end(); }
+
+	/// Get the runs of override tags in a syllable's text, in order
+	boost::iterator_range<const Tags *> GetTags(Syllable const& syl) const {
+		return boost::make_iterator_range(tags.data() + syl.first_tags, tags.data() + syl.first_tags + syl.tags_count);
+	}
+
+	const char *data(Span span) const { return buffer.data() + span.offset; }
+	std::string str(Span span) const { return buffer.substr(span.offset, span.length); }
+};
@@ -36,13 +36,18 @@
 #include <libaegisub/exception.h>
 #include <libaegisub/format.h>
 #include <libaegisub/make_unique.h>
+#include <libaegisub/split.h>
 
+#include <algorithm>
+#include <array>
+#include <boost/algorithm/string/classification.hpp>
 #include <boost/algorithm/string/join.hpp>
 #include <boost/algorithm/string/predicate.hpp>
-#include <boost/algorithm/string/trim.hpp>
 #include <boost/range/adaptor/filtered.hpp>
 #include <boost/range/adaptor/transformed.hpp>
+#include <cassert>
 #include <functional>
+#include <mutex>
 
 using namespace boost::adaptors;
 
@@ -65,19 +70,31 @@ template<> std::string AssOverrideParameter::Get<std::string>() const {
 	return value;
 }
 
-template<> int AssOverrideParameter::Get<int>() const {
+void AssOverrideParameter::ParseNumbers() {
+	has_numbers = type == VariableDataType::INT || type == VariableDataType::FLOAT
+		|| type == VariableDataType::BOOL || classification == AssParameterClass::ALPHA;
+	if (!has_numbers) return;
+
 	if (classification == AssParameterClass::ALPHA)
 		// &Hxx&, but vsfilter lets you leave everything out
-		return mid<int>(0, strtol(std::find_if(value.c_str(), value.c_str() + value.size(), isxdigit), nullptr, 16), 255);
+		int_value = mid<int>(0, strtol(std::find_if(value.c_str(), value.c_str() + value.size(), isxdigit), nullptr, 16), 255);
+	else
+		int_value = atoi(value.c_str());
+	float_value = atof(value.c_str());
+}
+
+template<> int AssOverrideParameter::Get<int>() const {
+	if (has_numbers) return int_value;
 	return atoi(Get<std::string>().c_str());
 }
 
 template<> double AssOverrideParameter::Get<double>() const {
+	if (has_numbers) return float_value;
 	return atof(Get<std::string>().c_str());
 }
 
 template<> float AssOverrideParameter::Get<float>() const {
-	return atof(Get<std::string>().c_str());
+	return Get<double>();
 }
 
 template<> bool AssOverrideParameter::Get<bool>() const {
@@ -98,8 +115,9 @@ template<> AssDialogueBlockOverride *AssOverrideParameter::Get<AssDialogueBlockO
 
 template<> void AssOverrideParameter::Set<std::string>(std::string new_value) {
 	omitted = false;
-	value = new_value;
+	value = std::move(new_value);
 	block.reset();
+	ParseNumbers();
 }
 
 template<> void AssOverrideParameter::Set<int>(int new_value) {
@@ -152,8 +170,6 @@ struct AssOverrideTagProto {
 	/// Parameters to this tag
 	std::vector<AssOverrideParamProto> params;
 
-	typedef std::vector<AssOverrideTagProto>::iterator iterator;
-
 	/// @brief Add a parameter to this tag prototype
 	/// @param type Data type of the parameter
 	/// @param classi Semantic type of the parameter
@@ -173,14 +189,47 @@ struct AssOverrideTagProto {
 	}
 };
 
+/// Node of the trie of tag names
+struct AssOverrideTagTrieNode {
+	/// Index of the child node for each ASCII character, or 0 if there is
+	/// none
+	std::array<uint8_t, 128> children{{}};
+
+	/// Index of the prototype for the name ending at this node, or -1
+	int proto = -1;
+};
+
 static std::vector<AssOverrideTagProto> proto;
-static void load_protos() {
-	if (!proto.empty()) return;
+static std::vector<AssOverrideTagTrieNode> proto_trie;
+static std::once_flag proto_loaded;
+
+/// Build the trie of the prototypes' names, so that the prototype of a tag
+/// can be found with a single pass over its name
+static void build_proto_trie() {
+	proto_trie.resize(1);
+	for (size_t i = 0; i < proto.size(); ++i) {
+		size_t node = 0;
+		for (unsigned char c : proto[i].name) {
+			if (!proto_trie[node].children[c]) {
+				assert(proto_trie.size() < 256);
+				proto_trie[node].children[c] = proto_trie.size();
+				proto_trie.emplace_back();
+			}
+			node = proto_trie[node].children[c];
+		}
+		// Tags with two prototypes are found by their first
+		if (proto_trie[node].proto < 0)
+			proto_trie[node].proto = i;
+	}
+}
 
+static void do_load_protos() {
 	proto.resize(56);
 	int i = 0;
 
-	// Longer tag names must appear before shorter tag names
+	// Tags are matched to the prototype with the longest name which is a
+	// prefix of the tag, so the order only matters for the tags with two
+	// prototypes
 
 	proto[0].Set("\\alpha", VariableDataType::TEXT, AssParameterClass::ALPHA); // \alpha&H<aa>&
 	proto[++i].Set("\\bord", VariableDataType::FLOAT, AssParameterClass::ABSOLUTE_SIZE); // \bord<depth>
@@ -305,32 +354,59 @@ static void load_protos() {
 	proto[i].AddParam(VariableDataType::INT, AssParameterClass::RELATIVE_TIME_START,OPTIONAL_3 | OPTIONAL_4);
 	proto[i].AddParam(VariableDataType::FLOAT, AssParameterClass::NORMAL,OPTIONAL_2 | OPTIONAL_4);
 	proto[i].AddParam(VariableDataType::BLOCK);
+
+	build_proto_trie();
+}
+
+/// Tags may be parsed from several Lua states at once, so the prototypes
+/// are only ever loaded under the once flag
+static void load_protos() {
+	std::call_once(proto_loaded, do_load_protos);
 }
 
-std::vector<std::string> tokenize(const std::string &text) {
-	std::vector<std::string> paramList;
-	paramList.reserve(6);
+/// Find the prototype with the longest name which is a prefix of the text
+/// @return Index of the prototype, or -1 if there isn't one
+int find_proto(std::string::const_iterator begin, std::string::const_iterator end) {
+	int found = -1;
+	size_t node = 0;
+	for (auto it = begin; it != end; ++it) {
+		auto c = static_cast<unsigned char>(*it);
+		if (c >= 128 || !(node = proto_trie[node].children[c])) break;
+		if (proto_trie[node].proto >= 0)
+			found = proto_trie[node].proto;
+	}
+	return found;
+}
 
-	if (text.empty())
-		return paramList;
+agi::StringRange trim(std::string::const_iterator begin, std::string::const_iterator end) {
+	auto is_space = boost::algorithm::is_space();
+	while (begin != end && is_space(*begin)) ++begin;
+	while (end != begin && is_space(*(end - 1))) --end;
+	return agi::StringRange(begin, end);
+}
 
-	if (text[0] != '(') {
+/// Split the parameters of a tag into ranges of its text
+void tokenize(std::string::const_iterator begin, std::string::const_iterator end, std::vector<agi::StringRange> &paramList) {
+	if (begin == end)
+		return;
+
+	if (*begin != '(') {
 		// There's just one parameter (because there's no parentheses)
 		// This means text is all our parameters
-		paramList.emplace_back(boost::trim_copy(text));
-		return paramList;
+		paramList.push_back(trim(begin, end));
+		return;
 	}
 
 	// Ok, so there are parentheses used here, so there may be more than one parameter
 	// Enter fullscale parsing!
-	size_t i = 0, textlen = text.size();
+	auto i = begin;
 	int parDepth = 1;
-	while (i < textlen && parDepth > 0) {
+	while (i != end && parDepth > 0) {
 		// Just skip until next ',' or ')', whichever comes first
 		// (Next ')' is achieved when parDepth == 0)
-		size_t start = ++i;
-		while (i < textlen && parDepth > 0) {
-			char c = text[i];
+		auto start = ++i;
+		while (i != end && parDepth > 0) {
+			char c = *i;
 			// parDepth 1 is where we start, and the tag-level we're interested in parsing on
 			if (c == ',' && parDepth == 1) break;
 			if (c == '(') parDepth++;
@@ -341,35 +417,40 @@ std::vector<std::string> tokenize(const std::string &text) {
 					break;
 				}
 			}
-			i++;
+			++i;
 		}
 		// i now points to the first character not member of this parameter
-		paramList.emplace_back(boost::trim_copy(text.substr(start, i - start)));
+		paramList.push_back(trim(start, i));
 	}
 
-	if (i+1 < textlen) {
+	if (i != end && i + 1 != end) {
 		// There's some additional garbage after the parentheses
 		// Just add it in for completeness
-		paramList.emplace_back(text.begin() + i + 1, text.end());
+		paramList.emplace_back(i + 1, end);
 	}
-	return paramList;
 }
 
-void parse_parameters(AssOverrideTag *tag, const std::string &text, AssOverrideTagProto::iterator proto_it) {
+void parse_parameters(AssOverrideTag *tag, std::string::const_iterator begin, std::string::const_iterator end, size_t proto_index) {
 	tag->Clear();
 
-	// Tokenize text, attempting to find all parameters
-	std::vector<std::string> paramList = tokenize(text);
+	// Tokenize text, attempting to find all parameters. The ranges are only
+	// needed until they're copied into the parameters, so the vector is
+	// reused rather than allocated for every tag.
+	thread_local std::vector<agi::StringRange> paramList;
+	paramList.clear();
+	tokenize(begin, end, paramList);
 	size_t totalPars = paramList.size();
 
 	int parsFlag = 1 << (totalPars - 1); // Get optional parameters flag
-	// vector (i)clip is the second clip proto_ittype in the list
+	// vector (i)clip is the second clip prototype in the list
 	if ((tag->Name == "\\clip" || tag->Name == "\\iclip") && totalPars != 4) {
-		++proto_it;
+		++proto_index;
 	}
 
+	auto const& params = proto[proto_index].params;
+	tag->Params.reserve(params.size());
 	unsigned curPar = 0;
-	for (auto& curproto : proto_it->params) {
+	for (auto& curproto : params) {
 		// Create parameter
 		tag->Params.emplace_back(curproto.type, curproto.classification);
 
@@ -377,7 +458,8 @@ void parse_parameters(AssOverrideTag *tag, const std::string &text, AssOverrideT
 		if (!(curproto.optional & parsFlag) || curPar >= totalPars)
 			continue;
 
-		tag->Params.back().Set(paramList[curPar++]);
+		auto const& param = paramList[curPar++];
+		tag->Params.back().Set(std::string(param.begin(), param.end()));
 	}
 }
 
@@ -386,24 +468,38 @@ void parse_parameters(AssOverrideTag *tag, const std::string &text, AssOverrideT
 // From ass_dialogue.h
 void AssDialogueBlockOverride::ParseTags() {
 	Tags.clear();
+	SplitTags(text.cbegin(), text.cend(), [&](std::string::const_iterator begin, std::string::const_iterator end) {
+		Tags.emplace_back(begin, end);
+	});
+}
 
-	int depth = 0;
-	size_t start = 0;
-	for (size_t i = 1; i < text.size(); ++i) {
-		if (depth > 0) {
-			if (text[i] == ')')
-				--depth;
-		}
-		else if (text[i] == '\\') {
-			Tags.emplace_back(text.substr(start, i - start));
-			start = i;
+int AssDialogueBlockOverride::GetDrawingLevel(std::string::const_iterator begin, std::string::const_iterator end, int level) {
+	// Most blocks don't have anything which could be a \p tag
+	static const std::string p_tag = "\\p";
+	if (std::search(begin, end, p_tag.begin(), p_tag.end()) == end)
+		return level;
+
+	load_protos();
+	static const int p_proto = find_proto(p_tag.begin(), p_tag.end());
+	SplitTags(begin, end, [&](std::string::const_iterator tag_begin, std::string::const_iterator tag_end) {
+		if (find_proto(tag_begin, tag_end) != p_proto) return;
+
+		thread_local std::vector<agi::StringRange> paramList;
+		paramList.clear();
+		tokenize(tag_begin + 2, tag_end, paramList);
+		if (paramList.empty()) {
+			// An omitted parameter reads as zero
+			level = 0;
+			return;
 		}
-		else if (text[i] == '(')
-			++depth;
-	}
 
-	if (!text.empty())
-		Tags.emplace_back(text.substr(start));
+		// Parse the same way as AssOverrideParameter so that the result
+		// matches ParseTags exactly
+		thread_local std::string value;
+		value.assign(paramList[0].begin(), paramList[0].end());
+		level = atoi(value.c_str());
+	});
+	return level;
 }
 
 void AssDialogueBlockOverride::AddTag(std::string const& tag) {
@@ -434,25 +530,31 @@ AssOverrideTag::AssOverrideTag(std::string const& text) {
 	SetText(text);
 }
 
+AssOverrideTag::AssOverrideTag(std::string::const_iterator begin, std::string::const_iterator end) {
+	SetText(begin, end);
+}
+
 void AssOverrideTag::Clear() {
 	Params.clear();
-	Params.reserve(6);
 	valid = false;
 }
 
 void AssOverrideTag::SetText(const std::string &text) {
+	SetText(text.begin(), text.end());
+}
+
+void AssOverrideTag::SetText(std::string::const_iterator begin, std::string::const_iterator end) {
 	load_protos();
-	for (auto cur = proto.begin(); cur != proto.end(); ++cur) {
-		if (boost::starts_with(text, cur->name)) {
-			Name = cur->name;
-			parse_parameters(this, text.substr(Name.size()), cur);
-			valid = true;
-			return;
-		}
+	int index = find_proto(begin, end);
+	if (index >= 0) {
+		Name = proto[index].name;
+		parse_parameters(this, begin + Name.size(), end, index);
+		valid = true;
+		return;
 	}
 
 	// Junk tag
-	Name = text;
+	Name.assign(begin, end);
 	valid = false;
 }
 
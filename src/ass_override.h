@@ -33,6 +33,7 @@
 ///
 
 #include <memory>
+#include <string>
 #include <vector>
 
 class AssDialogueBlockOverride;
@@ -67,6 +68,14 @@ class AssOverrideParameter {
 	mutable std::unique_ptr<AssDialogueBlockOverride> block;
 	VariableDataType type;
 
+	/// The value as each numeric type, parsed when the value is set for
+	/// parameters which are numbers so that getting them doesn't reparse it
+	int int_value = 0;
+	double float_value = 0;
+	bool has_numbers = false;
+
+	void ParseNumbers();
+
 public:
 	AssOverrideParameter(VariableDataType type, AssParameterClass classification);
 	AssOverrideParameter(AssOverrideParameter&&) = default;
@@ -93,6 +102,7 @@ class AssOverrideTag {
 public:
 	AssOverrideTag() = default;
 	AssOverrideTag(std::string const& text);
+	AssOverrideTag(std::string::const_iterator begin, std::string::const_iterator end);
 	AssOverrideTag(AssOverrideTag&&) = default;
 	AssOverrideTag& operator=(AssOverrideTag&&) = default;
 
@@ -102,5 +112,6 @@ public:
 	bool IsValid() const { return valid; }
 	void Clear();
 	void SetText(const std::string &text);
+	void SetText(std::string::const_iterator begin, std::string::const_iterator end);
 	operator std::string() const;
 };
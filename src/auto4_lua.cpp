@@ -61,12 +61,16 @@
 #include <libaegisub/path.h>
 
 #include <algorithm>
+#include <atomic>
 #include <boost/algorithm/string/case_conv.hpp>
 #include <boost/algorithm/string/classification.hpp>
 #include <boost/algorithm/string/predicate.hpp>
+#include <boost/filesystem/operations.hpp>
 #include <boost/scope_exit.hpp>
 #include <cassert>
+#include <future>
 #include <mutex>
+#include <thread>
 
 using namespace agi::lua;
 using namespace Automation4;
@@ -83,6 +87,22 @@ namespace {
 		}
 	}
 
+	/// Push require(module_name)[function_name] for a parallel_map worker.
+	/// Loading the module runs arbitrary code, so this is called in a
+	/// protected call.
+	int get_map_function(lua_State *W)
+	{
+		const std::string module_name = check_string(W, 1);
+		const std::string function_name = check_string(W, 2);
+		lua_getglobal(W, "require");
+		lua_pushvalue(W, 1);
+		lua_call(W, 1, 1);
+		lua_getfield(W, -1, function_name.c_str());
+		if (!lua_isfunction(W, -1))
+			return error(W, "'%s' is not a function in module '%s'", function_name.c_str(), module_name.c_str());
+		return 1;
+	}
+
 	void set_context(lua_State *L, const agi::Context *c)
 	{
 		// Explicit cast is needed to discard the const
@@ -209,6 +229,24 @@ namespace {
 		throw error_tag();
 	}
 
+	/// Set the fields of the aegisub table which don't need the project, and
+	/// so are also available to parallel_map's workers
+	void set_text_functions(lua_State *L)
+	{
+		set_field<LuaParseTags>(L, "parse_tags");
+		set_field<LuaBuildText>(L, "build_text");
+		set_field<LuaSetTag>(L, "set_tag");
+		set_field<LuaStripTags>(L, "strip_tags");
+		set_field<LuaCharCount>(L, "char_count");
+		set_field<LuaWrap>(L, "wrap");
+		set_field<LuaKaraokeMatch>(L, "karaoke_match");
+
+		lua_createtable(L, 0, 2);
+		set_field<LuaCacheGet>(L, "get");
+		set_field<LuaCachePut>(L, "put");
+		lua_setfield(L, -2, "cache");
+	}
+
 	int lua_text_textents(lua_State *L)
 	{
 		argcheck(L, !!lua_istable(L, 1), 1, "");
@@ -346,15 +384,31 @@ namespace {
 
 		std::vector<cmd::Command*> macros;
 
+		/// Lua states used to run parallel_map's function, created on first
+		/// use and kept until the script is unloaded so that the modules they
+		/// load only have to be loaded once
+		std::vector<lua_State*> workers;
+
+		/// LuaJIT settings for the script's Lua states
+		LuaJitSettings jit;
+		/// Trace events of the script's Lua states, if requested
+		std::unique_ptr<JitTraceReport> jit_report;
+
 		/// load script and create internal structures etc.
 		void Create();
 		/// destroy internal structures, unreg features and delete environment
 		void Destroy();
 
+		/// Create a Lua state for parallel_map with the same module search
+		/// path as the script, but none of the functions which need the
+		/// script or project
+		lua_State *CreateWorker();
+
 		static int LuaInclude(lua_State *L);
+		static int LuaParallelMap(lua_State *L);
 
 	public:
-		LuaScript(agi::fs::path const& filename);
+		LuaScript(agi::fs::path const& filename, LuaJitSettings jit);
 		~LuaScript() { Destroy(); }
 
 		void RegisterCommand(LuaCommand *command);
@@ -374,8 +428,9 @@ namespace {
 		std::vector<cmd::Command*> GetMacros() const override { return macros; }
 	};
 
-	LuaScript::LuaScript(agi::fs::path const& filename)
+	LuaScript::LuaScript(agi::fs::path const& filename, LuaJitSettings jit)
 	: Script(filename)
+	, jit(std::move(jit))
 	{
 		Create();
 	}
@@ -401,6 +456,23 @@ namespace {
 		preload_modules(L);
 		stackcheck.check_stack(0);
 
+		if (!ConfigureJit(L, jit)) {
+			description = "Invalid LuaJIT options: " + get_string_or_default(L, 1);
+			lua_pop(L, 1);
+			return;
+		}
+		if (jit.report) {
+			jit_report = agi::make_unique<JitTraceReport>();
+			jit_report->Attach(L);
+		}
+		stackcheck.check_stack(0);
+
+		lua_getglobal(L, "package");
+		lua_getfield(L, -1, "preload");
+		set_field(L, "aegisub.__lines_impl", LuaAssFile::LuaOpenLinesImpl);
+		lua_pop(L, 2);
+		stackcheck.check_stack(0);
+
 		// dofile and loadfile are replaced with include
 		lua_pushnil(L);
 		lua_setglobal(L, "dofile");
@@ -425,6 +497,11 @@ namespace {
 		lua_setfield(L, LUA_REGISTRYINDEX, "filename");
 		stackcheck.check_stack(0);
 
+		// aegisub.cache keys are per script
+		push_value(L, boost::filesystem::absolute(GetFilename()));
+		lua_setfield(L, LUA_REGISTRYINDEX, "script_path");
+		stackcheck.check_stack(0);
+
 		// reference to the script object
 		push_value(L, this);
 		lua_setfield(L, LUA_REGISTRYINDEX, "aegisub");
@@ -450,6 +527,8 @@ namespace {
 		set_field<project_properties>(L, "project_properties");
 		set_field<lua_get_audio_selection>(L, "get_audio_selection");
 		set_field<lua_set_status_text>(L, "set_status_text");
+		set_field<LuaParallelMap>(L, "parallel_map");
+		set_text_functions(L);
 
 		// store aegisub table to globals
 		lua_settable(L, LUA_GLOBALSINDEX);
@@ -508,8 +587,61 @@ namespace {
 		for (int i = macros.size() - 1; i >= 0; --i)
 			cmd::unreg(macros[i]->name());
 
+		for (auto worker : workers)
+			lua_close(worker);
+		workers.clear();
+
 		lua_close(L);
 		L = nullptr;
+
+		if (jit_report) {
+			jit_report->Log(name);
+			jit_report.reset();
+		}
+	}
+
+	lua_State *LuaScript::CreateWorker()
+	{
+		lua_State *W = luaL_newstate();
+		if (!W) throw agi::InternalError("Could not initialize Lua state");
+
+		preload_modules(W);
+		if (!ConfigureJit(W, jit)) {
+			std::string err = get_string_or_default(W, 1);
+			lua_close(W);
+			throw agi::InternalError("Invalid LuaJIT options: " + err);
+		}
+		if (jit_report)
+			jit_report->Attach(W);
+
+		lua_pushnil(W);
+		lua_setglobal(W, "dofile");
+		lua_pushnil(W);
+		lua_setglobal(W, "loadfile");
+		push_value(W, exception_wrapper<LuaInclude>);
+		lua_setglobal(W, "include");
+
+		if (!Install(W, include_path)) {
+			std::string err = get_string_or_default(W, 1);
+			lua_close(W);
+			throw agi::InternalError("Could not initialize Lua state: " + err);
+		}
+
+		// include() looks up the script's include path through this
+		push_value(W, this);
+		lua_setfield(W, LUA_REGISTRYINDEX, "aegisub");
+
+		// aegisub.cache keys are per script
+		push_value(W, boost::filesystem::absolute(GetFilename()));
+		lua_setfield(W, LUA_REGISTRYINDEX, "script_path");
+
+		lua_createtable(W, 0, 8);
+		set_text_functions(W);
+		set_field(W, "lua_automation_version", 4);
+		set_field<get_translation>(W, "gettext");
+		lua_setglobal(W, "aegisub");
+
+		return W;
 	}
 
 	void LuaScript::RegisterCommand(LuaCommand *command)
@@ -566,6 +698,107 @@ namespace {
 		return lua_gettop(L) - pretop;
 	}
 
+	int LuaScript::LuaParallelMap(lua_State *L)
+	{
+		auto s = GetScriptObject(L);
+		const std::string module_name = check_string(L, 1);
+		const std::string function_name = check_string(L, 2);
+		luaL_checktype(L, 3, LUA_TTABLE);
+
+		// Items and results are passed between states serialized with luabins,
+		// which is binary so has to be read with its length
+		const size_t count = lua_objlen(L, 3);
+		std::vector<std::string> items(count);
+		for (size_t i = 0; i < count; ++i) {
+			lua_rawgeti(L, 3, i + 1);
+			if (luabins_save(L, lua_gettop(L), lua_gettop(L)))
+				return error(L, "parallel_map: could not serialize item %d: %s", (int)i + 1, get_string_or_default(L, -1).c_str());
+			items[i] = agi::lua::get_string(L, -1);
+			lua_pop(L, 2);
+		}
+
+		size_t thread_count = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u), count);
+		while (s->workers.size() < thread_count)
+			s->workers.push_back(s->CreateWorker());
+
+		std::vector<std::string> results(count);
+		std::atomic<size_t> next_item{0};
+		std::atomic<bool> failed{false};
+		std::mutex error_mutex;
+		// The error reported is the one from the earliest item, so that it
+		// doesn't depend on how the items were scheduled
+		size_t error_item = count;
+		std::string error_message;
+
+		auto run = [&](lua_State *W) {
+			auto fail = [&](size_t item, std::string const& message) {
+				std::lock_guard<std::mutex> lock(error_mutex);
+				if (item < error_item) {
+					error_item = item;
+					error_message = message;
+				}
+				failed = true;
+			};
+
+			lua_settop(W, 0);
+			lua_pushcclosure(W, add_stack_trace, 0);
+			const int handler = lua_gettop(W);
+
+			// Look up the function once per run of the worker
+			push_value(W, exception_wrapper<get_map_function>);
+			push_value(W, module_name);
+			push_value(W, function_name);
+			if (lua_pcall(W, 2, 1, handler)) {
+				fail(0, agi::format("could not load '%s' from module '%s':\n%s", function_name, module_name, get_string_or_default(W, -1)));
+				lua_settop(W, 0);
+				return;
+			}
+			const int function = lua_gettop(W);
+
+			for (size_t i; !failed && (i = next_item++) < count; ) {
+				lua_pushvalue(W, function);
+				int loaded = 0;
+				auto const& item = items[i];
+				if (luabins_load(W, reinterpret_cast<const unsigned char *>(item.data()), item.size(), &loaded)) {
+					fail(i, agi::format("could not deserialize item %d: %s", i + 1, get_string_or_default(W, -1)));
+					break;
+				}
+
+				if (lua_pcall(W, loaded, 1, handler)) {
+					fail(i, agi::format("error processing item %d:\n%s", i + 1, get_string_or_default(W, -1)));
+					break;
+				}
+
+				if (luabins_save(W, function + 1, function + 1)) {
+					fail(i, agi::format("could not serialize result %d: %s", i + 1, get_string_or_default(W, -1)));
+					break;
+				}
+				results[i] = agi::lua::get_string(W, -1);
+				lua_settop(W, function);
+			}
+			lua_settop(W, 0);
+		};
+
+		std::vector<std::future<void>> futures;
+		for (size_t i = 0; i < thread_count; ++i)
+			futures.push_back(std::async(std::launch::async, run, s->workers[i]));
+		for (auto& future : futures)
+			future.get();
+
+		if (failed)
+			return error(L, "parallel_map: %s", error_message.c_str());
+
+		lua_createtable(L, count, 0);
+		for (size_t i = 0; i < count; ++i) {
+			int loaded = 0;
+			auto const& result = results[i];
+			if (luabins_load(L, reinterpret_cast<const unsigned char *>(result.data()), result.size(), &loaded))
+				return error(L, "parallel_map: could not deserialize result %d: %s", (int)i + 1, get_string_or_default(L, -1).c_str());
+			lua_rawseti(L, -2, i + 1);
+		}
+		return 1;
+	}
+
 	void LuaThreadedCall(lua_State *L, int nargs, int nresults, std::string const& title, bool can_open_config)
 	{
 		bool failed = false;
@@ -866,15 +1099,18 @@ namespace {
 }
 
 namespace Automation4 {
-	LuaScriptFactory::LuaScriptFactory()
+	LuaScriptFactory::LuaScriptFactory(LuaJitSettings jit, uint64_t cache_size)
 	: ScriptFactory("Lua", "*.lua,*.moon")
+	, jit(std::move(jit))
 	{
+		agi::lua::SetCacheDirectory(config::path->Decode("?local/automation"));
+		SetLuaCache(config::path->Decode("?local/automation/cache.dat"), cache_size);
 	}
 
 	std::unique_ptr<Script> LuaScriptFactory::Produce(agi::fs::path const& filename) const
 	{
 		if (agi::fs::HasExtension(filename, "lua") || agi::fs::HasExtension(filename, "moon"))
-			return agi::make_unique<LuaScript>(filename);
+			return agi::make_unique<LuaScript>(filename, jit);
 		return nullptr;
 	}
 }
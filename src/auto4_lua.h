@@ -27,22 +27,98 @@
 //
 // Aegisub Project http://www.aegisub.org/
 
+#include "ass_entry.h"
 #include "auto4_base.h"
 
+#include <libaegisub/gap_buffer.h>
+
+#include <array>
 #include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
-class AssEntry;
+class AssDialogue;
+class AssKaraokeSyllables;
+class EventTimeIndex;
+struct agi_dialogue;
+struct agi_subs;
 struct lua_State;
 
+// Serialization of Lua values, used to pass values between Lua states and to
+// store them in aegisub.cache; see vendor/luabins/src/luabins.h
+extern "C" {
+int luabins_save(lua_State *L, int index_from, int index_to);
+int luabins_load(lua_State *L, const unsigned char *data, size_t len, int *count);
+}
+
 namespace Automation4 {
+	// Override tag functions exposed in the aegisub table; see auto4_lua_tags.cpp
+	int LuaParseTags(lua_State *L);
+	int LuaBuildText(lua_State *L);
+	int LuaSetTag(lua_State *L);
+	int LuaStripTags(lua_State *L);
+
+	// Character counting, wrapping and karaoke matching functions exposed in
+	// the aegisub table; see auto4_lua_text.cpp
+	int LuaCharCount(lua_State *L);
+	int LuaWrap(lua_State *L);
+	int LuaKaraokeMatch(lua_State *L);
+
+	// Native karaoke template application; see auto4_lua_templater.cpp
+	class KaraokeTemplater;
+
+	// Persistent cache exposed as aegisub.cache; see auto4_lua_cache.cpp
+	int LuaCacheGet(lua_State *L);
+	int LuaCachePut(lua_State *L);
+
+	/// Set the file used for aegisub.cache, which is opened on first use
+	/// @param max_size Maximum size of the file in bytes, or 0 to disable
+	///                 the cache
+	void SetLuaCache(agi::fs::path const& filename, uint64_t max_size);
+
+	struct LuaJitSettings;
+
+	/// Apply the JIT settings to a Lua state
+	/// @return false with an error message pushed if an option was rejected
+	bool ConfigureJit(lua_State *L, LuaJitSettings const& settings);
+
+	/// @class JitTraceReport
+	/// @brief Collects LuaJIT trace events from one or more Lua states
+	///
+	/// Traces which abort fall back to the interpreter, which can make hot
+	/// loops far slower than expected, so the aborts are counted along with
+	/// the location and reason given by the trace compiler.
+	class JitTraceReport {
+		std::mutex mutex;
+		size_t started = 0;
+		size_t stopped = 0;
+		size_t aborted = 0;
+		/// Number of aborts by "file:line: reason"
+		std::map<std::string, size_t> aborts;
+
+		static int OnTrace(lua_State *L);
+	public:
+		/// Start collecting the trace events of a Lua state
+		void Attach(lua_State *L);
+		/// Write the collected events to the log
+		void Log(std::string const& script_name);
+	};
+
 	/// @class LuaAssFile
 	/// @brief Object wrapping an AssFile object for modification through Lua
 	class LuaAssFile {
+		friend class KaraokeTemplater;
+
+		/// An undo point set by the script. The CLI has no undo stack, so
+		/// only the description and what changed are recorded rather than a
+		/// snapshot of the lines, and the final state is applied once.
 		struct PendingCommit {
 			std::string mesage;
 			int modification_type;
-			std::vector<AssEntry*> lines;
 		};
 
 		/// Pointer to file being modified
@@ -59,6 +135,12 @@ namespace Automation4 {
 		void CheckAllowModify();
 		/// throws an error if the line index is out of bounds
 		void CheckBounds(int idx);
+		/// Read an optional one-based inclusive range of lines from the
+		/// arguments at arg and arg + 1, defaulting to the whole file
+		void CheckRange(lua_State *L, int arg, size_t& first, size_t& last);
+		/// Get the line at the zero-based index, whether or not it's a
+		/// script info line which hasn't been copied yet
+		AssEntry const& GetEntry(size_t idx) const;
 
 		/// How ass file been modified by the script since the last commit
 		int modification_type = 0;
@@ -68,14 +150,41 @@ namespace Automation4 {
 		int references = 2;
 
 		/// Set of subtitle lines being modified; initially a shallow copy of ass->Line
-		std::vector<AssEntry*> lines;
+		agi::gap_buffer<AssEntry*> lines;
 		bool script_info_copied = false;
 
+		/// Number of lines of each group in lines
+		std::array<size_t, (size_t)AssEntryGroup::GROUP_MAX> group_counts{};
+		/// Are all lines of each group contiguous and the groups in order? If
+		/// so, the position to append a line of a group at can be calculated
+		/// from the counts rather than searched for.
+		bool groups_in_order = true;
+		/// Update the group counts and order flag for lines just inserted at
+		/// [idx, idx + count)
+		void LinesInserted(size_t idx, size_t count);
+		/// Update the group counts for a line about to be removed
+		void LineRemoved(size_t idx);
+		/// Get the position to append a line of the given group at
+		size_t AppendPosition(AssEntryGroup group) const;
+
 		/// Commits to apply once processing completes successfully
 		std::deque<PendingCommit> pending_commits;
 		/// Lines to delete once processing complete successfully
 		std::vector<std::unique_ptr<AssEntry>> lines_to_delete;
 
+		/// Index over the times of the non-comment dialogue lines, built on
+		/// first use and discarded whenever the set of lines changes
+		std::unique_ptr<EventTimeIndex> time_index;
+		/// Get the time index, building it if needed
+		EventTimeIndex const& GetTimeIndex();
+		/// Build a time index over the non-comment dialogue lines among
+		/// the given zero-based line indices
+		std::unique_ptr<EventTimeIndex> BuildTimeIndex(std::vector<size_t> const& ids) const;
+
+		/// Syllables parsed by parse_karaoke_data, by the text they were
+		/// parsed from, as the same line is often parsed several times
+		std::unordered_map<std::string, std::unique_ptr<AssKaraokeSyllables>> karaoke_cache;
+
 		/// Create copies of all of the lines in the script info section if it
 		/// hasn't already happened. This is done lazily, since it only needs
 		/// to happen when the user modifies the headers in some way, which
@@ -88,6 +197,7 @@ namespace Automation4 {
 		/// Set the line at the index to the given value
 		void AssignLine(size_t idx, std::unique_ptr<AssEntry> e);
 		void InsertLine(std::vector<AssEntry *> &vec, size_t idx, std::unique_ptr<AssEntry> e);
+		void InsertLine(size_t idx, std::unique_ptr<AssEntry> e);
 
 		int ObjectIndexRead(lua_State *L);
 		void ObjectIndexWrite(lua_State *L);
@@ -96,20 +206,51 @@ namespace Automation4 {
 		void ObjectDeleteRange(lua_State *L);
 		void ObjectAppend(lua_State *L);
 		void ObjectInsert(lua_State *L);
+		void ObjectSort(lua_State *L);
 		void ObjectGarbageCollect(lua_State *L);
 		int ObjectIPairs(lua_State *L);
 		int IterNext(lua_State *L);
 
 		int LuaParseKaraokeData(lua_State *L);
 		int LuaGetScriptResolution(lua_State *L);
+		int LuaColumn(lua_State *L);
+		int LuaGetRange(lua_State *L);
+		int LuaFind(lua_State *L);
+		int LuaLinesOverlapping(lua_State *L);
+		int LuaApplyTemplates(lua_State *L);
+		int LuaOverlaps(lua_State *L);
 
 		void LuaSetUndoPoint(lua_State *L);
 
+		/// Lines which were copied from the file for modification through
+		/// the FFI and so can be modified in place
+		std::unordered_set<AssEntry *> writable_lines;
+		/// Get the dialogue line at the index for modification, copying it
+		/// first if it's still the file's line
+		/// @return nullptr if the index is out of range or not dialogue
+		AssDialogue *GetWritableDialogue(size_t idx, int modification);
+
+		// Functions exposed to Lua through the FFI, taking an agi_subs handle
+		// obtained from subs.__handle. Indices are zero-based.
+		static size_t FFICount(agi_subs *subs);
+		static bool FFIGetDialogue(agi_subs *subs, size_t idx, agi_dialogue *out);
+		static bool FFISetTimes(agi_subs *subs, size_t idx, int start, int end);
+		static bool FFISetLayer(agi_subs *subs, size_t idx, int layer);
+		static bool FFISetMargins(agi_subs *subs, size_t idx, int l, int r, int t);
+		static bool FFISetComment(agi_subs *subs, size_t idx, bool comment);
+		static bool FFISetStyle(agi_subs *subs, size_t idx, const char *str, size_t len);
+		static bool FFISetActor(agi_subs *subs, size_t idx, const char *str, size_t len);
+		static bool FFISetEffect(agi_subs *subs, size_t idx, const char *str, size_t len);
+		static bool FFISetText(agi_subs *subs, size_t idx, const char *str, size_t len);
+
 		// LuaAssFile can only be deleted by the reference count hitting zero
 		~LuaAssFile();
 	public:
 		static LuaAssFile *GetObjPointer(lua_State *L, int idx, bool allow_expired);
 
+		/// Loader for the aegisub.__lines_impl FFI module
+		static int LuaOpenLinesImpl(lua_State *L);
+
 		/// makes a Lua representation of AssEntry and places on the top of the stack
 		void AssEntryToLua(lua_State *L, size_t idx);
 		/// assumes a Lua representation of AssEntry on the top of the stack, and creates an AssEntry object of it
@@ -39,14 +39,18 @@
 #include "ass_file.h"
 #include "ass_karaoke.h"
 #include "ass_style.h"
+#include "event_time_index.h"
 
 #include <libaegisub/exception.h>
 #include <libaegisub/log.h>
+#include <libaegisub/lua/ffi.h>
 #include <libaegisub/lua/utils.h>
 #include <libaegisub/make_unique.h>
 
 #include <algorithm>
 #include <boost/algorithm/string/case_conv.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/algorithm/string/split.hpp>
 #include <cassert>
 #include <memory>
 
@@ -113,7 +117,7 @@ namespace {
 		return 0;
 	}
 
-	int modification_mask(AssEntry *e)
+	int modification_mask(const AssEntry *e)
 	{
 		if (!e) return AssFile::COMMIT_SCRIPTINFO;
 		switch (e->Group()) {
@@ -123,117 +127,272 @@ namespace {
 		}
 	}
 
-	template<typename T, typename U>
-	const T *check_cast_constptr(const U *value) {
-		return typeid(const T) == typeid(*value) ? static_cast<const T *>(value) : nullptr;
+	/// Push a table of one-based line indices given zero-based ones
+	void push_line_indices(lua_State *L, std::vector<size_t> const& ids)
+	{
+		lua_createtable(L, ids.size(), 0);
+		for (size_t i = 0; i < ids.size(); ++i) {
+			lua_pushinteger(L, ids[i] + 1);
+			lua_rawseti(L, -2, i + 1);
+		}
 	}
-}
 
-namespace Automation4 {
-	LuaAssFile::~LuaAssFile() { }
-
-	void LuaAssFile::CheckAllowModify()
+	AssEntryGroup group_of(const AssEntry *e)
 	{
-		if (!can_modify)
-			error(L, "Attempt to modify subtitles in read-only feature context.");
+		return e ? e->Group() : AssEntryGroup::INFO;
 	}
 
-	void LuaAssFile::CheckBounds(int idx)
-	{
-		if (idx <= 0 || idx > (int)lines.size())
-			error(L, "Requested out-of-range line from subtitle file: %d", idx);
+	template<typename T, typename U>
+	const T *check_cast_constptr(const U *value) {
+		return typeid(const T) == typeid(*value) ? static_cast<const T *>(value) : nullptr;
 	}
 
-	void LuaAssFile::AssEntryToLua(lua_State *L, size_t idx)
+	/// Get the commit types needed to replace one line with another, or zero
+	/// if they're identical
+	int modification_diff(AssEntry const& old_line, AssEntry const& new_line)
 	{
-		lua_newtable(L);
-
-		const AssEntry *e = lines[idx];
-		if (!e)
-			e = &ass->Info[idx];
-
-		set_field(L, "section", e->GroupHeader());
-
-		if (auto info = check_cast_constptr<AssInfo>(e)) {
-			set_field(L, "raw", info->GetEntryData());
-			set_field(L, "key", info->Key());
-			set_field(L, "value", info->Value());
-			set_field(L, "class", "info");
+		if (typeid(old_line) != typeid(new_line))
+			return modification_mask(&old_line) | modification_mask(&new_line);
+
+		if (auto old_dia = check_cast_constptr<AssDialogue>(&old_line)) {
+			auto new_dia = static_cast<AssDialogue const*>(&new_line);
+			int mask = 0;
+			if (old_dia->Start != new_dia->Start || old_dia->End != new_dia->End)
+				mask |= AssFile::COMMIT_DIAG_TIME;
+			if (old_dia->Text != new_dia->Text)
+				mask |= AssFile::COMMIT_DIAG_TEXT;
+			if (old_dia->Comment != new_dia->Comment || old_dia->Layer != new_dia->Layer ||
+				old_dia->Margin != new_dia->Margin || old_dia->Style != new_dia->Style ||
+				old_dia->Actor != new_dia->Actor || old_dia->Effect != new_dia->Effect)
+				mask |= AssFile::COMMIT_DIAG_META;
+			if (old_dia->ExtradataIds != new_dia->ExtradataIds)
+				mask |= AssFile::COMMIT_EXTRADATA;
+			return mask;
 		}
-		else if (auto dia = check_cast_constptr<AssDialogue>(e)) {
-			set_field(L, "raw", dia->GetEntryData());
-			set_field(L, "comment", dia->Comment);
 
-			set_field(L, "layer", dia->Layer);
-
-			set_field(L, "start_time", dia->Start);
-			set_field(L, "end_time", dia->End);
+		if (auto old_info = check_cast_constptr<AssInfo>(&old_line)) {
+			auto new_info = static_cast<AssInfo const*>(&new_line);
+			return old_info->Key() == new_info->Key() && old_info->Value() == new_info->Value() ? 0 : AssFile::COMMIT_SCRIPTINFO;
+		}
 
-			set_field(L, "style", dia->Style);
-			set_field(L, "actor", dia->Actor);
-			set_field(L, "effect", dia->Effect);
+		auto old_style = check_cast_constptr<AssStyle>(&old_line);
+		auto new_style = static_cast<AssStyle const*>(&new_line);
+		return old_style && old_style->GetEntryData() == new_style->GetEntryData() ? 0 : modification_mask(&new_line);
+	}
 
-			set_field(L, "margin_l", dia->Margin[0]);
-			set_field(L, "margin_r", dia->Margin[1]);
-			set_field(L, "margin_t", dia->Margin[2]);
-			set_field(L, "margin_b", dia->Margin[2]);
+	/// Match a string against a pattern where * matches any run of bytes
+	/// and ? matches any single byte
+	bool glob_match(const char *str, const char *pattern) {
+		const char *star = nullptr, *backtrack = nullptr;
+		while (*str) {
+			if (*pattern == '*') {
+				star = pattern++;
+				backtrack = str;
+			}
+			else if (*pattern == '?' || *pattern == *str) {
+				++pattern;
+				++str;
+			}
+			else if (star) {
+				pattern = star + 1;
+				str = ++backtrack;
+			}
+			else
+				return false;
+		}
+		while (*pattern == '*') ++pattern;
+		return !*pattern;
+	}
 
-			set_field(L, "text", dia->Text);
+	/// A field value searched for by find
+	struct FindCriterion {
+		std::string field;
+		/// Lua type of the value
+		int type;
+		std::string str;
+		double num;
+		bool boolean;
+	};
+
+	/// Does a field's value match a criterion, as it would if the value were
+	/// pushed to Lua and compared there?
+	bool field_matches(FindCriterion const& c, const char *value) {
+		return c.type == LUA_TSTRING && glob_match(value, c.str.c_str());
+	}
+	bool field_matches(FindCriterion const& c, std::string const& value) {
+		return field_matches(c, value.c_str());
+	}
+	bool field_matches(FindCriterion const& c, double value) {
+		return c.type == LUA_TNUMBER && value == c.num;
+	}
+	bool field_matches(FindCriterion const& c, int value) {
+		return field_matches(c, static_cast<double>(value));
+	}
+	bool field_matches(FindCriterion const& c, bool value) {
+		return c.type == LUA_TBOOLEAN && value == c.boolean;
+	}
 
-			// create extradata table
+	struct LineField {
+		const char *name;
+		void (*push)(lua_State *L, AssEntry const& e, AssFile const& ass);
+		bool (*matches)(AssEntry const& e, AssFile const& ass, FindCriterion const& c);
+	};
+
+	#define FIELD(type, name, expr) \
+		{name, [](lua_State *L, AssEntry const& e, AssFile const& ass) { \
+			auto& line = static_cast<type const&>(e); (void)line; (void)ass; \
+			push_value(L, expr); \
+		}, [](AssEntry const& e, AssFile const& ass, FindCriterion const& c) { \
+			auto& line = static_cast<type const&>(e); (void)line; (void)ass; \
+			return field_matches(c, expr); \
+		}}
+
+	const LineField info_fields[] = {
+		FIELD(AssInfo, "class", "info"),
+		FIELD(AssInfo, "section", line.GroupHeader()),
+		FIELD(AssInfo, "raw", line.GetEntryData()),
+		FIELD(AssInfo, "key", line.Key()),
+		FIELD(AssInfo, "value", line.Value()),
+	};
+
+	const LineField dialogue_fields[] = {
+		FIELD(AssDialogue, "class", "dialogue"),
+		FIELD(AssDialogue, "section", line.GroupHeader()),
+		FIELD(AssDialogue, "raw", line.GetEntryData()),
+		FIELD(AssDialogue, "comment", line.Comment),
+		FIELD(AssDialogue, "layer", line.Layer),
+		FIELD(AssDialogue, "start_time", (int)line.Start),
+		FIELD(AssDialogue, "end_time", (int)line.End),
+		FIELD(AssDialogue, "style", line.Style.get()),
+		FIELD(AssDialogue, "actor", line.Actor.get()),
+		FIELD(AssDialogue, "effect", line.Effect.get()),
+		FIELD(AssDialogue, "margin_l", line.Margin[0]),
+		FIELD(AssDialogue, "margin_r", line.Margin[1]),
+		FIELD(AssDialogue, "margin_t", line.Margin[2]),
+		FIELD(AssDialogue, "margin_b", line.Margin[2]),
+		FIELD(AssDialogue, "text", line.Text.get()),
+		{"extra", [](lua_State *L, AssEntry const& e, AssFile const& ass) {
 			lua_newtable(L);
-			for (auto const& ed : ass->GetExtradata(dia->ExtradataIds)) {
+			for (auto const& ed : ass.GetExtradata(static_cast<AssDialogue const&>(e).ExtradataIds)) {
 				push_value(L, ed.key);
 				push_value(L, ed.value);
 				lua_settable(L, -3);
 			}
-			lua_setfield(L, -2, "extra");
+		}, [](AssEntry const&, AssFile const&, FindCriterion const&) {
+			// Tables never equal the strings, numbers and booleans searched for
+			return false;
+		}},
+	};
+
+	const LineField style_fields[] = {
+		FIELD(AssStyle, "class", "style"),
+		FIELD(AssStyle, "section", line.GroupHeader()),
+		FIELD(AssStyle, "raw", line.GetEntryData()),
+		FIELD(AssStyle, "name", line.name),
+		FIELD(AssStyle, "fontname", line.font),
+		FIELD(AssStyle, "fontsize", line.fontsize),
+		FIELD(AssStyle, "color1", line.primary.GetAssStyleFormatted() + "&"),
+		FIELD(AssStyle, "color2", line.secondary.GetAssStyleFormatted() + "&"),
+		FIELD(AssStyle, "color3", line.outline.GetAssStyleFormatted() + "&"),
+		FIELD(AssStyle, "color4", line.shadow.GetAssStyleFormatted() + "&"),
+		FIELD(AssStyle, "bold", line.bold),
+		FIELD(AssStyle, "italic", line.italic),
+		FIELD(AssStyle, "underline", line.underline),
+		FIELD(AssStyle, "strikeout", line.strikeout),
+		FIELD(AssStyle, "scale_x", line.scalex),
+		FIELD(AssStyle, "scale_y", line.scaley),
+		FIELD(AssStyle, "spacing", line.spacing),
+		FIELD(AssStyle, "angle", line.angle),
+		FIELD(AssStyle, "borderstyle", line.borderstyle),
+		FIELD(AssStyle, "outline", line.outline_w),
+		FIELD(AssStyle, "shadow", line.shadow_w),
+		FIELD(AssStyle, "align", line.alignment),
+		FIELD(AssStyle, "margin_l", line.Margin[0]),
+		FIELD(AssStyle, "margin_r", line.Margin[1]),
+		FIELD(AssStyle, "margin_t", line.Margin[2]),
+		FIELD(AssStyle, "margin_b", line.Margin[2]),
+		FIELD(AssStyle, "encoding", line.encoding),
+		// From STS.h: "0: window, 1: video, 2: undefined (~window)"
+		FIELD(AssStyle, "relative_to", 2),
+	};
+
+	#undef FIELD
+
+	template<size_t N>
+	std::pair<const LineField *, size_t> fields(const LineField (&arr)[N]) {
+		return {arr, N};
+	}
 
-			set_field(L, "class", "dialogue");
+	std::pair<const LineField *, size_t> get_fields(AssEntry const& e) {
+		switch (e.Group()) {
+			case AssEntryGroup::DIALOGUE: return fields(dialogue_fields);
+			case AssEntryGroup::STYLE:    return fields(style_fields);
+			default:                      return fields(info_fields);
 		}
-		else if (auto sty = check_cast_constptr<AssStyle>(e)) {
-			set_field(L, "raw", sty->GetEntryData());
-			set_field(L, "name", sty->name);
-
-			set_field(L, "fontname", sty->font);
-			set_field(L, "fontsize", sty->fontsize);
-
-			set_field(L, "color1", sty->primary.GetAssStyleFormatted() + "&");
-			set_field(L, "color2", sty->secondary.GetAssStyleFormatted() + "&");
-			set_field(L, "color3", sty->outline.GetAssStyleFormatted() + "&");
-			set_field(L, "color4", sty->shadow.GetAssStyleFormatted() + "&");
-
-			set_field(L, "bold", sty->bold);
-			set_field(L, "italic", sty->italic);
-			set_field(L, "underline", sty->underline);
-			set_field(L, "strikeout", sty->strikeout);
-
-			set_field(L, "scale_x", sty->scalex);
-			set_field(L, "scale_y", sty->scaley);
-
-			set_field(L, "spacing", sty->spacing);
-
-			set_field(L, "angle", sty->angle);
+	}
 
-			set_field(L, "borderstyle", sty->borderstyle);
-			set_field(L, "outline", sty->outline_w);
-			set_field(L, "shadow", sty->shadow_w);
+	/// Get the index of the named field in the entry's field list, or -1
+	int find_field(AssEntry const& e, const char *name) {
+		auto fields = get_fields(e);
+		for (size_t i = 0; i < fields.second; ++i) {
+			if (strcmp(fields.first[i].name, name) == 0)
+				return i;
+		}
+		return -1;
+	}
+}
 
-			set_field(L, "align", sty->alignment);
+/// View of a dialogue line for the FFI. The strings are not nul-terminated
+/// and are only valid until the line is next modified.
+struct agi_dialogue {
+	int layer;
+	int start_time;
+	int end_time;
+	int margin_l;
+	int margin_r;
+	int margin_t;
+	bool comment;
+	const char *style;
+	size_t style_len;
+	const char *actor;
+	size_t actor_len;
+	const char *effect;
+	size_t effect_len;
+	const char *text;
+	size_t text_len;
+};
+
+/// Opaque handle for a LuaAssFile passed through the FFI
+struct agi_subs;
+
+namespace agi {
+	AGI_DEFINE_TYPE_NAME(agi_dialogue);
+	AGI_DEFINE_TYPE_NAME(agi_subs);
+}
 
-			set_field(L, "margin_l", sty->Margin[0]);
-			set_field(L, "margin_r", sty->Margin[1]);
-			set_field(L, "margin_t", sty->Margin[2]);
-			set_field(L, "margin_b", sty->Margin[2]);
+namespace Automation4 {
+	LuaAssFile::~LuaAssFile() { }
 
-			set_field(L, "encoding", sty->encoding);
+	void LuaAssFile::CheckAllowModify()
+	{
+		if (!can_modify)
+			error(L, "Attempt to modify subtitles in read-only feature context.");
+	}
 
-			set_field(L, "relative_to", 2);// From STS.h: "0: window, 1: video, 2: undefined (~window)"
+	void LuaAssFile::CheckBounds(int idx)
+	{
+		if (idx <= 0 || idx > (int)lines.size())
+			error(L, "Requested out-of-range line from subtitle file: %d", idx);
+	}
 
-			set_field(L, "class", "style");
-		}
-		else {
-			assert(false);
+	void LuaAssFile::AssEntryToLua(lua_State *L, size_t idx)
+	{
+		auto const& e = GetEntry(idx);
+		auto fields = get_fields(e);
+		lua_createtable(L, 0, fields.second);
+		for (size_t i = 0; i < fields.second; ++i) {
+			fields.first[i].push(L, e, *ass);
+			lua_setfield(L, -2, fields.first[i].name);
 		}
 	}
 
@@ -350,6 +509,12 @@ namespace Automation4 {
 					return 1;
 				}
 
+				if (strcmp(idx, "__handle") == 0) {
+					// handle for the FFI functions in aegisub.__lines_impl
+					lua_pushlightuserdata(L, this);
+					return 1;
+				}
+
 				lua_pushvalue(L, 1);
 				if (strcmp(idx, "delete") == 0)
 					lua_pushcclosure(L, closure_wrapper_v<&LuaAssFile::ObjectDelete, false>, 1);
@@ -361,6 +526,20 @@ namespace Automation4 {
 					lua_pushcclosure(L, closure_wrapper_v<&LuaAssFile::ObjectAppend, false>, 1);
 				else if (strcmp(idx, "script_resolution") == 0)
 					lua_pushcclosure(L, closure_wrapper<&LuaAssFile::LuaGetScriptResolution>, 1);
+				else if (strcmp(idx, "sort") == 0)
+					lua_pushcclosure(L, closure_wrapper_v<&LuaAssFile::ObjectSort, false>, 1);
+				else if (strcmp(idx, "column") == 0)
+					lua_pushcclosure(L, closure_wrapper<&LuaAssFile::LuaColumn>, 1);
+				else if (strcmp(idx, "get_range") == 0)
+					lua_pushcclosure(L, closure_wrapper<&LuaAssFile::LuaGetRange>, 1);
+				else if (strcmp(idx, "find") == 0)
+					lua_pushcclosure(L, closure_wrapper<&LuaAssFile::LuaFind>, 1);
+				else if (strcmp(idx, "lines_overlapping") == 0)
+					lua_pushcclosure(L, closure_wrapper<&LuaAssFile::LuaLinesOverlapping>, 1);
+				else if (strcmp(idx, "overlaps") == 0)
+					lua_pushcclosure(L, closure_wrapper<&LuaAssFile::LuaOverlaps>, 1);
+				else if (strcmp(idx, "apply_karaoke_templates") == 0)
+					lua_pushcclosure(L, closure_wrapper<&LuaAssFile::LuaApplyTemplates>, 1);
 				else {
 					// idiot
 					lua_pop(L, 1);
@@ -401,12 +580,52 @@ namespace Automation4 {
 			lines_to_delete.emplace_back(lines[idx]);
 	}
 
+	void LuaAssFile::LinesInserted(size_t idx, size_t count)
+	{
+		for (size_t i = idx; i < idx + count; ++i) {
+			++group_counts[(size_t)group_of(lines[i])];
+			if (groups_in_order && i > 0 && group_of(lines[i - 1]) > group_of(lines[i]))
+				groups_in_order = false;
+		}
+		size_t next = idx + count;
+		if (groups_in_order && next > 0 && next < lines.size() && group_of(lines[next - 1]) > group_of(lines[next]))
+			groups_in_order = false;
+	}
+
+	void LuaAssFile::LineRemoved(size_t idx)
+	{
+		--group_counts[(size_t)group_of(lines[idx])];
+	}
+
+	size_t LuaAssFile::AppendPosition(AssEntryGroup group) const
+	{
+		// No lines of this type exist already, so just append it to the end
+		if (!group_counts[(size_t)group])
+			return lines.size();
+
+		// Otherwise it goes after the last line of the same group
+		if (groups_in_order) {
+			size_t pos = 0;
+			for (size_t i = 0; i <= (size_t)group; ++i)
+				pos += group_counts[i];
+			return pos;
+		}
+
+		for (size_t i = lines.size(); i > 0; --i) {
+			if (group_of(lines[i - 1]) == group)
+				return i;
+		}
+		return lines.size();
+	}
+
 	void LuaAssFile::AssignLine(size_t idx, std::unique_ptr<AssEntry> e)
 	{
 		auto group = e->Group();
 		if (group == AssEntryGroup::INFO)
 			InitScriptInfoIfNeeded();
+		LineRemoved(idx);
 		lines[idx] = e.get();
+		LinesInserted(idx, 1);
 		if (group == AssEntryGroup::INFO)
 			lines_to_delete.emplace_back(std::move(e));
 		else
@@ -425,6 +644,19 @@ namespace Automation4 {
 			e.release();
 	}
 
+	void LuaAssFile::InsertLine(size_t idx, std::unique_ptr<AssEntry> e)
+	{
+		auto group = e->Group();
+		if (group == AssEntryGroup::INFO)
+			InitScriptInfoIfNeeded();
+		lines.insert(idx, e.get());
+		LinesInserted(idx, 1);
+		if (group == AssEntryGroup::INFO)
+			lines_to_delete.emplace_back(std::move(e));
+		else
+			e.release();
+	}
+
 	void LuaAssFile::ObjectIndexWrite(lua_State *L)
 	{
 		// instead of implementing everything twice, just call the other modification-functions from here
@@ -451,11 +683,21 @@ namespace Automation4 {
 			if (!lua_isnil(L, 3)) {
 				// insert
 				CheckBounds(n);
+				auto const& old_line = GetEntry(n - 1);
 
 				auto e = LuaToAssEntry(L, ass);
-				modification_type |= modification_mask(e.get());
+				int mask = modification_diff(old_line, *e);
+				if (!mask) return;
+
+				// The new line takes the old one's place, so it keeps its row
+				auto old_dia = check_cast_constptr<AssDialogue>(&old_line);
+				if (old_dia && e->Group() == AssEntryGroup::DIALOGUE)
+					static_cast<AssDialogue *>(e.get())->Row = old_dia->Row;
+
+				modification_type |= mask;
 				QueueLineForDeletion(n - 1);
 				AssignLine(n - 1, std::move(e));
+				time_index.reset();
 			}
 			else {
 				// delete
@@ -500,20 +742,19 @@ namespace Automation4 {
 		}
 
 		sort(ids.begin(), ids.end());
+		ids.erase(unique(ids.begin(), ids.end()), ids.end());
 
-		size_t id_idx = 0, out = 0;
-		for (size_t i = 0; i < lines.size(); ++i) {
-			if (id_idx < ids.size() && ids[id_idx] == i) {
-				modification_type |= modification_mask(lines[i]);
-				QueueLineForDeletion(i);
-				++id_idx;
-			}
-			else {
-				lines[out++] = lines[i];
-			}
+		// Erase from the back so that the remaining indices stay valid and
+		// the buffer's gap only moves over the lines between them
+		for (auto it = ids.rbegin(); it != ids.rend(); ++it) {
+			size_t i = *it;
+			modification_type |= modification_mask(lines[i]);
+			QueueLineForDeletion(i);
+			LineRemoved(i);
+			lines.erase(i);
 		}
 
-		lines.erase(lines.begin() + out, lines.end());
+		time_index.reset();
 	}
 
 	void LuaAssFile::ObjectDeleteRange(lua_State *L)
@@ -528,9 +769,11 @@ namespace Automation4 {
 		for (size_t i = a; i < b; ++i) {
 			modification_type |= modification_mask(lines[i]);
 			QueueLineForDeletion(i);
+			LineRemoved(i);
 		}
 
-		lines.erase(lines.begin() + a, lines.begin() + b);
+		lines.erase(a, b);
+		time_index.reset();
 	}
 
 	void LuaAssFile::ObjectAppend(lua_State *L)
@@ -538,29 +781,15 @@ namespace Automation4 {
 		CheckAllowModify();
 
 		int n = lua_gettop(L);
+		if (n > 0)
+			time_index.reset();
 
 		for (int i = 1; i <= n; i++) {
 			lua_pushvalue(L, i);
 			auto e = LuaToAssEntry(L, ass);
 			modification_type |= modification_mask(e.get());
-
-			if (lines.empty()) {
-				InsertLine(lines, 0, std::move(e));
-				continue;
-			}
-
-			// Find the appropriate place to put it
-			auto group = e->Group();
-			for (size_t i = lines.size(); i > 0; --i) {
-				auto cur_group = lines[i - 1] ? lines[i - 1]->Group() : AssEntryGroup::INFO;
-				if (cur_group == group) {
-					InsertLine(lines, i, std::move(e));
-					break;
-				}
-			}
-
-			// No lines of this type exist already, so just append it to the end
-			if (e) InsertLine(lines, lines.size(), std::move(e));
+			auto pos = AppendPosition(e->Group());
+			InsertLine(pos, std::move(e));
 		}
 	}
 
@@ -590,7 +819,73 @@ namespace Automation4 {
 			InsertLine(new_entries, i - 2, std::move(e));
 			lua_pop(L, 1);
 		}
-		lines.insert(lines.begin() + before - 1, new_entries.begin(), new_entries.end());
+		lines.insert(before - 1, new_entries.begin(), new_entries.end());
+		LinesInserted(before - 1, new_entries.size());
+		time_index.reset();
+	}
+
+	void LuaAssFile::ObjectSort(lua_State *L)
+	{
+		CheckAllowModify();
+
+		if (lua_isuserdata(L, 1))
+			lua_remove(L, 1);
+
+		// Keys are either a table of names or a comma-separated string
+		std::vector<std::string> names;
+		if (lua_istable(L, 1)) {
+			lua_pushvalue(L, 1);
+			lua_for_each(L, [&] {
+				names.push_back(check_string(L, -1));
+			});
+		}
+		else
+			boost::split(names, check_string(L, 1), [](char c) { return c == ','; });
+
+		AssFile::SortKeys keys;
+		for (auto const& name : names) {
+			auto comp = AssFile::GetSortKey(name);
+			if (!comp)
+				error(L, "Invalid sort key: '%s'", name.c_str());
+			keys.push_back(comp);
+		}
+
+		// Sort either every dialogue line or just the given ones, with the
+		// sorted lines being written back to the same positions
+		std::vector<size_t> positions;
+		if (lua_istable(L, 2)) {
+			lua_pushvalue(L, 2);
+			lua_for_each(L, [&] {
+				size_t n = check_uint(L, -1);
+				argcheck(L, n > 0 && n <= lines.size(), 2, "Out of range line index");
+				positions.push_back(n - 1);
+			});
+			std::sort(begin(positions), end(positions));
+			positions.erase(std::unique(begin(positions), end(positions)), end(positions));
+		}
+		else {
+			for (size_t i = 0; i < lines.size(); ++i)
+				positions.push_back(i);
+		}
+
+		std::vector<size_t> dialogue_positions;
+		std::vector<AssDialogue*> dialogue;
+		for (size_t i : positions) {
+			if (lines[i] && lines[i]->Group() == AssEntryGroup::DIALOGUE) {
+				dialogue_positions.push_back(i);
+				dialogue.push_back(static_cast<AssDialogue*>(lines[i]));
+			}
+		}
+
+		AssFile::Sort(dialogue, keys);
+
+		for (size_t i = 0; i < dialogue_positions.size(); ++i) {
+			if (lines[dialogue_positions[i]] != dialogue[i]) {
+				lines[dialogue_positions[i]] = dialogue[i];
+				modification_type |= AssFile::COMMIT_ORDER;
+				time_index.reset();
+			}
+		}
 	}
 
 	void LuaAssFile::ObjectGarbageCollect(lua_State *L)
@@ -624,9 +919,25 @@ namespace Automation4 {
 
 	int LuaAssFile::LuaParseKaraokeData(lua_State *L)
 	{
-		auto e = LuaToAssEntry(L, ass);
-		auto dia = check_cast_constptr<AssDialogue>(e.get());
-		argcheck(L, !!dia, 1, "Subtitle line must be a dialogue line");
+		// Only the text is needed, so rather than converting the whole line
+		// just check that it is a dialogue line
+		if (!lua_istable(L, -1))
+			error(L, "Can't convert a non-table value to AssEntry");
+		lua_getfield(L, -1, "class");
+		std::string lclass = lua_isstring(L, -1) ? lua_tostring(L, -1) : "";
+		lua_pop(L, 1);
+		argcheck(L, boost::iequals(lclass, "dialogue"), 1, "Subtitle line must be a dialogue line");
+		auto text = get_string_field(L, "text", "dialogue");
+
+		// Scripts generating many lines of their own could fill the cache
+		// with text which is never seen again, so start over when it's large
+		if (karaoke_cache.size() >= 10000)
+			karaoke_cache.clear();
+		auto& kara = karaoke_cache[text];
+		if (!kara) {
+			kara = agi::make_unique<AssKaraokeSyllables>();
+			kara->Parse(text);
+		}
 
 		int idx = 0;
 
@@ -642,15 +953,18 @@ namespace Automation4 {
 		set_field(L, "text_stripped", "");
 		lua_rawseti(L, -2, idx++);
 
-		AssKaraoke kara(dia, false, false);
-		for (auto const& syl : kara) {
+		auto push_span = [&](const char *name, AssKaraokeSyllables::Span span) {
+			lua_pushlstring(L, kara->data(span), span.length);
+			lua_setfield(L, -2, name);
+		};
+		for (auto const& syl : *kara) {
 			lua_createtable(L, 0, 6);
 			set_field(L, "duration", syl.duration);
-			set_field(L, "start_time", syl.start_time - dia->Start);
-			set_field(L, "end_time", syl.start_time + syl.duration - dia->Start);
-			set_field(L, "tag", syl.tag_type);
-			set_field(L, "text", syl.GetText(false));
-			set_field(L, "text_stripped", syl.text);
+			set_field(L, "start_time", syl.start_time);
+			set_field(L, "end_time", syl.start_time + syl.duration);
+			push_span("tag", syl.tag_type);
+			push_span("text", syl.text);
+			push_span("text_stripped", syl.stripped);
 			lua_rawseti(L, -2, idx++);
 		}
 
@@ -666,6 +980,164 @@ namespace Automation4 {
 		return 2;
 	}
 
+	AssEntry const& LuaAssFile::GetEntry(size_t idx) const
+	{
+		return lines[idx] ? *lines[idx] : ass->Info[idx];
+	}
+
+	void LuaAssFile::CheckRange(lua_State *L, int arg, size_t& first, size_t& last)
+	{
+		first = lua_isnoneornil(L, arg) ? 1 : check_uint(L, arg);
+		last = lua_isnoneornil(L, arg + 1) ? lines.size() : check_uint(L, arg + 1);
+		argcheck(L, first > 0 && first <= lines.size() + 1, arg, "Out of range line index");
+		argcheck(L, last <= lines.size(), arg + 1, "Out of range line index");
+	}
+
+	int LuaAssFile::LuaColumn(lua_State *L)
+	{
+		if (lua_isuserdata(L, 1))
+			lua_remove(L, 1);
+
+		const char *name = luaL_checkstring(L, 1);
+		size_t first, last;
+		CheckRange(L, 2, first, last);
+
+		// Lines without the field leave a nil at their position
+		lua_createtable(L, last >= first ? last - first + 1 : 0, 0);
+		for (size_t i = first; i <= last; ++i) {
+			auto const& e = GetEntry(i - 1);
+			int field = find_field(e, name);
+			if (field < 0) continue;
+			get_fields(e).first[field].push(L, e, *ass);
+			lua_rawseti(L, -2, i - first + 1);
+		}
+		return 1;
+	}
+
+	int LuaAssFile::LuaGetRange(lua_State *L)
+	{
+		if (lua_isuserdata(L, 1))
+			lua_remove(L, 1);
+
+		size_t first, last;
+		CheckRange(L, 1, first, last);
+
+		lua_createtable(L, last >= first ? last - first + 1 : 0, 0);
+		for (size_t i = first; i <= last; ++i) {
+			AssEntryToLua(L, i - 1);
+			lua_rawseti(L, -2, i - first + 1);
+		}
+		return 1;
+	}
+
+	int LuaAssFile::LuaFind(lua_State *L)
+	{
+		if (lua_isuserdata(L, 1))
+			lua_remove(L, 1);
+		luaL_checktype(L, 1, LUA_TTABLE);
+
+		std::vector<FindCriterion> criteria;
+		lua_pushvalue(L, 1);
+		lua_for_each(L, [&] {
+			if (lua_type(L, -2) != LUA_TSTRING)
+				error(L, "Search criteria must be keyed by field name");
+			FindCriterion c{lua_tostring(L, -2), lua_type(L, -1), "", 0, false};
+			switch (c.type) {
+				case LUA_TSTRING:  c.str = lua_tostring(L, -1); break;
+				case LUA_TNUMBER:  c.num = lua_tonumber(L, -1); break;
+				case LUA_TBOOLEAN: c.boolean = !!lua_toboolean(L, -1); break;
+				default: error(L, "Invalid search value for field '%s'", c.field.c_str());
+			}
+			criteria.push_back(std::move(c));
+		});
+
+		// The values are compared without pushing them to Lua. The index of
+		// each criterion's field is only looked up again when the kind of
+		// line changes.
+		std::vector<size_t> matches;
+		std::vector<int> field_indices;
+		const LineField *indexed_fields = nullptr;
+		for (size_t i = 0; i < lines.size(); ++i) {
+			auto const& e = GetEntry(i);
+			auto fields = get_fields(e);
+			if (fields.first != indexed_fields) {
+				field_indices.clear();
+				for (auto const& c : criteria)
+					field_indices.push_back(find_field(e, c.field.c_str()));
+				indexed_fields = fields.first;
+			}
+
+			bool match = true;
+			for (size_t j = 0; match && j < criteria.size(); ++j)
+				match = field_indices[j] >= 0 && fields.first[field_indices[j]].matches(e, *ass, criteria[j]);
+			if (match)
+				matches.push_back(i);
+		}
+
+		push_line_indices(L, matches);
+		return 1;
+	}
+
+	std::unique_ptr<EventTimeIndex> LuaAssFile::BuildTimeIndex(std::vector<size_t> const& ids) const
+	{
+		std::vector<EventTimeIndex::Interval> intervals;
+		intervals.reserve(ids.size());
+		for (size_t i : ids) {
+			auto dia = lines[i] ? check_cast_constptr<AssDialogue>(lines[i]) : nullptr;
+			if (dia && !dia->Comment)
+				intervals.push_back({(int)dia->Start, (int)dia->End, i});
+		}
+		return agi::make_unique<EventTimeIndex>(std::move(intervals));
+	}
+
+	EventTimeIndex const& LuaAssFile::GetTimeIndex()
+	{
+		if (!time_index) {
+			std::vector<size_t> ids(lines.size());
+			for (size_t i = 0; i < ids.size(); ++i)
+				ids[i] = i;
+			time_index = BuildTimeIndex(ids);
+		}
+		return *time_index;
+	}
+
+	int LuaAssFile::LuaLinesOverlapping(lua_State *L)
+	{
+		// Allow both subs.lines_overlapping(a, b) and subs:lines_overlapping(a, b)
+		if (lua_isuserdata(L, 1))
+			lua_remove(L, 1);
+
+		int start = check_int(L, 1);
+		int end = check_int(L, 2);
+		argcheck(L, start <= end, 2, "End time must not be before start time");
+
+		push_line_indices(L, GetTimeIndex().Overlapping(start, end));
+		return 1;
+	}
+
+	int LuaAssFile::LuaOverlaps(lua_State *L)
+	{
+		if (lua_isuserdata(L, 1))
+			lua_remove(L, 1);
+
+		if (lua_isnoneornil(L, 1)) {
+			push_line_indices(L, GetTimeIndex().Overlaps());
+			return 1;
+		}
+
+		luaL_checktype(L, 1, LUA_TTABLE);
+		std::vector<size_t> ids;
+		lua_pushvalue(L, 1);
+		lua_for_each(L, [&] {
+			size_t n = check_uint(L, -1);
+			argcheck(L, n > 0 && n <= lines.size(), 1, "Out of range line index");
+			ids.push_back(n - 1);
+		});
+
+		push_line_indices(L, BuildTimeIndex(ids)->Overlaps());
+		return 1;
+	}
+
 	void LuaAssFile::LuaSetUndoPoint(lua_State *L)
 	{
 		if (!can_set_undo)
@@ -677,11 +1149,145 @@ namespace Automation4 {
 
 			back.modification_type = modification_type;
 			back.mesage = check_string(L, 1);
-			back.lines = lines;
 			modification_type = 0;
 		}
 	}
 
+	AssDialogue *LuaAssFile::GetWritableDialogue(size_t idx, int modification)
+	{
+		if (idx >= lines.size() || !lines[idx] || lines[idx]->Group() != AssEntryGroup::DIALOGUE)
+			return nullptr;
+		if (!can_modify)
+			return nullptr;
+
+		if (!writable_lines.count(lines[idx])) {
+			// Copy the line rather than modifying the file's line in place so
+			// that cancelling leaves the file untouched
+			auto copy = agi::make_unique<AssDialogue>(static_cast<AssDialogueBase const&>(*static_cast<AssDialogue *>(lines[idx])));
+			QueueLineForDeletion(idx);
+			AssignLine(idx, std::move(copy));
+			writable_lines.insert(lines[idx]);
+		}
+
+		modification_type |= modification;
+		if (modification & (AssFile::COMMIT_DIAG_TIME | AssFile::COMMIT_DIAG_META))
+			time_index.reset();
+		return static_cast<AssDialogue *>(lines[idx]);
+	}
+
+	size_t LuaAssFile::FFICount(agi_subs *subs)
+	{
+		return reinterpret_cast<LuaAssFile *>(subs)->lines.size();
+	}
+
+	bool LuaAssFile::FFIGetDialogue(agi_subs *subs, size_t idx, agi_dialogue *out)
+	{
+		auto self = reinterpret_cast<LuaAssFile *>(subs);
+		if (idx >= self->lines.size() || !self->lines[idx] || self->lines[idx]->Group() != AssEntryGroup::DIALOGUE)
+			return false;
+
+		auto dia = static_cast<AssDialogue *>(self->lines[idx]);
+		out->layer = dia->Layer;
+		out->start_time = dia->Start;
+		out->end_time = dia->End;
+		out->margin_l = dia->Margin[0];
+		out->margin_r = dia->Margin[1];
+		out->margin_t = dia->Margin[2];
+		out->comment = dia->Comment;
+		out->style = dia->Style.get().data();
+		out->style_len = dia->Style.get().size();
+		out->actor = dia->Actor.get().data();
+		out->actor_len = dia->Actor.get().size();
+		out->effect = dia->Effect.get().data();
+		out->effect_len = dia->Effect.get().size();
+		out->text = dia->Text.get().data();
+		out->text_len = dia->Text.get().size();
+		return true;
+	}
+
+	bool LuaAssFile::FFISetTimes(agi_subs *subs, size_t idx, int start, int end)
+	{
+		auto dia = reinterpret_cast<LuaAssFile *>(subs)->GetWritableDialogue(idx, AssFile::COMMIT_DIAG_TIME);
+		if (!dia) return false;
+		dia->Start = start;
+		dia->End = end;
+		return true;
+	}
+
+	bool LuaAssFile::FFISetLayer(agi_subs *subs, size_t idx, int layer)
+	{
+		auto dia = reinterpret_cast<LuaAssFile *>(subs)->GetWritableDialogue(idx, AssFile::COMMIT_DIAG_META);
+		if (!dia) return false;
+		dia->Layer = layer;
+		return true;
+	}
+
+	bool LuaAssFile::FFISetMargins(agi_subs *subs, size_t idx, int l, int r, int t)
+	{
+		auto dia = reinterpret_cast<LuaAssFile *>(subs)->GetWritableDialogue(idx, AssFile::COMMIT_DIAG_META);
+		if (!dia) return false;
+		dia->Margin[0] = l;
+		dia->Margin[1] = r;
+		dia->Margin[2] = t;
+		return true;
+	}
+
+	bool LuaAssFile::FFISetComment(agi_subs *subs, size_t idx, bool comment)
+	{
+		auto dia = reinterpret_cast<LuaAssFile *>(subs)->GetWritableDialogue(idx, AssFile::COMMIT_DIAG_META);
+		if (!dia) return false;
+		dia->Comment = comment;
+		return true;
+	}
+
+	bool LuaAssFile::FFISetStyle(agi_subs *subs, size_t idx, const char *str, size_t len)
+	{
+		auto dia = reinterpret_cast<LuaAssFile *>(subs)->GetWritableDialogue(idx, AssFile::COMMIT_DIAG_META);
+		if (!dia) return false;
+		dia->Style = std::string(str, len);
+		return true;
+	}
+
+	bool LuaAssFile::FFISetActor(agi_subs *subs, size_t idx, const char *str, size_t len)
+	{
+		auto dia = reinterpret_cast<LuaAssFile *>(subs)->GetWritableDialogue(idx, AssFile::COMMIT_DIAG_META);
+		if (!dia) return false;
+		dia->Actor = std::string(str, len);
+		return true;
+	}
+
+	bool LuaAssFile::FFISetEffect(agi_subs *subs, size_t idx, const char *str, size_t len)
+	{
+		auto dia = reinterpret_cast<LuaAssFile *>(subs)->GetWritableDialogue(idx, AssFile::COMMIT_DIAG_META);
+		if (!dia) return false;
+		dia->Effect = std::string(str, len);
+		return true;
+	}
+
+	bool LuaAssFile::FFISetText(agi_subs *subs, size_t idx, const char *str, size_t len)
+	{
+		auto dia = reinterpret_cast<LuaAssFile *>(subs)->GetWritableDialogue(idx, AssFile::COMMIT_DIAG_TEXT);
+		if (!dia) return false;
+		dia->Text = std::string(str, len);
+		return true;
+	}
+
+	int LuaAssFile::LuaOpenLinesImpl(lua_State *L)
+	{
+		agi::lua::register_lib_table(L, {"agi_subs"},
+			"count", FFICount,
+			"get_dialogue", FFIGetDialogue,
+			"set_times", FFISetTimes,
+			"set_layer", FFISetLayer,
+			"set_margins", FFISetMargins,
+			"set_comment", FFISetComment,
+			"set_style", FFISetStyle,
+			"set_actor", FFISetActor,
+			"set_effect", FFISetEffect,
+			"set_text", FFISetText);
+		return 1;
+	}
+
 	LuaAssFile *LuaAssFile::GetObjPointer(lua_State *L, int idx, bool allow_expired)
 	{
 		assert(lua_type(L, idx) == LUA_TUSERDATA);
@@ -710,21 +1316,29 @@ namespace Automation4 {
 				}
 			}
 		};
-		// Apply any pending commits
+		// Undo points only record what changed, so fold them together with
+		// any changes made after the last one and apply the final state once
+		int commit_type = 0;
 		for (auto const& pc : pending_commits) {
-			apply_lines(pc.lines);
-			ass->Commit(/*pc.mesage, */pc.modification_type);
+			LOG_D("automation/lua") << "Undo point: " << pc.mesage;
+			commit_type |= pc.modification_type;
 		}
 
-		// Commit any changes after the last undo point was set
-		if (modification_type)
-			apply_lines(lines);
 		if (modification_type && can_set_undo && !undo_description.empty())
-			ass->Commit(/*undo_description, */modification_type);
+			commit_type |= modification_type;
+
+		// Deletions and insertions only ever touched the gap buffer, so this
+		// is the only time the full line array is rebuilt
+		auto ret = lines.to_vector();
+		lines.clear();
+
+		if (commit_type || modification_type)
+			apply_lines(ret);
+		if (commit_type)
+			ass->Commit(/*undo_description, */commit_type);
 
 		lines_to_delete.clear();
 
-		auto ret = std::move(lines);
 		references--;
 		if (!references) delete this;
 		return ret;
@@ -749,6 +1363,7 @@ namespace Automation4 {
 			lines.push_back(&line);
 		for (auto& line : ass->Events)
 			lines.push_back(&line);
+		LinesInserted(0, lines.size());
 
 		// prepare userdata object
 		*static_cast<LuaAssFile**>(lua_newuserdata(L, sizeof(LuaAssFile*))) = this;
@@ -0,0 +1,112 @@
+// Copyright (c) 2026, Aegisub CLI contributors
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+// Aegisub Project http://www.aegisub.org/
+
+/// @file auto4_lua_cache.cpp
+/// @brief Persistent cache for Lua scripts
+/// @ingroup scripting
+///
+/// aegisub.cache.put(key, value) stores any value which luabins can
+/// serialize (nil, booleans, numbers, strings and tables of them), and
+/// aegisub.cache.get(key) returns the value and true, or nil and false if
+/// there isn't one. Keys are strings, and are separate for each script.
+///
+/// The cache is shared by all scripts and all processes using the same
+/// ?local directory, so scripts which do expensive deterministic work per
+/// line can skip it for lines they've seen before, even in earlier runs.
+
+#include "auto4_lua.h"
+
+#include <libaegisub/log.h>
+#include <libaegisub/lua/utils.h>
+#include <libaegisub/make_unique.h>
+#include <libaegisub/persistent_cache.h>
+
+#include <mutex>
+
+using namespace agi::lua;
+
+namespace {
+std::mutex cache_mutex;
+agi::fs::path cache_filename;
+uint64_t cache_max_size = 0;
+std::unique_ptr<agi::PersistentCache> cache;
+bool cache_failed = false;
+
+/// Get the cache, opening it on first use
+/// @return nullptr if the cache is disabled or couldn't be opened
+agi::PersistentCache *get_cache() {
+	std::lock_guard<std::mutex> lock(cache_mutex);
+	if (!cache && !cache_failed && cache_max_size > 0) {
+		try {
+			cache = agi::make_unique<agi::PersistentCache>(cache_filename, cache_max_size);
+		}
+		catch (agi::Exception const& e) {
+			// Scripts work without the cache, just more slowly
+			LOG_E("automation/lua/cache") << "Could not open " << cache_filename << ": " << e.GetMessage();
+			cache_failed = true;
+		}
+	}
+	return cache.get();
+}
+
+/// Prefix the key with the full path of the script so that scripts don't see
+/// each other's values, even if they have the same filename
+std::string cache_key(lua_State *L) {
+	auto key = check_string(L, 1);
+	lua_getfield(L, LUA_REGISTRYINDEX, "script_path");
+	auto script = get_string_or_default(L, -1);
+	lua_pop(L, 1);
+	return script + '\0' + key;
+}
+}
+
+namespace Automation4 {
+	void SetLuaCache(agi::fs::path const& filename, uint64_t max_size) {
+		std::lock_guard<std::mutex> lock(cache_mutex);
+		cache.reset();
+		cache_failed = false;
+		cache_filename = filename;
+		cache_max_size = max_size;
+	}
+
+	int LuaCacheGet(lua_State *L) {
+		auto key = cache_key(L);
+		std::string value;
+		auto cache = get_cache();
+		if (!cache || !cache->Get(key, value)) {
+			lua_pushnil(L);
+			push_value(L, false);
+			return 2;
+		}
+
+		int loaded = 0;
+		if (luabins_load(L, reinterpret_cast<const unsigned char *>(value.data()), value.size(), &loaded))
+			return error(L, "cache.get: could not deserialize value: %s", get_string_or_default(L, -1).c_str());
+		push_value(L, true);
+		return 2;
+	}
+
+	int LuaCachePut(lua_State *L) {
+		auto key = cache_key(L);
+		lua_settop(L, 2);
+		if (luabins_save(L, 2, 2))
+			return error(L, "cache.put: could not serialize value: %s", get_string_or_default(L, -1).c_str());
+
+		if (auto cache = get_cache())
+			cache->Put(key, get_string(L, -1));
+		return 0;
+	}
+}
@@ -34,10 +34,28 @@
 
 #include "auto4_base.h"
 
+#include <cstdint>
+#include <string>
+#include <vector>
+
 namespace Automation4 {
+	/// LuaJIT settings applied to the Lua states of each script
+	struct LuaJitSettings {
+		/// Is the JIT compiler enabled at all?
+		bool enabled = true;
+		/// Optimization parameters as passed to jit.opt.start, e.g. "hotloop=56"
+		std::vector<std::string> options;
+		/// Collect trace aborts and report them when the script is unloaded
+		bool report = false;
+	};
+
 	class LuaScriptFactory final : public ScriptFactory {
+		LuaJitSettings jit;
+
 		std::unique_ptr<Script> Produce(agi::fs::path const& filename) const override;
 	public:
-		LuaScriptFactory();
+		/// @param cache_size Maximum size of the aegisub.cache file in bytes,
+		///                   or 0 to disable it
+		LuaScriptFactory(LuaJitSettings jit = LuaJitSettings(), uint64_t cache_size = 0);
 	};
 }
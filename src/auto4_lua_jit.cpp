@@ -0,0 +1,206 @@
+// Copyright (c) 2026, Aegisub CLI contributors
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+// Aegisub Project http://www.aegisub.org/
+
+/// @file auto4_lua_jit.cpp
+/// @brief LuaJIT tuning and trace diagnostics for Lua scripts
+/// @ingroup scripting
+
+#include "auto4_lua.h"
+
+#include "auto4_lua_factory.h"
+
+#include <libaegisub/format.h>
+#include <libaegisub/log.h>
+#include <libaegisub/lua/utils.h>
+
+#include <algorithm>
+#include <boost/algorithm/string/replace.hpp>
+
+using namespace agi::lua;
+
+namespace {
+/// Trace compiler error messages, in the order of LuaJIT 2.0's
+/// lj_traceerr.h. jit.vmdef has these, but it's generated when building
+/// LuaJIT and isn't available to scripts.
+const char *trace_errors[] = {
+	"error thrown or hook called during recording",
+	"trace too long",
+	"trace too deep",
+	"too many snapshots",
+	"blacklisted",
+	"NYI: bytecode %d",
+	"leaving loop in root trace",
+	"inner loop in root trace",
+	"loop unroll limit reached",
+	"bad argument type",
+	"JIT compilation disabled for function",
+	"call unroll limit reached",
+	"down-recursion, restarting",
+	"NYI: C function %s",
+	"NYI: FastFunc %s",
+	"NYI: unsupported variant of FastFunc %s",
+	"NYI: return to lower frame",
+	"store with nil or NaN key",
+	"missing metamethod",
+	"looping index lookup",
+	"NYI: mixed sparse/dense table",
+	"symbol not in cache",
+	"NYI: unsupported C type conversion",
+	"NYI: unsupported C function type",
+	"guard would always fail",
+	"too many PHIs",
+	"persistent type instability",
+	"failed to allocate mcode memory",
+	"machine code too long",
+	"hit mcode limit (retrying)",
+	"too many spill slots",
+	"inconsistent register allocation",
+	"NYI: cannot assemble IR instruction %d",
+	"NYI: PHI shuffling too complex",
+	"NYI: register coalescing too complex",
+};
+
+/// Push the jit.opt, jit.util or similar module
+void push_jit_module(lua_State *L, const char *name) {
+	lua_getfield(L, LUA_REGISTRYINDEX, "_LOADED");
+	lua_getfield(L, -1, name);
+	lua_remove(L, -2);
+}
+
+/// Describe the function at func_idx, at the bytecode position at pc_idx if
+/// it's a Lua function, using jit.util.funcinfo at upvalue 2
+std::string function_location(lua_State *L, int func_idx, int pc_idx) {
+	if (!lua_isfunction(L, func_idx)) return "?";
+
+	lua_pushvalue(L, lua_upvalueindex(2));
+	lua_pushvalue(L, func_idx);
+	if (pc_idx)
+		lua_pushvalue(L, pc_idx);
+	else
+		lua_pushnil(L);
+	lua_call(L, 2, 1);
+
+	std::string ret = "?";
+	lua_getfield(L, -1, "loc");
+	if (lua_isstring(L, -1))
+		ret = get_string(L, -1);
+	else {
+		lua_getfield(L, -2, "ffid");
+		if (lua_isnumber(L, -1))
+			ret = agi::format("builtin#%d", (int)lua_tointeger(L, -1));
+		lua_pop(L, 1);
+	}
+	lua_pop(L, 2);
+	return ret;
+}
+
+/// Format the abort reason from the error code and info arguments of an
+/// abort event
+std::string abort_reason(lua_State *L, int code_idx, int info_idx) {
+	if (!lua_isnumber(L, code_idx))
+		return get_string_or_default(L, code_idx);
+
+	auto code = static_cast<size_t>(lua_tointeger(L, code_idx));
+	if (code >= sizeof(trace_errors) / sizeof(trace_errors[0]))
+		return agi::format("trace error %d", (int)code);
+
+	std::string reason = trace_errors[code];
+	std::string info;
+	if (lua_isfunction(L, info_idx))
+		info = function_location(L, info_idx, 0);
+	else if (lua_isnumber(L, info_idx))
+		info = std::to_string(lua_tointeger(L, info_idx));
+	else
+		info = get_string_or_default(L, info_idx);
+	boost::replace_first(reason, "%d", info);
+	boost::replace_first(reason, "%s", info);
+	return reason;
+}
+}
+
+namespace Automation4 {
+	bool ConfigureJit(lua_State *L, LuaJitSettings const& settings) {
+		if (!settings.options.empty()) {
+			push_jit_module(L, "jit.opt");
+			lua_getfield(L, -1, "start");
+			lua_remove(L, -2);
+			for (auto const& opt : settings.options)
+				push_value(L, opt);
+			if (lua_pcall(L, settings.options.size(), 0, 0))
+				return false;
+		}
+
+		if (!settings.enabled) {
+			lua_getglobal(L, "jit");
+			lua_getfield(L, -1, "off");
+			lua_remove(L, -2);
+			if (lua_pcall(L, 0, 0, 0))
+				return false;
+		}
+
+		return true;
+	}
+
+	int JitTraceReport::OnTrace(lua_State *L) {
+		auto report = static_cast<JitTraceReport *>(lua_touserdata(L, lua_upvalueindex(1)));
+		// Arguments are what, trace number, function, pc, and for aborts the
+		// error code and info
+		std::string what = get_string_or_default(L, 1);
+
+		if (what == "start") {
+			std::lock_guard<std::mutex> lock(report->mutex);
+			++report->started;
+		}
+		else if (what == "stop") {
+			std::lock_guard<std::mutex> lock(report->mutex);
+			++report->stopped;
+		}
+		else if (what == "abort") {
+			auto key = function_location(L, 3, 4) + ": " + abort_reason(L, 5, 6);
+			std::lock_guard<std::mutex> lock(report->mutex);
+			++report->aborted;
+			++report->aborts[key];
+		}
+		return 0;
+	}
+
+	void JitTraceReport::Attach(lua_State *L) {
+		lua_getglobal(L, "jit");
+		lua_getfield(L, -1, "attach");
+		lua_pushlightuserdata(L, this);
+		push_jit_module(L, "jit.util");
+		lua_getfield(L, -1, "funcinfo");
+		lua_remove(L, -2);
+		lua_pushcclosure(L, OnTrace, 2);
+		push_value(L, "trace");
+		lua_call(L, 2, 0);
+		lua_pop(L, 1);
+	}
+
+	void JitTraceReport::Log(std::string const& script_name) {
+		std::lock_guard<std::mutex> lock(mutex);
+		LOG_I("automation/lua/jit") << script_name << ": " << started << " traces started, "
+			<< stopped << " completed, " << aborted << " aborted";
+
+		// Most frequent aborts first, as those are the ones worth fixing
+		std::vector<std::pair<std::string, size_t>> sorted(aborts.begin(), aborts.end());
+		std::stable_sort(sorted.begin(), sorted.end(), [](std::pair<std::string, size_t> const& a, std::pair<std::string, size_t> const& b) {
+			return a.second > b.second;
+		});
+		for (auto const& abort : sorted)
+			LOG_I("automation/lua/jit") << agi::format("%6d abort%s at %s", abort.second, abort.second == 1 ? " " : "s", abort.first);
+	}
+}
@@ -0,0 +1,326 @@
+// Copyright (c) 2026, Aegisub CLI contributors
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+// Aegisub Project http://www.aegisub.org/
+
+/// @file auto4_lua_tags.cpp
+/// @brief Override tag parsing functions for Lua scripts
+/// @ingroup scripting
+///
+/// parse_tags returns the blocks of a line's text as tables:
+///
+///     {class="plain", text="..."}
+///     {class="drawing", text="...", scale=1}
+///     {class="comment", text="..."}
+///     {class="override", text="...", tags={{name="\\pos", valid=true, params={10, 20}}, ...}}
+///
+/// The text of comment and override blocks does not include the braces.
+/// params holds only the parameters present in the tag, typed according to
+/// the tag's prototype, with the style modifiers of \t as a nested list of
+/// tags. build_text accepts the same structure (or plain strings) and
+/// prefers an override block's tags over its text when both are present.
+
+#include "auto4_lua.h"
+
+#include "ass_dialogue.h"
+#include "utils.h"
+
+#include <libaegisub/lua/utils.h>
+
+#include <algorithm>
+
+using namespace agi::lua;
+
+namespace {
+/// Blocks of the text being worked on, kept between calls so that their
+/// storage is reused
+thread_local AssBlockList blocks;
+
+/// Tag names may be given with or without the leading backslash
+std::string normalize_name(std::string name) {
+	if (name.empty() || name[0] != '\\')
+		name.insert(name.begin(), '\\');
+	return name;
+}
+
+template<typename Tags>
+void push_tags(lua_State *L, Tags const& tags);
+
+void push_param(lua_State *L, AssOverrideParameter const& param) {
+	switch (param.GetType()) {
+		case VariableDataType::INT:
+			push_value(L, param.Get<int>());
+			break;
+		case VariableDataType::FLOAT:
+			push_value(L, param.Get<double>());
+			break;
+		case VariableDataType::BOOL:
+			push_value(L, param.Get<bool>());
+			break;
+		case VariableDataType::BLOCK:
+			push_tags(L, param.Get<AssDialogueBlockOverride*>()->Tags);
+			break;
+		default:
+			push_value(L, param.Get<std::string>());
+			break;
+	}
+}
+
+template<typename Tags>
+void push_tags(lua_State *L, Tags const& tags) {
+	lua_createtable(L, tags.size(), 0);
+	for (size_t i = 0; i < tags.size(); ++i) {
+		auto const& tag = tags[i];
+		lua_createtable(L, 0, 3);
+		set_field(L, "name", tag.Name);
+		set_field(L, "valid", tag.IsValid());
+
+		lua_createtable(L, tag.Params.size(), 0);
+		int n = 0;
+		for (auto const& param : tag.Params) {
+			if (param.omitted) continue;
+			push_param(L, param);
+			lua_rawseti(L, -2, ++n);
+		}
+		lua_setfield(L, -2, "params");
+
+		lua_rawseti(L, -2, i + 1);
+	}
+}
+
+std::string tags_string(lua_State *L, int idx);
+
+std::string param_string(lua_State *L, int idx) {
+	switch (lua_type(L, idx)) {
+		case LUA_TNUMBER:
+			return float_to_string(lua_tonumber(L, idx));
+		case LUA_TBOOLEAN:
+			return lua_toboolean(L, idx) ? "1" : "0";
+		case LUA_TSTRING:
+			return get_string(L, idx);
+		case LUA_TTABLE:
+			return tags_string(L, idx);
+		default:
+			error(L, "Invalid tag parameter of type %s", luaL_typename(L, idx));
+	}
+}
+
+/// Build the text of a tag from its name and the parameters at
+/// [first, first + count)
+std::string tag_string(lua_State *L, std::string const& name, int first, int count) {
+	std::string ret = name;
+	// Single-parameter tags don't use parentheses, except for the tags
+	// whose other parameters are optional
+	bool parentheses = count > 1 || name == "\\t" || name == "\\clip" || name == "\\iclip";
+	if (parentheses) ret += '(';
+	for (int i = 0; i < count; ++i) {
+		if (i > 0) ret += ',';
+		ret += param_string(L, first + i);
+	}
+	if (parentheses) ret += ')';
+	return ret;
+}
+
+/// Build the text of a tag table at idx
+std::string tag_string(lua_State *L, int idx) {
+	if (!lua_istable(L, idx))
+		error(L, "Tag must be a table, got %s", luaL_typename(L, idx));
+
+	lua_getfield(L, idx, "name");
+	if (!lua_isstring(L, -1))
+		error(L, "Tag name must be a string");
+	auto name = get_string(L, -1);
+	lua_pop(L, 1);
+
+	lua_getfield(L, idx, "params");
+	int params = lua_gettop(L);
+	int count = 0;
+	if (lua_istable(L, params)) {
+		count = lua_objlen(L, params);
+		luaL_checkstack(L, count, "too many tag parameters");
+		for (int i = 1; i <= count; ++i)
+			lua_rawgeti(L, params, i);
+	}
+	auto ret = tag_string(L, name, params + 1, count);
+	lua_settop(L, params - 1);
+	return ret;
+}
+
+/// Concatenate the text of the array of tag tables at idx
+std::string tags_string(lua_State *L, int idx) {
+	std::string ret;
+	size_t n = lua_objlen(L, idx);
+	for (size_t i = 1; i <= n; ++i) {
+		lua_rawgeti(L, idx, i);
+		ret += tag_string(L, lua_gettop(L));
+		lua_pop(L, 1);
+	}
+	return ret;
+}
+
+/// Build the text of a block table at idx
+std::string block_string(lua_State *L, int idx) {
+	if (lua_type(L, idx) == LUA_TSTRING)
+		return get_string(L, idx);
+	if (!lua_istable(L, idx))
+		error(L, "Block must be a table or string, got %s", luaL_typename(L, idx));
+
+	lua_getfield(L, idx, "class");
+	auto cls = get_string(L, -1);
+	lua_getfield(L, idx, "tags");
+	lua_getfield(L, idx, "text");
+	auto text = get_string(L, -1);
+
+	std::string ret;
+	if (cls == "override")
+		ret = "{" + (lua_istable(L, -2) ? tags_string(L, lua_gettop(L) - 1) : text) + "}";
+	else if (cls == "comment")
+		ret = "{" + text + "}";
+	else
+		ret = text;
+	lua_pop(L, 3);
+	return ret;
+}
+}
+
+namespace Automation4 {
+	int LuaParseTags(lua_State *L) {
+		auto text = check_string(L, 1);
+		blocks.Parse(text);
+
+		lua_createtable(L, blocks.size(), 0);
+		for (size_t i = 0; i < blocks.size(); ++i) {
+			lua_createtable(L, 0, 3);
+			switch (blocks[i].type) {
+				case AssBlockType::PLAIN:
+					set_field(L, "class", "plain");
+					set_field(L, "text", blocks.Text(i));
+					break;
+				case AssBlockType::DRAWING:
+					set_field(L, "class", "drawing");
+					set_field(L, "text", blocks.Text(i));
+					set_field(L, "scale", blocks[i].scale);
+					break;
+				case AssBlockType::COMMENT:
+					set_field(L, "class", "comment");
+					set_field(L, "text", blocks.Contents(i));
+					break;
+				case AssBlockType::OVERRIDE:
+					set_field(L, "class", "override");
+					set_field(L, "text", blocks.Contents(i));
+					push_tags(L, blocks.Tags(i));
+					lua_setfield(L, -2, "tags");
+					break;
+			}
+			lua_rawseti(L, -2, i + 1);
+		}
+		return 1;
+	}
+
+	int LuaBuildText(lua_State *L) {
+		luaL_checktype(L, 1, LUA_TTABLE);
+		std::string ret;
+		size_t n = lua_objlen(L, 1);
+		for (size_t i = 1; i <= n; ++i) {
+			lua_rawgeti(L, 1, i);
+			ret += block_string(L, lua_gettop(L));
+			lua_pop(L, 1);
+		}
+		push_value(L, ret);
+		return 1;
+	}
+
+	int LuaSetTag(lua_State *L) {
+		auto text = check_string(L, 1);
+		auto name = normalize_name(check_string(L, 2));
+		auto tag = tag_string(L, name, 3, lua_gettop(L) - 2);
+
+		blocks.Parse(text);
+
+		// Set the tag in the override block at the start of the line,
+		// adding one if there isn't one
+		if (blocks[0].type != AssBlockType::OVERRIDE) {
+			push_value(L, "{" + tag + "}" + text);
+			return 1;
+		}
+
+		// Replace the first instance of the tag and remove any later ones,
+		// which would override the new value
+		std::string ret = "{";
+		bool found = false;
+		for (auto const& t : blocks.Tags(0)) {
+			if (t.Name != name)
+				ret += t;
+			else if (!found) {
+				ret += AssOverrideTag(tag);
+				found = true;
+			}
+		}
+		if (!found)
+			ret += AssOverrideTag(tag);
+		ret += '}';
+
+		ret.append(text, blocks[0].length, std::string::npos);
+		push_value(L, ret);
+		return 1;
+	}
+
+	int LuaStripTags(lua_State *L) {
+		auto text = check_string(L, 1);
+
+		// No names given, so strip everything but the plain text
+		if (lua_isnoneornil(L, 2)) {
+			push_value(L, AssDialogue::GetStrippedText(text));
+			return 1;
+		}
+
+		luaL_checktype(L, 2, LUA_TTABLE);
+		std::vector<std::string> names;
+		size_t n = lua_objlen(L, 2);
+		for (size_t i = 1; i <= n; ++i) {
+			lua_rawgeti(L, 2, i);
+			if (!lua_isstring(L, -1))
+				error(L, "Tag names must be strings");
+			names.push_back(normalize_name(get_string(L, -1)));
+			lua_pop(L, 1);
+		}
+
+		auto is_stripped = [&](AssOverrideTag const& tag) {
+			return std::find(names.begin(), names.end(), tag.Name) != names.end();
+		};
+
+		std::string ret;
+		ret.reserve(text.size());
+		blocks.Parse(text);
+		for (size_t i = 0; i < blocks.size(); ++i) {
+			auto tags = blocks.Tags(i);
+			if (blocks[i].type != AssBlockType::OVERRIDE || std::none_of(tags.begin(), tags.end(), is_stripped)) {
+				ret.append(text, blocks[i].offset, blocks[i].length);
+				continue;
+			}
+
+			// Blocks left empty are dropped entirely
+			std::string kept;
+			for (auto const& tag : tags) {
+				if (!is_stripped(tag))
+					kept += tag;
+			}
+			if (!kept.empty())
+				ret += "{" + kept + "}";
+		}
+
+		push_value(L, ret);
+		return 1;
+	}
+}
@@ -0,0 +1,1485 @@
+// Copyright (c) 2026, Aegisub CLI contributors
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+// Aegisub Project http://www.aegisub.org/
+
+/// @file auto4_lua_templater.cpp
+/// @brief Native implementation of kara-templater's template application
+/// @ingroup scripting
+///
+/// subs.apply_karaoke_templates(meta, styles, tenv) does what kara-templater's
+/// parse_templates and apply_templates did in Lua: it deletes the previously
+/// generated fx lines, parses the code and template lines, and runs them over
+/// every karaoke line, appending the generated lines to the file.
+///
+/// Each template's text is split into literal text and $variables once, and
+/// the variables are filled in from a native copy of the line and syllable
+/// layout, so templates which are only made of text and variables never enter
+/// Lua. !expressions! and code lines still run in tenv, compiled once per
+/// distinct source text, and the line, syl, basesyl, j and maxj fields of
+/// tenv are filled in just before they run. The line and syllable tables
+/// which scripts expect are only copied when some Lua code will see them.
+///
+/// Lines are still laid out by karaskel.preproc_line so that scripts
+/// changing karaskel get the same results as before. Lua code can change the
+/// generated line and the original line through tenv.line and tenv.orgline,
+/// and the j and maxj loop counters, but changes it makes to other fields of
+/// the syllable and line tables aren't seen by the $variables.
+
+#include "auto4_lua.h"
+
+#include "ass_dialogue.h"
+#include "ass_file.h"
+#include "ass_style.h"
+#include "auto4_base.h"
+#include "event_time_index.h"
+
+#include <libaegisub/lua/utils.h>
+#include <libaegisub/make_unique.h>
+
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <map>
+
+using namespace agi::lua;
+
+namespace {
+/// The variables which can be used as $name in templates
+enum Var {
+	V_LAYER, V_LSTART, V_LEND, V_LDUR, V_LMID, V_STYLE, V_ACTOR,
+	V_MARGIN_L, V_MARGIN_R, V_MARGIN_T, V_MARGIN_B, V_MARGIN_V,
+	V_SYLN, V_LI, V_LLEFT, V_LCENTER, V_LRIGHT, V_LWIDTH,
+	V_LTOP, V_LMIDDLE, V_LBOTTOM, V_LHEIGHT, V_LX, V_LY,
+	V_START, V_END, V_DUR, V_KDUR, V_MID, V_I, V_LEFT, V_CENTER, V_RIGHT,
+	V_WIDTH, V_TOP, V_MIDDLE, V_BOTTOM, V_HEIGHT, V_X, V_Y,
+	V_SSTART, V_SEND, V_SDUR, V_SKDUR, V_SMID, V_SI,
+	V_SLEFT, V_SCENTER, V_SRIGHT, V_SWIDTH,
+	V_STOP, V_SMIDDLE, V_SBOTTOM, V_SHEIGHT, V_SX, V_SY,
+	V_COUNT
+};
+
+const char *var_names[V_COUNT] = {
+	"layer", "lstart", "lend", "ldur", "lmid", "style", "actor",
+	"margin_l", "margin_r", "margin_t", "margin_b", "margin_v",
+	"syln", "li", "lleft", "lcenter", "lright", "lwidth",
+	"ltop", "lmiddle", "lbottom", "lheight", "lx", "ly",
+	"start", "end", "dur", "kdur", "mid", "i", "left", "center", "right",
+	"width", "top", "middle", "bottom", "height", "x", "y",
+	"sstart", "send", "sdur", "skdur", "smid", "si",
+	"sleft", "scenter", "sright", "swidth",
+	"stop", "smiddle", "sbottom", "sheight", "sx", "sy",
+};
+
+/// A value in the variable context, which is unset until the point where
+/// kara-templater would have assigned it
+struct Value {
+	enum { UNSET, NUMBER, STRING } type = UNSET;
+	double number = 0;
+	std::string string;
+
+	void operator=(double value) {
+		type = NUMBER;
+		number = value;
+	}
+};
+
+/// Append a number as Lua's tostring would format it
+void append_number(std::string& out, double value) {
+	if (value == std::floor(value) && std::abs(value) < 1e14 && !(value == 0 && std::signbit(value))) {
+		out += std::to_string(static_cast<long long>(value));
+		return;
+	}
+	char buf[64];
+	int len = snprintf(buf, sizeof buf, "%.14g", value);
+	if (len > 0 && len < static_cast<int>(sizeof buf))
+		out.append(buf, len);
+}
+
+bool is_lua_space(char c) {
+	return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+/// string.headtail: split off the first space-separated word
+void headtail(std::string const& str, std::string& head, std::string& tail) {
+	auto space = std::find_if(str.begin(), str.end(), is_lua_space);
+	if (space == str.end()) {
+		head = str;
+		tail.clear();
+		return;
+	}
+	auto rest = std::find_if_not(space, str.end(), is_lua_space);
+	head.assign(str.begin(), space);
+	tail.assign(rest, str.end());
+}
+
+std::string lower(std::string str) {
+	for (auto& c : str)
+		c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+	return str;
+}
+
+/// Template text split into literal text and variables
+struct TextTemplate {
+	struct Segment {
+		std::string text;
+		/// Index of the variable, or -1 for literal text. Unknown variable
+		/// names have V_COUNT, with the lowercased name in text.
+		int var;
+	};
+
+	std::string source;
+	std::vector<Segment> segments;
+
+	void Parse(std::string text) {
+		source = std::move(text);
+		segments.clear();
+
+		size_t literal = 0;
+		for (size_t i = 0; i < source.size(); ++i) {
+			if (source[i] != '$') continue;
+			size_t end = i + 1;
+			while (end < source.size() && (isalpha(static_cast<unsigned char>(source[end])) || source[end] == '_'))
+				++end;
+			if (end == i + 1) continue;
+
+			if (i > literal)
+				segments.push_back(Segment{source.substr(literal, i - literal), -1});
+			auto name = lower(source.substr(i + 1, end - i - 1));
+			auto it = std::find_if(std::begin(var_names), std::end(var_names),
+				[&](const char *var) { return name == var; });
+			segments.push_back(Segment{name, static_cast<int>(it - std::begin(var_names))});
+			literal = end;
+			i = end - 1;
+		}
+		if (literal < source.size())
+			segments.push_back(Segment{source.substr(literal), -1});
+	}
+
+	bool empty() const { return source.empty(); }
+};
+
+/// A code or template line, or for line templates with an identifier, all of
+/// the lines which share it
+struct Template {
+	bool is_code = false;
+	std::string code;
+	/// Identifier of a named line template, shared by all of its lines
+	std::string id;
+	/// Index of the compiled code in the code cache table
+	int code_index = 0;
+
+	std::string t_source, pre_source;
+	TextTemplate t, pre;
+
+	/// Does the template apply to lines of all styles, rather than just style?
+	bool all_styles = false;
+	std::string style;
+	double loops = 1;
+	int layer = 0;
+	bool addtext = true;
+	bool keeptags = false;
+	bool has_fx = false;
+	std::string fx;
+	bool has_fxgroup = false;
+	std::string fxgroup;
+	bool multi = false;
+	bool isline = false;
+	bool perchar = false;
+	bool noblank = false;
+};
+
+/// The layout of a syllable or furigana as set up by karaskel, along with
+/// the fields changed in per-character and multi-highlight copies
+struct Syllable {
+	double start_time, end_time, duration, i;
+	double left, center, right, width, height;
+	double prespacewidth, postspacewidth;
+	bool isfuri;
+	std::string text, text_stripped, text_spacestripped, prespace, postspace;
+	std::string inline_fx;
+	bool has_style;
+	std::string style_name;
+};
+
+/// A syllable whose Lua table, if one is needed, is either an element of
+/// line.kara or line.furi, or a copy of its parent's table with some fields
+/// changed
+struct SylState {
+	Syllable data;
+	SylState *parent = nullptr;
+	/// Index in line.kara or line.furi, for syllables without a parent
+	int index = 0;
+	bool furi = false;
+	/// Index of the table in the per-line temporary table, once it's made
+	int temp = 0;
+	/// Fields which need to be written to the table before Lua next sees it
+	enum { CHAR_FIELDS = 1, HIGHLIGHT_FIELDS = 2 };
+	int dirty = 0;
+
+	SylState const& Root() const { return parent ? parent->Root() : *this; }
+};
+
+/// A generated line whose table is only copied from the original line if Lua
+/// code needs to see it
+struct NewLine {
+	int layer;
+	/// The syllable whose style the line takes, or nullptr for line templates
+	SylState *style_from;
+	/// Index of the table in the per-line temporary table, once it's made
+	int temp = 0;
+
+	NewLine(int layer, SylState *style_from) : layer(layer), style_from(style_from) { }
+};
+
+/// Is the syllable empty or only spaces, as kara-templater's is_syl_blank?
+bool is_blank(Syllable const& syl) {
+	if (syl.duration <= 0) return true;
+
+	std::string text;
+	for (char c : syl.text_stripped) {
+		if (c != ' ' && c != '\t' && c != '\n' && c != '\r')
+			text += c;
+	}
+	// Fullwidth spaces
+	static const char fullwidth_space[] = "\xE3\x80\x80";
+	for (size_t pos = 0; pos < text.size(); pos += 3) {
+		if (text.compare(pos, 3, fullwidth_space) != 0)
+			return false;
+	}
+	return true;
+}
+
+/// Number of bytes in the UTF-8 character starting with the byte, as
+/// unicode.chars counts them
+size_t char_width(unsigned char c) {
+	if (c < 128) return 1;
+	if (c < 224) return 2;
+	if (c < 240) return 3;
+	return 4;
+}
+
+/// Modifiers which can't be used as the identifier of a line template
+const char *template_modifiers[] = {
+	"pre-line", "line", "syl", "furi", "char", "all", "repeat", "loop",
+	"notext", "keeptags", "noblank", "multi", "fx", "fxgroup"
+};
+}
+
+namespace Automation4 {
+	class KaraokeTemplater {
+		LuaAssFile *subs;
+		lua_State *L;
+
+		// Fixed stack slots
+		enum {
+			META = 1, STYLES, TENV, SUBS,
+			/// Compiled expressions by their source text
+			EXPR_CACHE,
+			/// Compiled code lines by Template::code_index
+			CODE_CACHE,
+			/// Per-line slots
+			ORGLINE, KARA, FURI, TEMP,
+			SLOT_COUNT = TEMP
+		};
+		size_t expr_cache_size = 0;
+		int code_count = 0;
+		int temp_count = 0;
+
+		std::deque<Template> pool;
+		std::vector<Template *> once, line_templates, syl, furi;
+		/// Line templates with an identifier, in the order they were created.
+		/// kara-templater found these after the unnamed ones, in hash order.
+		std::vector<Template *> named_lines;
+
+		/// The original line as the Lua code may have changed it
+		AssDialogueBase base;
+		bool base_stale = false;
+		/// Has any Lua code run since the current line was set up?
+		bool lua_ran = false;
+
+		/// Layout of the current line
+		struct {
+			double left;
+			std::string halign, valign;
+			std::string text_stripped;
+			int kara_n, furi_n;
+		} line;
+		Value varctx[V_COUNT];
+
+		std::vector<SylState> kara_syls, furi_syls;
+		bool kara_loaded = false, furi_loaded = false;
+
+		// What kara-templater would currently have in tenv
+		bool line_is_orgline = false;
+		NewLine *cur_newline = nullptr;
+		SylState *cur_syl = nullptr;
+		SylState *cur_basesyl = nullptr;
+		double *loop_j = nullptr, *loop_maxj = nullptr;
+
+		std::map<const void *, std::unique_ptr<AssStyle>> styles;
+		std::map<std::pair<const void *, std::string>, double> char_widths;
+
+		/// Call aegisub.debug.out(level, fmt, ...) with the nargs values on
+		/// the top of the stack as the format arguments
+		void DebugOut(int level, const char *fmt, int nargs) {
+			lua_getglobal(L, "aegisub");
+			lua_getfield(L, -1, "debug");
+			lua_getfield(L, -1, "out");
+			lua_replace(L, -3);
+			lua_pop(L, 1);
+			lua_insert(L, -(nargs + 1));
+			lua_pushinteger(L, level);
+			lua_insert(L, -(nargs + 1));
+			lua_pushstring(L, fmt);
+			lua_insert(L, -(nargs + 1));
+			lua_call(L, nargs + 2, 0);
+		}
+
+		void DebugOut(int level, const char *fmt, std::initializer_list<std::string const*> args) {
+			for (auto arg : args)
+				push_value(L, *arg);
+			DebugOut(level, fmt, static_cast<int>(args.size()));
+		}
+
+		BOOST_NORETURN void Cancel() {
+			lua_getglobal(L, "aegisub");
+			lua_getfield(L, -1, "cancel");
+			lua_remove(L, -2);
+			lua_call(L, 0, 0);
+			lua_pushnil(L);
+			throw error_tag();
+		}
+
+		void CallProgress(const char *name, double value) {
+			lua_getglobal(L, "aegisub");
+			lua_getfield(L, -1, "progress");
+			lua_getfield(L, -1, name);
+			lua_pushnumber(L, value);
+			lua_call(L, 1, 0);
+			lua_pop(L, 2);
+		}
+
+		void SetTask(const char *task) {
+			lua_getglobal(L, "aegisub");
+			lua_getfield(L, -1, "progress");
+			lua_getfield(L, -1, "task");
+			lua_pushstring(L, task);
+			lua_call(L, 1, 0);
+			lua_pop(L, 2);
+		}
+
+		bool IsCancelled() {
+			lua_getglobal(L, "aegisub");
+			lua_getfield(L, -1, "progress");
+			lua_getfield(L, -1, "is_cancelled");
+			lua_call(L, 0, 1);
+			bool cancelled = !!lua_toboolean(L, -1);
+			lua_pop(L, 3);
+			return cancelled;
+		}
+
+		/// Push table.copy(value at idx)
+		void PushCopy(int idx) {
+			if (idx < 0)
+				idx = lua_gettop(L) + idx + 1;
+			lua_getglobal(L, "table");
+			lua_getfield(L, -1, "copy");
+			lua_remove(L, -2);
+			lua_pushvalue(L, idx);
+			lua_call(L, 1, 1);
+		}
+
+		/// Store the value on the top of the stack in the per-line temporary
+		/// table and pop it
+		int StoreTemp() {
+			lua_rawseti(L, TEMP, ++temp_count);
+			return temp_count;
+		}
+
+		AssDialogue const& Dialogue(size_t idx) const {
+			return static_cast<AssDialogue const&>(subs->GetEntry(idx));
+		}
+
+		bool IsDialogue(size_t idx) const {
+			return subs->lines[idx] && subs->lines[idx]->Group() == AssEntryGroup::DIALOGUE;
+		}
+
+		// Template parsing
+
+		bool ReadLoops(std::string& rest, Template& t, const char *kind, AssDialogue const& dia) {
+			std::string times, tail;
+			headtail(rest, times, tail);
+			push_value(L, times);
+			bool is_number = !!lua_isnumber(L, -1);
+			t.loops = is_number ? lua_tonumber(L, -1) : 1;
+			lua_pop(L, 1);
+			if (is_number) {
+				rest = tail;
+				return true;
+			}
+
+			std::string text = dia.Text, effect = dia.Effect;
+			DebugOut(3, kind, {&times, &text, &effect});
+			return false;
+		}
+
+		void ParseCode(AssDialogue const& dia, std::string rest) {
+			pool.emplace_back();
+			Template& t = pool.back();
+			t.is_code = true;
+			t.code = dia.Text;
+			t.code_index = ++code_count;
+			t.style = dia.Style;
+			bool inserted = false;
+
+			std::string m, tail;
+			while (!rest.empty()) {
+				headtail(rest, m, tail);
+				rest = tail;
+				m = lower(m);
+				if (m == "once") {
+					once.push_back(&t);
+					inserted = true;
+				}
+				else if (m == "line") {
+					line_templates.push_back(&t);
+					inserted = true;
+				}
+				else if (m == "syl") {
+					syl.push_back(&t);
+					inserted = true;
+				}
+				else if (m == "furi") {
+					furi.push_back(&t);
+					inserted = true;
+				}
+				else if (m == "all")
+					t.all_styles = true;
+				else if (m == "noblank")
+					t.noblank = true;
+				else if (m == "repeat" || m == "loop")
+					ReadLoops(rest, t, "Failed reading this repeat-count to a number: %s\nIn template code line: %s\nEffect field: %s\n\n", dia);
+				else {
+					std::string text = dia.Text, effect = dia.Effect;
+					DebugOut(3, "Unknown modifier in code template: %s\nIn template code line: %s\nEffect field: %s\n\n", {&m, &text, &effect});
+				}
+			}
+
+			if (!inserted)
+				once.push_back(&t);
+		}
+
+		void ParseTemplate(AssDialogue const& dia, std::string rest) {
+			pool.emplace_back();
+			Template *t = &pool.back();
+			t->style = dia.Style;
+			t->layer = dia.Layer;
+			bool inserted = false;
+
+			std::string m, tail;
+			std::string text = dia.Text, effect = dia.Effect;
+			while (!rest.empty()) {
+				headtail(rest, m, tail);
+				rest = tail;
+				m = lower(m);
+				if ((m == "pre-line" || m == "line") && !inserted) {
+					std::string id;
+					headtail(rest, id, tail);
+					id = lower(id);
+					bool is_id = !id.empty() && std::none_of(std::begin(template_modifiers), std::end(template_modifiers),
+						[&](const char *kw) { return id == kw; });
+					if (is_id)
+						rest = tail;
+
+					auto named = is_id ? std::find_if(named_lines.begin(), named_lines.end(),
+						[&](Template *tpl) { return tpl->id == id; }) : named_lines.end();
+					if (named != named_lines.end())
+						t = *named;
+					else if (is_id) {
+						t->id = id;
+						named_lines.push_back(t);
+					}
+					else
+						line_templates.push_back(t);
+					inserted = true;
+					t->isline = true;
+					if (m == "line")
+						t->t_source += dia.Text.get();
+					else
+						t->pre_source += dia.Text.get();
+				}
+				else if (m == "syl" && !t->isline) {
+					syl.push_back(t);
+					inserted = true;
+				}
+				else if (m == "furi" && !t->isline) {
+					furi.push_back(t);
+					inserted = true;
+				}
+				else if ((m == "pre-line" || m == "line") && inserted)
+					DebugOut(2, "Unable to combine %s class templates with other template classes\n\n", {&m});
+				else if ((m == "syl" || m == "furi") && t->isline)
+					DebugOut(2, "Unable to combine %s class template lines with line or pre-line classes\n\n", {&m});
+				else if (m == "all")
+					t->all_styles = true;
+				else if (m == "repeat" || m == "loop")
+					ReadLoops(rest, *t, "Failed reading this repeat-count to a number: %s\nIn template line: %s\nEffect field: %s\n\n", dia);
+				else if (m == "notext")
+					t->addtext = false;
+				else if (m == "keeptags")
+					t->keeptags = true;
+				else if (m == "multi")
+					t->multi = true;
+				else if (m == "char")
+					t->perchar = true;
+				else if (m == "noblank")
+					t->noblank = true;
+				else if (m == "fx" || m == "fxgroup") {
+					std::string name;
+					headtail(rest, name, tail);
+					bool fx = m == "fx";
+					(fx ? t->has_fx : t->has_fxgroup) = !name.empty();
+					if (!name.empty()) {
+						(fx ? t->fx : t->fxgroup) = name;
+						rest = tail;
+					}
+					else if (fx)
+						DebugOut(3, "No fx name following fx modifier\nIn template line: %s\nEffect field: %s\n\n", {&text, &effect});
+					else
+						DebugOut(3, "No fxgroup name following fxgroup modifier\nIn template linee: %s\nEffect field: %s\n\n", {&text, &effect});
+				}
+				else
+					DebugOut(3, "Unknown modifier in template: %s\nIn template line: %s\nEffect field: %s\n\n", {&m, &text, &effect});
+			}
+
+			if (!inserted)
+				syl.push_back(t);
+			if (!t->isline)
+				t->t_source = dia.Text;
+		}
+
+		void ParseTemplates() {
+			auto& lines = subs->lines;
+			std::string fx, mods;
+			for (size_t i = 0; i < lines.size(); ) {
+				CallProgress("set", static_cast<double>(i) / lines.size() * 100);
+				size_t idx = i++;
+				if (!IsDialogue(idx)) continue;
+
+				auto const& dia = Dialogue(idx);
+				if (dia.Comment) {
+					headtail(dia.Effect, fx, mods);
+					fx = lower(fx);
+					if (fx == "code")
+						ParseCode(dia, mods);
+					else if (fx == "template")
+						ParseTemplate(dia, mods);
+				}
+				else if (dia.Effect.get() == "fx") {
+					// A line generated by an earlier run
+					subs->modification_type |= AssFile::COMMIT_DIAG_ADDREM;
+					subs->QueueLineForDeletion(idx);
+					subs->LineRemoved(idx);
+					lines.erase(idx);
+					subs->time_index.reset();
+					i = idx;
+				}
+			}
+			CallProgress("set", 100);
+
+			for (auto& t : pool) {
+				if (t.is_code) continue;
+				t.t.Parse(std::move(t.t_source));
+				t.pre.Parse(std::move(t.pre_source));
+			}
+		}
+
+		// Running Lua code
+
+		/// Push the table for the syllable, making it first if needed
+		void PushSyl(SylState& s) {
+			if (!s.parent) {
+				lua_rawgeti(L, s.furi ? FURI : KARA, s.index);
+				return;
+			}
+
+			if (!s.temp) {
+				PushSyl(*s.parent);
+				PushCopy(-1);
+				lua_remove(L, -2);
+				s.temp = StoreTemp();
+				s.dirty = s.parent->dirty | SylState::CHAR_FIELDS | SylState::HIGHLIGHT_FIELDS;
+			}
+			lua_rawgeti(L, TEMP, s.temp);
+
+			auto const& d = s.data;
+			if (s.dirty & SylState::CHAR_FIELDS) {
+				set_field(L, "text", d.text);
+				set_field(L, "text_stripped", d.text_stripped);
+				set_field(L, "text_spacestripped", d.text_spacestripped);
+				set_field(L, "prespace", d.prespace);
+				set_field(L, "postspace", d.postspace);
+				set_field(L, "left", d.left);
+				set_field(L, "center", d.center);
+				set_field(L, "right", d.right);
+				set_field(L, "prespacewidth", d.prespacewidth);
+				set_field(L, "postspacewidth", d.postspacewidth);
+			}
+			if (s.dirty & SylState::HIGHLIGHT_FIELDS) {
+				set_field(L, "start_time", d.start_time);
+				set_field(L, "end_time", d.end_time);
+				set_field(L, "duration", d.duration);
+			}
+			s.dirty = 0;
+		}
+
+		void PushNewLine(NewLine& nl) {
+			if (!nl.temp) {
+				PushCopy(ORGLINE);
+				set_field(L, "layer", nl.layer);
+				if (nl.style_from) {
+					PushSyl(*nl.style_from);
+					lua_getfield(L, -1, "style");
+					lua_pushvalue(L, -1);
+					lua_setfield(L, -4, "styleref");
+					lua_getfield(L, -1, "name");
+					lua_setfield(L, -4, "style");
+					lua_pop(L, 2);
+				}
+				nl.temp = StoreTemp();
+			}
+			lua_rawgeti(L, TEMP, nl.temp);
+		}
+
+		/// Set the fields of tenv to what kara-templater would have had in
+		/// them at this point
+		void EnterLua() {
+			if (loop_j) {
+				set_field(L, "j", *loop_j);
+				set_field(L, "maxj", *loop_maxj);
+			}
+
+			if (cur_newline)
+				PushNewLine(*cur_newline);
+			else if (line_is_orgline)
+				lua_pushvalue(L, ORGLINE);
+			else
+				lua_pushnil(L);
+			lua_setfield(L, TENV, "line");
+
+			for (auto s : {std::make_pair("syl", cur_syl), std::make_pair("basesyl", cur_basesyl)}) {
+				if (s.second)
+					PushSyl(*s.second);
+				else
+					lua_pushnil(L);
+				lua_setfield(L, TENV, s.first);
+			}
+		}
+
+		/// Read back what Lua code may have changed
+		void LeaveLua() {
+			lua_ran = true;
+			base_stale = true;
+			if (!loop_j) return;
+			for (auto field : {std::make_pair("j", loop_j), std::make_pair("maxj", loop_maxj)}) {
+				lua_getfield(L, TENV, field.first);
+				if (!lua_isnumber(L, -1))
+					error(L, "Template loop counter '%s' must be a number", field.first);
+				*field.second = lua_tonumber(L, -1);
+				lua_pop(L, 1);
+			}
+		}
+
+		/// Evaluate !expression! in the context of the template and append
+		/// the result
+		void Evaluate(std::string const& expression, TextTemplate const& tt, std::string& out) {
+			std::string source = "return (" + expression + ")";
+			push_value(L, source);
+			lua_rawget(L, EXPR_CACHE);
+			if (lua_isnil(L, -1)) {
+				lua_pop(L, 1);
+				if (luaL_loadbuffer(L, source.data(), source.size(), source.c_str())) {
+					push_value(L, expression);
+					push_value(L, tt.source);
+					DebugOut(2, "Error parsing expression: %s\nExpression producing error: %s\nTemplate with expression: %s\n\n", 3);
+					Cancel();
+				}
+				lua_pushvalue(L, TENV);
+				lua_setfenv(L, -2);
+
+				// Expressions containing variables are different every time,
+				// so start over rather than keeping all of them
+				if (++expr_cache_size > 10000) {
+					lua_newtable(L);
+					lua_replace(L, EXPR_CACHE);
+					expr_cache_size = 0;
+				}
+				push_value(L, source);
+				lua_pushvalue(L, -2);
+				lua_rawset(L, EXPR_CACHE);
+			}
+
+			EnterLua();
+			if (lua_pcall(L, 0, 1, 0)) {
+				push_value(L, expression);
+				push_value(L, tt.source);
+				DebugOut(2, "Runtime error in template expression: %s\nExpression producing error: %s\nTemplate with expression: %s\n\n", 3);
+				Cancel();
+			}
+			LeaveLua();
+
+			switch (lua_type(L, -1)) {
+				case LUA_TSTRING:
+				case LUA_TNUMBER: {
+					size_t len;
+					const char *str = lua_tolstring(L, -1, &len);
+					out.append(str, len);
+					break;
+				}
+				case LUA_TNIL:
+					out += '!';
+					out += expression;
+					out += '!';
+					break;
+				case LUA_TBOOLEAN:
+					if (!lua_toboolean(L, -1)) {
+						out += '!';
+						out += expression;
+						out += '!';
+						break;
+					}
+					// fallthrough
+				default:
+					error(L, "invalid replacement value (a %s)", lua_typename(L, lua_type(L, -1)));
+			}
+			lua_pop(L, 1);
+		}
+
+		void RunCode(Template& t) {
+			lua_rawgeti(L, CODE_CACHE, t.code_index);
+			if (lua_isnil(L, -1)) {
+				lua_pop(L, 1);
+				if (luaL_loadbuffer(L, t.code.data(), t.code.size(), "template code")) {
+					push_value(L, t.code);
+					DebugOut(2, "Failed to parse Lua code: %s\nCode that failed to parse: %s\n\n", 2);
+					Cancel();
+				}
+				lua_pushvalue(L, TENV);
+				lua_setfenv(L, -2);
+				lua_pushvalue(L, -1);
+				lua_rawseti(L, CODE_CACHE, t.code_index);
+			}
+
+			double j = 0, maxj = t.loops;
+			auto old_j = loop_j, old_maxj = loop_maxj;
+			loop_j = &j;
+			loop_maxj = &maxj;
+			while (!(j >= maxj)) {
+				++j;
+				EnterLua();
+				lua_pushvalue(L, -1);
+				if (lua_pcall(L, 0, 0, 0)) {
+					push_value(L, t.code);
+					DebugOut(2, "Runtime error in template code: %s\nCode producing error: %s\n\n", 2);
+					Cancel();
+				}
+				LeaveLua();
+			}
+			loop_j = old_j;
+			loop_maxj = old_maxj;
+			lua_pop(L, 1);
+		}
+
+		/// Fill in the variables and expressions of a template and append the
+		/// result
+		void Render(TextTemplate const& tt, std::string& out) {
+			std::string text;
+			for (auto const& segment : tt.segments) {
+				if (segment.var < 0) {
+					text += segment.text;
+					continue;
+				}
+
+				Value const* value = segment.var < V_COUNT ? &varctx[segment.var] : nullptr;
+				if (!value || value->type == Value::UNSET) {
+					push_value(L, segment.text);
+					push_value(L, tt.source);
+					DebugOut(2, "Unknown variable name: %s\nIn karaoke template: %s\n\n", 2);
+					text += '$';
+					text += segment.text;
+				}
+				else if (value->type == Value::NUMBER)
+					append_number(text, value->number);
+				else
+					text += value->string;
+			}
+
+			size_t pos = 0;
+			while (pos < text.size()) {
+				size_t open = text.find('!', pos);
+				size_t close = open == std::string::npos ? open : text.find('!', open + 1);
+				if (close == std::string::npos) break;
+				out.append(text, pos, open - pos);
+				Evaluate(text.substr(open + 1, close - open - 1), tt, out);
+				pos = close + 1;
+			}
+			if (pos < text.size())
+				out.append(text, pos, std::string::npos);
+		}
+
+		// Line and syllable data
+
+		AssDialogueBase const& Base() {
+			if (base_stale) {
+				lua_pushvalue(L, ORGLINE);
+				auto e = LuaAssFile::LuaToAssEntry(L, subs->ass);
+				lua_pop(L, 1);
+				if (e->Group() != AssEntryGroup::DIALOGUE)
+					error(L, "The original line must stay a dialogue line");
+				base = static_cast<AssDialogue&>(*e);
+				base_stale = false;
+			}
+			return base;
+		}
+
+		/// Read a number field from the table on the top of the stack
+		double GetNumber(const char *name, const char *what) {
+			lua_getfield(L, -1, name);
+			if (!lua_isnumber(L, -1))
+				error(L, "Invalid or missing field '%s' in karaoke %s (expected number)", name, what);
+			double value = lua_tonumber(L, -1);
+			lua_pop(L, 1);
+			return value;
+		}
+
+		std::string GetString(const char *name) {
+			lua_getfield(L, -1, name);
+			std::string value = lua_isstring(L, -1) ? lua_tostring(L, -1) : "";
+			lua_pop(L, 1);
+			return value;
+		}
+
+		Value GetValue(const char *name) {
+			Value value;
+			lua_getfield(L, -1, name);
+			if (lua_type(L, -1) == LUA_TNUMBER)
+				value = lua_tonumber(L, -1);
+			else if (lua_type(L, -1) == LUA_TSTRING) {
+				value.type = Value::STRING;
+				value.string = lua_tostring(L, -1);
+			}
+			lua_pop(L, 1);
+			return value;
+		}
+
+		void LoadSyllables(std::vector<SylState>& syls, bool is_furi, int first, int last) {
+			syls.clear();
+			syls.resize(std::max(last - first + 1, 0));
+			for (int i = first; i <= last; ++i) {
+				auto& s = syls[i - first];
+				s.index = i;
+				s.furi = is_furi;
+				lua_rawgeti(L, is_furi ? FURI : KARA, i);
+				if (!lua_istable(L, -1))
+					error(L, "Missing karaoke %s %d", is_furi ? "furigana" : "syllable", i);
+
+				const char *what = is_furi ? "furigana" : "syllable";
+				auto& d = s.data;
+				d.start_time = GetNumber("start_time", what);
+				d.end_time = GetNumber("end_time", what);
+				d.duration = GetNumber("duration", what);
+				d.i = GetNumber("i", what);
+				d.left = GetNumber("left", what);
+				d.center = GetNumber("center", what);
+				d.right = GetNumber("right", what);
+				d.width = GetNumber("width", what);
+				d.height = GetNumber("height", what);
+				d.prespacewidth = GetNumber("prespacewidth", what);
+				d.postspacewidth = GetNumber("postspacewidth", what);
+				lua_getfield(L, -1, "isfuri");
+				d.isfuri = !!lua_toboolean(L, -1);
+				lua_pop(L, 1);
+				d.text = GetString("text");
+				d.text_stripped = GetString("text_stripped");
+				d.text_spacestripped = GetString("text_spacestripped");
+				d.prespace = GetString("prespace");
+				d.postspace = GetString("postspace");
+				d.inline_fx = GetString("inline_fx");
+
+				lua_getfield(L, -1, "style");
+				d.has_style = lua_istable(L, -1);
+				if (d.has_style)
+					d.style_name = GetString("name");
+				lua_pop(L, 2);
+			}
+		}
+
+		std::vector<SylState>& KaraSyls() {
+			if (!kara_loaded) {
+				LoadSyllables(kara_syls, false, 0, line.kara_n);
+				kara_loaded = true;
+			}
+			return kara_syls;
+		}
+
+		std::vector<SylState>& FuriSyls() {
+			if (!furi_loaded) {
+				LoadSyllables(furi_syls, true, 1, line.furi_n);
+				furi_loaded = true;
+			}
+			return furi_syls;
+		}
+
+		/// Width of a character in the syllable's style, as
+		/// aegisub.text_extents gives it
+		double CharWidth(SylState const& s, std::string const& c) {
+			PushSyl(const_cast<SylState&>(s.Root()));
+			lua_getfield(L, -1, "style");
+			const void *key = lua_topointer(L, -1);
+
+			auto it = char_widths.find(std::make_pair(key, c));
+			if (it != char_widths.end()) {
+				lua_pop(L, 2);
+				return it->second;
+			}
+
+			auto& style = styles[key];
+			if (!style) {
+				if (!lua_istable(L, -1))
+					error(L, "Karaoke syllable has no style");
+				auto e = LuaAssFile::LuaToAssEntry(L);
+				if (e->Group() != AssEntryGroup::STYLE)
+					error(L, "Not a style entry");
+				style.reset(static_cast<AssStyle *>(e.release()));
+			}
+			lua_pop(L, 2);
+
+			double width, height, descent, extlead;
+			if (!CalculateTextExtents(style.get(), c, width, height, descent, extlead))
+				error(L, "Some internal error occurred calculating text_extents");
+			char_widths[std::make_pair(key, c)] = width;
+			return width;
+		}
+
+		/// kara-templater's set_ctx_syl
+		void SetCtxSyl(Syllable const& syl) {
+			auto v = varctx;
+			v[V_SSTART] = syl.start_time;
+			v[V_SEND] = syl.end_time;
+			v[V_SDUR] = syl.duration;
+			v[V_SKDUR] = syl.duration / 10;
+			v[V_SMID] = syl.start_time + syl.duration / 2;
+			v[V_START] = v[V_SSTART];
+			v[V_END] = v[V_SEND];
+			v[V_DUR] = v[V_SDUR];
+			v[V_KDUR] = v[V_SKDUR];
+			v[V_MID] = v[V_SMID];
+			v[V_SI] = syl.i;
+			v[V_I] = v[V_SI];
+			v[V_SLEFT] = std::floor(line.left + syl.left + 0.5);
+			v[V_SCENTER] = std::floor(line.left + syl.center + 0.5);
+			v[V_SRIGHT] = std::floor(line.left + syl.right + 0.5);
+			v[V_SWIDTH] = std::floor(syl.width + 0.5);
+			if (syl.isfuri) {
+				v[V_SBOTTOM] = v[V_LTOP];
+				v[V_STOP] = std::floor(v[V_LTOP].number - syl.height + 0.5);
+				v[V_SMIDDLE] = std::floor(v[V_LTOP].number - syl.height / 2 + 0.5);
+			}
+			else {
+				v[V_STOP] = v[V_LTOP];
+				v[V_SMIDDLE] = v[V_LMIDDLE];
+				v[V_SBOTTOM] = v[V_LBOTTOM];
+			}
+			v[V_SHEIGHT] = syl.height;
+			if (line.halign == "left")
+				v[V_SX] = std::floor(line.left + syl.left + 0.5);
+			else if (line.halign == "center")
+				v[V_SX] = std::floor(line.left + syl.center + 0.5);
+			else if (line.halign == "right")
+				v[V_SX] = std::floor(line.left + syl.right + 0.5);
+			if (line.valign == "top")
+				v[V_SY] = v[V_STOP];
+			else if (line.valign == "middle")
+				v[V_SY] = v[V_SMIDDLE];
+			else if (line.valign == "bottom")
+				v[V_SY] = v[V_SBOTTOM];
+			v[V_LEFT] = v[V_SLEFT];
+			v[V_CENTER] = v[V_SCENTER];
+			v[V_RIGHT] = v[V_SRIGHT];
+			v[V_WIDTH] = v[V_SWIDTH];
+			v[V_TOP] = v[V_STOP];
+			v[V_MIDDLE] = v[V_SMIDDLE];
+			v[V_BOTTOM] = v[V_SBOTTOM];
+			v[V_HEIGHT] = v[V_SHEIGHT];
+			v[V_X] = v[V_SX];
+			v[V_Y] = v[V_SY];
+		}
+
+		void SetCtxLine() {
+			auto v = varctx;
+			v[V_START] = v[V_LSTART];
+			v[V_END] = v[V_LEND];
+			v[V_DUR] = v[V_LDUR];
+			v[V_KDUR] = std::floor(v[V_DUR].number / 10);
+			v[V_MID] = v[V_LMID];
+			v[V_I] = v[V_LI];
+			v[V_LEFT] = v[V_LLEFT];
+			v[V_CENTER] = v[V_LCENTER];
+			v[V_RIGHT] = v[V_LRIGHT];
+			v[V_WIDTH] = v[V_LWIDTH];
+			v[V_TOP] = v[V_LTOP];
+			v[V_MIDDLE] = v[V_LMIDDLE];
+			v[V_BOTTOM] = v[V_LBOTTOM];
+			v[V_HEIGHT] = v[V_LHEIGHT];
+			v[V_X] = v[V_LX];
+			v[V_Y] = v[V_LY];
+		}
+
+		/// Read the layout karaskel gave the line on the top of the stack
+		void LoadLine() {
+			const char *what = "line";
+			auto v = varctx;
+			for (size_t i = 0; i < V_COUNT; ++i)
+				v[i].type = Value::UNSET;
+
+			double start_time = GetNumber("start_time", what);
+			double duration = GetNumber("duration", what);
+			v[V_LAYER] = GetValue("layer");
+			v[V_LSTART] = start_time;
+			v[V_LEND] = GetValue("end_time");
+			v[V_LDUR] = duration;
+			v[V_LMID] = start_time + duration / 2;
+			v[V_STYLE] = GetValue("style");
+			v[V_ACTOR] = GetValue("actor");
+
+			lua_getfield(L, -1, "styleref");
+			if (!lua_istable(L, -1))
+				error(L, "Invalid or missing field 'styleref' in karaoke line (expected table)");
+			double style_margins[3] = {
+				GetNumber("margin_l", "style"), GetNumber("margin_r", "style"), GetNumber("margin_t", "style")
+			};
+			double style_margin_b = GetNumber("margin_b", "style");
+			lua_pop(L, 1);
+			double margins[3] = {GetNumber("margin_l", what), GetNumber("margin_r", what), GetNumber("margin_t", what)};
+			double margin_b = GetNumber("margin_b", what);
+			for (int i = 0; i < 3; ++i)
+				v[V_MARGIN_L + i] = margins[i] > 0 ? margins[i] : style_margins[i];
+			v[V_MARGIN_B] = margin_b > 0 ? margin_b : style_margin_b;
+			v[V_MARGIN_V] = v[V_MARGIN_T];
+
+			lua_getfield(L, -1, "kara");
+			lua_replace(L, KARA);
+			lua_getfield(L, -1, "furi");
+			lua_replace(L, FURI);
+			if (!lua_istable(L, KARA) || !lua_istable(L, FURI))
+				error(L, "Karaoke line has not been preprocessed");
+			lua_getfield(L, KARA, "n");
+			line.kara_n = static_cast<int>(lua_tointeger(L, -1));
+			v[V_SYLN] = lua_tonumber(L, -1);
+			lua_getfield(L, FURI, "n");
+			line.furi_n = static_cast<int>(lua_tointeger(L, -1));
+			lua_pop(L, 2);
+
+			v[V_LI] = GetNumber("i", what);
+			double left = GetNumber("left", what);
+			double width = GetNumber("width", what);
+			line.left = left;
+			v[V_LLEFT] = std::floor(left + 0.5);
+			v[V_LCENTER] = std::floor(left + width / 2 + 0.5);
+			v[V_LRIGHT] = std::floor(left + width + 0.5);
+			v[V_LWIDTH] = std::floor(width + 0.5);
+			v[V_LTOP] = std::floor(GetNumber("top", what) + 0.5);
+			v[V_LMIDDLE] = std::floor(GetNumber("middle", what) + 0.5);
+			v[V_LBOTTOM] = std::floor(GetNumber("bottom", what) + 0.5);
+			v[V_LHEIGHT] = std::floor(GetNumber("height", what) + 0.5);
+			v[V_LX] = std::floor(GetNumber("x", what) + 0.5);
+			v[V_LY] = std::floor(GetNumber("y", what) + 0.5);
+			line.halign = GetString("halign");
+			line.valign = GetString("valign");
+			line.text_stripped = GetString("text_stripped");
+		}
+
+		// Applying templates
+
+		/// Does the template apply to the line as it currently is?
+		bool Matches(Template const& t) {
+			if (!t.all_styles && t.style != Base().Style.get())
+				return false;
+			if (!t.has_fxgroup)
+				return true;
+			lua_getfield(L, TENV, "fxgroup");
+			push_value(L, t.fxgroup);
+			lua_gettable(L, -2);
+			bool disabled = lua_isboolean(L, -1) && !lua_toboolean(L, -1);
+			lua_pop(L, 2);
+			return !disabled;
+		}
+
+		void AppendLine(NewLine& nl, std::string const& text) {
+			std::unique_ptr<AssEntry> e;
+			if (nl.temp) {
+				lua_rawgeti(L, TEMP, nl.temp);
+				set_field(L, "text", text);
+				set_field(L, "effect", "fx");
+				e = LuaAssFile::LuaToAssEntry(L, subs->ass);
+				lua_pop(L, 1);
+			}
+			else {
+				auto const& b = Base();
+				auto dia = agi::make_unique<AssDialogue>();
+				dia->Comment = b.Comment;
+				dia->Layer = nl.layer;
+				dia->Margin = b.Margin;
+				dia->Start = b.Start;
+				dia->End = b.End;
+				if (!nl.style_from)
+					dia->Style = b.Style;
+				else if (nl.style_from->data.has_style)
+					dia->Style = nl.style_from->data.style_name;
+				else
+					error(L, "Karaoke syllable has no style");
+				dia->Actor = b.Actor;
+				dia->ExtradataIds = b.ExtradataIds;
+				dia->Text = text;
+				dia->Effect = "fx";
+				e = std::move(dia);
+			}
+
+			subs->modification_type |= AssFile::COMMIT_DIAG_ADDREM;
+			subs->InsertLine(subs->AppendPosition(e->Group()), std::move(e));
+			subs->time_index.reset();
+		}
+
+		/// kara-templater's apply_one_syllable_template
+		int ApplyOne(SylState& s, Template& t, bool skip_perchar, bool skip_multi) {
+			if (t.has_fx && t.fx != s.data.inline_fx) return 0;
+			if (t.noblank && is_blank(s.data)) return 0;
+
+			int applied = 0;
+			if (!skip_perchar && t.perchar) {
+				SylState charsyl;
+				charsyl.data = s.data;
+				charsyl.parent = &s;
+				cur_syl = &charsyl;
+
+				auto& d = charsyl.data;
+				std::string const& text = s.data.text_stripped;
+				double left = s.data.left;
+				for (size_t pos = 0; pos < text.size(); ) {
+					size_t len = char_width(text[pos]);
+					std::string c = text.substr(pos, len);
+					pos += len;
+
+					d.text = d.text_stripped = d.text_spacestripped = c;
+					d.prespace.clear();
+					d.postspace.clear();
+					double width = CharWidth(s, c);
+					d.left = left;
+					d.center = left + width / 2;
+					d.right = left + width;
+					d.prespacewidth = d.postspacewidth = 0;
+					left += width;
+					charsyl.dirty |= SylState::CHAR_FIELDS;
+					SetCtxSyl(d);
+
+					applied += ApplyOne(charsyl, t, true, false);
+				}
+				cur_syl = &s;
+				return applied;
+			}
+
+			if (!skip_multi && t.multi) {
+				SylState hlsyl;
+				hlsyl.data = s.data;
+				hlsyl.parent = &s;
+				cur_syl = &hlsyl;
+
+				// The highlights are shared by every copy of the syllable
+				struct Highlight { double start_time, end_time, duration; };
+				std::vector<Highlight> highlights;
+				PushSyl(const_cast<SylState&>(s.Root()));
+				lua_getfield(L, -1, "highlights");
+				if (!lua_istable(L, -1))
+					error(L, "Invalid or missing field 'highlights' in karaoke syllable (expected table)");
+				lua_getfield(L, -1, "n");
+				int n = static_cast<int>(lua_tointeger(L, -1));
+				lua_pop(L, 1);
+				for (int i = 1; i <= n; ++i) {
+					lua_rawgeti(L, -1, i);
+					highlights.push_back(Highlight{
+						GetNumber("start_time", "highlight"),
+						GetNumber("end_time", "highlight"),
+						GetNumber("duration", "highlight")});
+					lua_pop(L, 1);
+				}
+				lua_pop(L, 2);
+
+				for (auto const& hl : highlights) {
+					hlsyl.data.start_time = hl.start_time;
+					hlsyl.data.end_time = hl.end_time;
+					hlsyl.data.duration = hl.duration;
+					hlsyl.dirty |= SylState::HIGHLIGHT_FIELDS;
+					SetCtxSyl(hlsyl.data);
+
+					applied += ApplyOne(hlsyl, t, true, true);
+				}
+				cur_syl = &s;
+				return applied;
+			}
+
+			if (t.is_code) {
+				line_is_orgline = true;
+				cur_newline = nullptr;
+				RunCode(t);
+				return applied;
+			}
+
+			double j = 0, maxj = t.loops;
+			loop_j = &j;
+			loop_maxj = &maxj;
+			while (!(j >= maxj)) {
+				++j;
+				NewLine nl{t.layer, &s};
+				cur_newline = &nl;
+
+				std::string text;
+				Render(t.t, text);
+				if (t.keeptags)
+					text += s.data.text;
+				else if (t.addtext)
+					text += s.data.text_stripped;
+				AppendLine(nl, text);
+				cur_newline = nullptr;
+				++applied;
+			}
+			loop_j = loop_maxj = nullptr;
+
+			return applied;
+		}
+
+		/// kara-templater's apply_syllable_templates
+		bool ApplySylTemplates(std::vector<Template *> const& templates, bool is_furi, int i) {
+			int applied = 0;
+			for (auto t : templates) {
+				if (!Matches(*t)) continue;
+
+				auto& s = (is_furi ? FuriSyls() : KaraSyls())[i];
+				cur_syl = cur_basesyl = &s;
+				SetCtxSyl(s.data);
+				applied += ApplyOne(s, *t, false, false);
+			}
+			return applied > 0;
+		}
+
+		/// kara-templater's apply_line
+		bool ApplyLine() {
+			bool applied = false;
+
+			for (auto list : {&line_templates, &named_lines}) {
+				for (auto t : *list) {
+					if (!Matches(*t)) continue;
+					SetCtxLine();
+
+					if (t->is_code) {
+						// kara-templater's line loop ended as soon as the code's
+						// own loop did
+						line_is_orgline = true;
+						cur_newline = nullptr;
+						RunCode(*t);
+						continue;
+					}
+
+					double j = 0, maxj = t->loops;
+					while (!(j >= maxj)) {
+						++j;
+						applied = true;
+						NewLine nl{t->layer, nullptr};
+						cur_newline = &nl;
+
+						std::string text;
+						loop_j = &j;
+						loop_maxj = &maxj;
+						if (!t->pre.empty())
+							Render(t->pre, text);
+						if (!t->t.empty()) {
+							auto& syls = KaraSyls();
+							for (int i = 1; i <= line.kara_n; ++i) {
+								auto& s = syls[i];
+								cur_syl = cur_basesyl = &s;
+								SetCtxSyl(s.data);
+								Render(t->t, text);
+								if (t->addtext)
+									text += t->keeptags ? s.data.text : s.data.text_stripped;
+							}
+						}
+						else if (t->keeptags)
+							text += Base().Text.get();
+						else
+							text += line.text_stripped;
+						AppendLine(nl, text);
+						cur_newline = nullptr;
+						loop_j = loop_maxj = nullptr;
+					}
+				}
+			}
+
+			if (!syl.empty()) {
+				for (int i = 0; i <= line.kara_n; ++i) {
+					if (ApplySylTemplates(syl, false, i))
+						applied = true;
+				}
+			}
+
+			if (!furi.empty()) {
+				for (int i = 1; i <= line.furi_n; ++i) {
+					if (ApplySylTemplates(furi, true, i - 1))
+						applied = true;
+				}
+			}
+
+			return applied;
+		}
+
+		/// Turn the original line into a karaoke timing line
+		void MarkApplied(size_t idx) {
+			if (!lua_ran) {
+				auto dia = subs->GetWritableDialogue(idx, AssFile::COMMIT_DIAG_META);
+				dia->Comment = true;
+				dia->Effect = "karaoke";
+				return;
+			}
+
+			lua_pushvalue(L, ORGLINE);
+			set_field(L, "comment", true);
+			set_field(L, "effect", "karaoke");
+			auto e = LuaAssFile::LuaToAssEntry(L, subs->ass);
+			lua_pop(L, 1);
+			if (e->Group() != AssEntryGroup::DIALOGUE)
+				error(L, "The original line must stay a dialogue line");
+			auto const& updated = static_cast<AssDialogue const&>(*e);
+
+			auto dia = subs->GetWritableDialogue(idx, AssFile::COMMIT_DIAG_FULL | AssFile::COMMIT_EXTRADATA);
+			dia->Comment = updated.Comment;
+			dia->Layer = updated.Layer;
+			dia->Margin = updated.Margin;
+			dia->Start = updated.Start;
+			dia->End = updated.End;
+			dia->Style = updated.Style;
+			dia->Actor = updated.Actor;
+			dia->Effect = updated.Effect;
+			dia->ExtradataIds = updated.ExtradataIds;
+			dia->Text = updated.Text;
+		}
+
+		void ApplyTemplates() {
+			for (auto t : once)
+				RunCode(*t);
+
+			auto const& lines = subs->lines;
+			size_t n = lines.size();
+			for (size_t i = 0; i < n; ++i) {
+				CallProgress("set", static_cast<double>(i) / n * 100);
+				if (!IsDialogue(i)) continue;
+
+				auto const& dia = Dialogue(i);
+				auto const& effect = dia.Effect.get();
+				bool is_karaoke = false;
+				for (size_t pos = effect.find("araoke"); pos != std::string::npos; pos = effect.find("araoke", pos + 1)) {
+					if (pos > 0 && (effect[pos - 1] == 'k' || effect[pos - 1] == 'K')) {
+						is_karaoke = true;
+						break;
+					}
+				}
+				if (!(effect.empty() && !dia.Comment) && !is_karaoke) continue;
+				if (IsCancelled()) break;
+
+				// Set up the line as kara-templater did, with the layout
+				// done by karaskel
+				subs->AssEntryToLua(L, i);
+				lua_replace(L, ORGLINE);
+				lua_newtable(L);
+				lua_replace(L, TEMP);
+				temp_count = 0;
+
+				lua_pushvalue(L, ORGLINE);
+				set_field(L, "i", i + 1);
+				set_field(L, "comment", false);
+				lua_pop(L, 1);
+
+				lua_getglobal(L, "karaskel");
+				lua_getfield(L, -1, "preproc_line");
+				lua_remove(L, -2);
+				lua_pushvalue(L, SUBS);
+				lua_pushvalue(L, META);
+				lua_pushvalue(L, STYLES);
+				lua_pushvalue(L, ORGLINE);
+				lua_call(L, 4, 0);
+
+				static_cast<AssDialogueBase&>(base) = dia;
+				base.Comment = false;
+				base_stale = false;
+				lua_ran = false;
+				kara_loaded = furi_loaded = false;
+
+				lua_pushvalue(L, ORGLINE);
+				LoadLine();
+				lua_pop(L, 1);
+
+				lua_pushvalue(L, ORGLINE);
+				lua_setfield(L, TENV, "orgline");
+				line_is_orgline = false;
+				cur_newline = nullptr;
+				cur_syl = cur_basesyl = nullptr;
+
+				if (ApplyLine())
+					MarkApplied(i);
+			}
+		}
+
+	public:
+		KaraokeTemplater(LuaAssFile *subs, lua_State *L) : subs(subs), L(L) { }
+
+		/// Run the templates, with meta, styles and tenv at stack indices
+		/// 1 to 3 and the file's userdata at 4
+		void Run() {
+			lua_settop(L, SUBS);
+			lua_newtable(L);
+			lua_newtable(L);
+			lua_settop(L, SLOT_COUNT);
+
+			SetTask("Parsing templates...");
+			ParseTemplates();
+			SetTask("Applying templates...");
+			ApplyTemplates();
+		}
+	};
+
+	int LuaAssFile::LuaApplyTemplates(lua_State *L)
+	{
+		CheckAllowModify();
+
+		if (lua_isuserdata(L, 1))
+			lua_remove(L, 1);
+		luaL_checktype(L, 1, LUA_TTABLE);
+		luaL_checktype(L, 2, LUA_TTABLE);
+		luaL_checktype(L, 3, LUA_TTABLE);
+		lua_settop(L, 3);
+		lua_pushvalue(L, lua_upvalueindex(1));
+
+		KaraokeTemplater(this, L).Run();
+		return 0;
+	}
+}
@@ -0,0 +1,331 @@
+// Copyright (c) 2026, Aegisub CLI contributors
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+// Aegisub Project http://www.aegisub.org/
+
+/// @file auto4_lua_text.cpp
+/// @brief Character counting, line wrapping and karaoke matching functions
+/// for Lua scripts
+/// @ingroup scripting
+///
+/// char_count and wrap take either a single string or an array of strings,
+/// and return a single result or an array of results to match, so that whole
+/// files can be processed with one call. karaoke_match matches all of the
+/// syllables of a line at once.
+
+#include "auto4_lua.h"
+
+#include "ass_style.h"
+#include "auto4_base.h"
+
+#include <libaegisub/character_count.h>
+#include <libaegisub/karaoke_matcher.h>
+#include <libaegisub/line_wrap.h>
+#include <libaegisub/lua/utils.h>
+
+#include <boost/algorithm/string/case_conv.hpp>
+#include <cmath>
+
+using namespace agi::lua;
+
+namespace {
+/// Read the ignore flags for char_count, given either as a bitmask or as a
+/// table of names
+int check_ignore_flags(lua_State *L, int idx) {
+	if (lua_isnoneornil(L, idx))
+		return agi::IGNORE_NONE;
+	if (lua_isnumber(L, idx))
+		return lua_tointeger(L, idx);
+	luaL_checktype(L, idx, LUA_TTABLE);
+
+	int flags = agi::IGNORE_NONE;
+	size_t n = lua_objlen(L, idx);
+	for (size_t i = 1; i <= n; ++i) {
+		lua_rawgeti(L, idx, i);
+		std::string name = lua_isstring(L, -1) ? get_string(L, -1) : "";
+		lua_pop(L, 1);
+		if (name == "whitespace")
+			flags |= agi::IGNORE_WHITESPACE;
+		else if (name == "punctuation")
+			flags |= agi::IGNORE_PUNCTUATION;
+		else if (name == "blocks")
+			flags |= agi::IGNORE_BLOCKS;
+		else
+			error(L, "Unknown character count flag '%s'", name.c_str());
+	}
+	return flags;
+}
+
+/// Does the table at idx look like a style table?
+bool is_style(lua_State *L, int idx) {
+	if (!lua_istable(L, idx)) return false;
+	lua_getfield(L, idx, "class");
+	std::string cls = lua_isstring(L, -1) ? get_string(L, -1) : "";
+	lua_pop(L, 1);
+	return boost::to_lower_copy(cls) == "style";
+}
+
+/// A word of text to wrap, including any whitespace after it
+struct Word {
+	size_t begin;
+	size_t end;
+	size_t trailing_space;
+};
+
+/// Remove override blocks from a range of text
+std::string strip_blocks(std::string const& text, size_t begin, size_t end) {
+	std::string ret;
+	ret.reserve(end - begin);
+	for (size_t i = begin; i < end; ++i) {
+		if (text[i] == '{') {
+			auto close = text.find('}', i);
+			if (close != std::string::npos && close < end) {
+				i = close;
+				continue;
+			}
+		}
+		ret += text[i];
+	}
+	return ret;
+}
+
+/// Lines of a text to be wrapped
+class Wrapper {
+	std::string const& text;
+	/// Words of each line, with lines split at hard line breaks
+	std::vector<std::vector<Word>> lines;
+
+public:
+	Wrapper(std::string const& text) : text(text) {
+		lines.emplace_back();
+		size_t word_start = 0;
+		bool in_space = false;
+		auto end_word = [&](size_t pos) {
+			if (pos > word_start) {
+				size_t space = 0;
+				while (space < pos - word_start && text[pos - space - 1] == ' ')
+					++space;
+				lines.back().push_back(Word{word_start, pos, space});
+			}
+			word_start = pos;
+		};
+
+		for (size_t i = 0; i < text.size(); ++i) {
+			char c = text[i];
+			if (c == '{') {
+				// Override blocks are part of the word they're in, but VSFilter
+				// treats unclosed blocks as plain text
+				auto close = text.find('}', i);
+				if (close != std::string::npos) {
+					if (in_space) end_word(i);
+					in_space = false;
+					i = close;
+				}
+			}
+			else if (c == ' ')
+				in_space = true;
+			else if (c == '\\' && i + 1 < text.size() && (text[i + 1] == 'N' || text[i + 1] == 'n')) {
+				end_word(i);
+				word_start = i + 2;
+				lines.emplace_back();
+				in_space = false;
+				++i;
+			}
+			else {
+				if (in_space) end_word(i);
+				in_space = false;
+			}
+		}
+		end_word(text.size());
+	}
+
+	size_t word_count() const {
+		size_t count = 0;
+		for (auto const& line : lines) count += line.size();
+		return count;
+	}
+
+	/// Get the width of each word in characters
+	std::vector<int> character_widths() const {
+		std::vector<int> widths;
+		widths.reserve(word_count());
+		for (auto const& line : lines) {
+			for (auto const& word : line)
+				widths.push_back(agi::CharacterCount(text.begin() + word.begin, text.begin() + word.end, agi::IGNORE_BLOCKS));
+		}
+		return widths;
+	}
+
+	/// Get the width of each word in pixels when rendered in the given style
+	std::vector<int> style_widths(lua_State *L, AssStyle *style) const {
+		std::vector<int> widths;
+		widths.reserve(word_count());
+		for (auto const& line : lines) {
+			for (auto const& word : line) {
+				double width, height, descent, extlead;
+				if (!Automation4::CalculateTextExtents(style, strip_blocks(text, word.begin, word.end), width, height, descent, extlead))
+					error(L, "Some internal error occurred calculating text extents");
+				widths.push_back(std::lround(width));
+			}
+		}
+		return widths;
+	}
+
+	/// Insert line breaks into the text
+	/// @param widths Width of each word
+	std::string wrap(std::vector<int> const& widths, int max_width, agi::WrapMode mode) const {
+		std::string ret;
+		ret.reserve(text.size() + 16);
+
+		size_t pos = 0;
+		size_t first_word = 0;
+		for (auto const& line : lines) {
+			std::vector<int> line_widths(widths.begin() + first_word, widths.begin() + first_word + line.size());
+			first_word += line.size();
+
+			auto breaks = agi::get_wrap_points(line_widths, max_width, mode);
+			for (auto wrap_before : breaks) {
+				// Drop the whitespace at the end of the line being broken
+				auto const& prev = line[wrap_before - 1];
+				ret.append(text, pos, prev.end - prev.trailing_space - pos);
+				ret += "\\N";
+				pos = line[wrap_before].begin;
+			}
+		}
+		ret.append(text, pos, std::string::npos);
+		return ret;
+	}
+};
+
+/// Wrap a single string, with the widths of the words given by the value at
+/// widths_idx: nil to use character counts, a style table to measure them in
+/// pixels or an array of numbers to use as-is
+std::string wrap_one(lua_State *L, std::string const& text, int widths_idx, AssStyle *style, int max_width, agi::WrapMode mode) {
+	Wrapper wrapper(text);
+	std::vector<int> widths;
+	if (style)
+		widths = wrapper.style_widths(L, style);
+	else if (lua_istable(L, widths_idx)) {
+		size_t n = lua_objlen(L, widths_idx);
+		if (n != wrapper.word_count())
+			error(L, "Expected %d word widths but got %d", (int)wrapper.word_count(), (int)n);
+		widths.reserve(n);
+		for (size_t i = 1; i <= n; ++i) {
+			lua_rawgeti(L, widths_idx, i);
+			widths.push_back(std::lround(lua_tonumber(L, -1)));
+			lua_pop(L, 1);
+		}
+	}
+	else
+		widths = wrapper.character_widths();
+	return wrapper.wrap(widths, max_width, mode);
+}
+}
+
+namespace Automation4 {
+	int LuaCharCount(lua_State *L) {
+		int flags = check_ignore_flags(L, 2);
+		if (!lua_istable(L, 1)) {
+			push_value(L, agi::CharacterCount(check_string(L, 1), flags));
+			return 1;
+		}
+
+		size_t n = lua_objlen(L, 1);
+		lua_createtable(L, n, 0);
+		for (size_t i = 1; i <= n; ++i) {
+			lua_rawgeti(L, 1, i);
+			auto count = agi::CharacterCount(check_string(L, -1), flags);
+			lua_pop(L, 1);
+			push_value(L, count);
+			lua_rawseti(L, -2, i);
+		}
+		return 1;
+	}
+
+	int LuaKaraokeMatch(lua_State *L) {
+		luaL_checktype(L, 1, LUA_TTABLE);
+		auto dest = check_string(L, 2);
+
+		// Syllables can be given as strings or as karaskel's syllable tables
+		std::vector<std::string> source;
+		size_t n = lua_objlen(L, 1);
+		source.reserve(n);
+		for (size_t i = 1; i <= n; ++i) {
+			lua_rawgeti(L, 1, i);
+			if (lua_istable(L, -1)) {
+				lua_getfield(L, -1, "text_stripped");
+				if (!lua_isstring(L, -1)) {
+					lua_pop(L, 1);
+					lua_getfield(L, -1, "text");
+				}
+				lua_remove(L, -2);
+			}
+			if (!lua_isstring(L, -1))
+				error(L, "Karaoke syllable %d is not a string or syllable table", static_cast<int>(i));
+			source.push_back(get_string(L, -1));
+			lua_pop(L, 1);
+		}
+
+		auto groups = agi::match_karaoke_line(source, dest);
+		lua_createtable(L, groups.size(), 0);
+		for (size_t i = 0; i < groups.size(); ++i) {
+			lua_createtable(L, 0, 2);
+			set_field(L, "source_length", groups[i].source_length);
+			set_field(L, "text", groups[i].destination);
+			lua_rawseti(L, -2, i + 1);
+		}
+		return 1;
+	}
+
+	int LuaWrap(lua_State *L) {
+		int max_width = check_int(L, 3);
+		int mode = luaL_optinteger(L, 4, agi::Wrap_Balanced_FirstLonger);
+		argcheck(L, mode >= agi::Wrap_Balanced_FirstLonger && mode <= agi::Wrap_Balanced, 4, "invalid wrap mode");
+		auto wrap_mode = static_cast<agi::WrapMode>(mode);
+
+		std::unique_ptr<AssEntry> style;
+		if (is_style(L, 2)) {
+			lua_pushvalue(L, 2);
+			style = LuaAssFile::LuaToAssEntry(L);
+			lua_pop(L, 1);
+		}
+		auto style_ptr = static_cast<AssStyle *>(style.get());
+
+		if (!lua_istable(L, 1)) {
+			push_value(L, wrap_one(L, check_string(L, 1), 2, style_ptr, max_width, wrap_mode));
+			return 1;
+		}
+
+		// For arrays of strings, the explicit widths are an array of arrays
+		bool per_line_widths = !style && lua_istable(L, 2);
+		size_t n = lua_objlen(L, 1);
+		lua_createtable(L, n, 0);
+		for (size_t i = 1; i <= n; ++i) {
+			lua_rawgeti(L, 1, i);
+			auto text = check_string(L, -1);
+			lua_pop(L, 1);
+
+			if (per_line_widths)
+				lua_rawgeti(L, 2, i);
+			else
+				lua_pushnil(L);
+			auto wrapped = wrap_one(L, text, lua_gettop(L), style_ptr, max_width, wrap_mode);
+			lua_pop(L, 1);
+
+			push_value(L, wrapped);
+			lua_rawseti(L, -2, i);
+		}
+		return 1;
+	}
+}
@@ -13,7 +13,10 @@
 // OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 
 #include "command.h"
+#include "../kanji_timer.h"
+#include "../options.h"
 #include "../resolution_resampler.h"
+#include "../tag_rewriter.h"
 #include "../include/aegisub/context.h"
 
 #include <libaegisub/format.h>
@@ -33,6 +36,40 @@ struct tool_resampleres final : public Command {
 	}
 };
 
+struct tool_rewrite_tags final : public Command {
+	CMD_NAME("tool/rewrite-tags")
+	STR_MENU("Re&write Tags...")
+	STR_DISP("Rewrite Tags")
+	STR_HELP("Apply the rules in a JSON file to the override tags of the selected lines")
+
+	void operator()(agi::Context *c) override {
+		// The rule file is given the same way as the files for a script's
+		// open dialogs
+		if (config::file_responses->empty() || config::file_responses->front().empty())
+			throw CommandError("tool/rewrite-tags needs a rule file, given with --file");
+		auto filename = config::file_responses->front().front();
+		config::file_responses->pop_front();
+
+		RewriteTags(c, LoadTagRewriteRules(filename));
+	}
+};
+
+struct tool_time_kanji final : public Command {
+	CMD_NAME("tool/time/kanji")
+	STR_MENU("&Kanji Timer...")
+	STR_DISP("Kanji Timer")
+	STR_HELP("Copy the karaoke timing and times of lines of one style to the lines of another style")
+
+	void operator()(agi::Context *c) override {
+		if (config::file_responses->empty() || config::file_responses->front().empty())
+			throw CommandError("tool/time/kanji needs an options file, given with --file");
+		auto filename = config::file_responses->front().front();
+		config::file_responses->pop_front();
+
+		TimeKanji(c, LoadKanjiTimerOptions(filename));
+	}
+};
+
 	static std::map<std::string, std::unique_ptr<Command>> cmd_map;
 	typedef std::map<std::string, std::unique_ptr<Command>>::iterator iterator;
 
@@ -77,6 +114,8 @@ struct tool_resampleres final : public Command {
 	void init_builtin_commands() {
 		LOG_D("command/init") << "Populating command map";
 		reg(agi::make_unique<tool_resampleres>());
+		reg(agi::make_unique<tool_rewrite_tags>());
+		reg(agi::make_unique<tool_time_kanji>());
 	}
 
 	void clear() {
@@ -0,0 +1,87 @@
+// Copyright (c) 2026, Aegisub CLI contributors
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+// Aegisub Project http://www.aegisub.org/
+
+/// @file event_time_index.cpp
+/// @brief Interval index used for overlap queries on dialogue lines
+/// @ingroup subs_storage
+///
+
+#include "event_time_index.h"
+
+#include <algorithm>
+#include <climits>
+
+EventTimeIndex::EventTimeIndex(std::vector<Interval> intervals)
+: intervals(std::move(intervals))
+{
+	std::sort(begin(this->intervals), end(this->intervals), [](Interval const& a, Interval const& b) {
+		return a.start < b.start || (a.start == b.start && a.id < b.id);
+	});
+	max_end.resize(this->intervals.size());
+	BuildMaxEnd(0, this->intervals.size());
+}
+
+int EventTimeIndex::BuildMaxEnd(size_t begin, size_t end) {
+	if (begin >= end) return INT_MIN;
+	size_t mid = begin + (end - begin) / 2;
+	int left = BuildMaxEnd(begin, mid);
+	int right = BuildMaxEnd(mid + 1, end);
+	return max_end[mid] = std::max(intervals[mid].end, std::max(left, right));
+}
+
+void EventTimeIndex::CollectActive(size_t begin, size_t end, int time, std::vector<size_t> &out) const {
+	if (begin >= end) return;
+	size_t mid = begin + (end - begin) / 2;
+	// Nothing in this subtree is still active at the given time
+	if (max_end[mid] <= time) return;
+
+	CollectActive(begin, mid, time, out);
+	// Everything from mid on starts at or after the time, so only the left
+	// subtree can contain intervals which started before it
+	if (intervals[mid].start >= time) return;
+	if (intervals[mid].end > time)
+		out.push_back(intervals[mid].id);
+	CollectActive(mid + 1, end, time, out);
+}
+
+std::vector<size_t> EventTimeIndex::Overlapping(int start, int end) const {
+	std::vector<size_t> ret;
+
+	// Intervals which began before the range and are still active at its start
+	CollectActive(0, intervals.size(), start, ret);
+
+	// Intervals which begin within the range
+	auto first = std::lower_bound(begin(intervals), std::end(intervals), start,
+		[](Interval const& i, int t) { return i.start < t; });
+	for (; first != std::end(intervals) && first->start < end; ++first)
+		ret.push_back(first->id);
+
+	std::sort(begin(ret), std::end(ret));
+	return ret;
+}
+
+std::vector<size_t> EventTimeIndex::Overlaps() const {
+	std::vector<size_t> ret;
+	int end_time = 0;
+	for (auto const& i : intervals) {
+		if (i.start >= end_time)
+			end_time = i.end;
+		else
+			ret.push_back(i.id);
+	}
+	std::sort(begin(ret), end(ret));
+	return ret;
+}
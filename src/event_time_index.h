@@ -0,0 +1,73 @@
+// Copyright (c) 2026, Aegisub CLI contributors
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+// Aegisub Project http://www.aegisub.org/
+
+/// @file event_time_index.h
+/// @see event_time_index.cpp
+/// @ingroup subs_storage
+///
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+/// @class EventTimeIndex
+/// @brief Static interval index over the times of a set of dialogue lines
+///
+/// The intervals are stored sorted by start time along with an implicit
+/// balanced tree of the maximum end time of each subtree, so stabbing and
+/// range queries run in O(log n + k) rather than comparing every pair of
+/// lines. The index does not track changes to the lines it was built from;
+/// it must be rebuilt whenever they are modified.
+class EventTimeIndex {
+public:
+	struct Interval {
+		int start;
+		int end;
+		/// Caller-defined identifier returned from queries, normally the
+		/// position of the line in whatever container it came from
+		size_t id;
+	};
+
+private:
+	/// Intervals sorted by start time, then by id
+	std::vector<Interval> intervals;
+	/// Maximum end time in the implicit subtree rooted at each index
+	std::vector<int> max_end;
+
+	int BuildMaxEnd(size_t begin, size_t end);
+	void CollectActive(size_t begin, size_t end, int time, std::vector<size_t> &out) const;
+
+public:
+	EventTimeIndex() = default;
+	/// @param intervals Intervals to index. Zero-length intervals are allowed.
+	explicit EventTimeIndex(std::vector<Interval> intervals);
+
+	/// Get the ids of all intervals overlapping [start, end), using the same
+	/// rules as AssDialogue::CollidesWith
+	/// @return Matching ids in ascending order
+	std::vector<size_t> Overlapping(int start, int end) const;
+
+	/// Get the ids of all intervals which begin while a previous interval is
+	/// active, as determined by the sweep used by the select overlaps macro:
+	/// lines are visited in order of start time (and then id), and a line
+	/// overlaps if it starts before the end of the last line which did not
+	/// @return Matching ids in ascending order
+	std::vector<size_t> Overlaps() const;
+
+	size_t size() const { return intervals.size(); }
+	bool empty() const { return intervals.empty(); }
+};
@@ -0,0 +1,197 @@
+// Copyright (c) 2026, Aegisub CLI contributors
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+// Aegisub Project http://www.aegisub.org/
+
+/// @file kanji_timer.cpp
+/// @brief Copying karaoke timing from romaji lines to kanji lines
+///
+/// The options file is a JSON object naming the two styles:
+///
+///     {"source_style": "Romaji", "destination_style": "Kanji"}
+///
+/// The nth line of the source style is matched to the nth line of the
+/// destination style, and the destination line is split between the source
+/// line's syllables with agi::match_karaoke_line. The destination keeps its
+/// override tags other than karaoke tags, but takes the source's times.
+
+#include "kanji_timer.h"
+
+#include "ass_dialogue.h"
+#include "ass_file.h"
+#include "ass_karaoke.h"
+#include "include/aegisub/context.h"
+
+#include <libaegisub/exception.h>
+#include <libaegisub/format.h>
+#include <libaegisub/format_path.h>
+#include <libaegisub/io.h>
+#include <libaegisub/json.h>
+#include <libaegisub/karaoke_matcher.h>
+#include <libaegisub/log.h>
+
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <thread>
+
+KanjiTimerOptions LoadKanjiTimerOptions(agi::fs::path const& filename) {
+	KanjiTimerOptions options;
+	try {
+		auto stream = agi::io::Open(filename);
+		auto root_element = agi::json_util::parse(*stream);
+		json::Object const& root = root_element;
+		for (auto const& field : root) {
+			auto const& key = field.first;
+			if (key == "source_style")
+				options.source_style = static_cast<json::String const&>(field.second);
+			else if (key == "destination_style")
+				options.destination_style = static_cast<json::String const&>(field.second);
+			else
+				throw agi::InvalidInputException("Unknown option '" + key + "'");
+		}
+		if (options.source_style.empty() || options.destination_style.empty())
+			throw agi::InvalidInputException("Both source_style and destination_style must be given");
+	}
+	catch (json::Exception const& e) {
+		throw agi::InvalidInputException(agi::format("Invalid kanji timer options in %s: %s", filename, e.what()));
+	}
+	catch (agi::InvalidInputException const& e) {
+		throw agi::InvalidInputException(agi::format("Invalid kanji timer options in %s: %s", filename, e.GetMessage()));
+	}
+	return options;
+}
+
+namespace {
+bool is_karaoke_tag(std::string const& name) {
+	return name == "\\k" || name == "\\K" || name == "\\kf" || name == "\\ko";
+}
+}
+
+std::string CopyKaraoke(AssDialogue const& source, std::string const& text) {
+	std::vector<AssKaraoke::Syllable> syls;
+	std::vector<std::string> syl_text;
+	for (auto const& syl : AssKaraoke(&source, false, false)) {
+		// Skip the empty syllable before the first \k tag
+		if (syl.text.empty() && !syl.duration) continue;
+		syls.push_back(syl);
+		syl_text.push_back(syl.text);
+	}
+	if (syls.empty()) return text;
+
+	// The karaoke tag for each group, and where it goes in the stripped text
+	std::vector<std::pair<size_t, std::string>> kara_tags;
+	size_t syl = 0, pos = 0;
+	for (auto const& group : agi::match_karaoke_line(syl_text, AssDialogue::GetStrippedText(text))) {
+		int duration = 0;
+		for (size_t i = 0; i < group.source_length; ++i)
+			duration += syls[syl + i].duration;
+		kara_tags.emplace_back(pos, agi::format("%s%d", syls[syl].tag_type, (duration + 5) / 10));
+		pos += group.destination.size();
+		syl += group.source_length;
+	}
+
+	// Kept between lines so that its storage is reused
+	thread_local AssBlockList blocks;
+	blocks.Parse(text);
+
+	std::string ret;
+	// Length of ret when it last ended with an override block, which the
+	// next karaoke tag is added to rather than starting a new block
+	size_t block_end = std::string::npos;
+	auto next_tag = kara_tags.begin();
+	auto add_tag = [&] {
+		if (ret.size() == block_end)
+			ret.insert(ret.size() - 1, next_tag->second);
+		else
+			ret += "{" + next_tag->second + "}";
+		block_end = ret.size();
+		++next_tag;
+	};
+
+	pos = 0;
+	for (size_t i = 0; i < blocks.size(); ++i) {
+		auto const& block = blocks[i];
+		if (block.type == AssBlockType::OVERRIDE) {
+			// Keep everything but the line's old karaoke tags, dropping the
+			// block if nothing else is left
+			std::string contents;
+			auto tag = blocks.Tags(i).begin();
+			auto begin = text.begin() + block.offset + 1;
+			AssDialogueBlockOverride::SplitTags(begin, begin + block.length - 2, [&](std::string::const_iterator b, std::string::const_iterator e) {
+				if (!is_karaoke_tag((tag++)->Name))
+					contents.append(b, e);
+			});
+			if (!contents.empty()) {
+				ret += "{" + contents + "}";
+				block_end = ret.size();
+			}
+		}
+		else if (block.type == AssBlockType::PLAIN) {
+			size_t start = block.offset;
+			for (; next_tag != kara_tags.end() && next_tag->first < pos + block.length; ) {
+				size_t split = block.offset + next_tag->first - pos;
+				ret.append(text, start, split - start);
+				start = split;
+				add_tag();
+			}
+			ret.append(text, start, block.offset + block.length - start);
+			pos += block.length;
+		}
+		else
+			ret.append(text, block.offset, block.length);
+	}
+	// Groups matched to nothing at the end of the line
+	while (next_tag != kara_tags.end())
+		add_tag();
+	return ret;
+}
+
+void TimeKanji(agi::Context *c, KanjiTimerOptions const& options) {
+	std::vector<AssDialogue *> sources, destinations;
+	for (auto& line : c->ass->Events) {
+		if (line.Style.get() == options.source_style)
+			sources.push_back(&line);
+		else if (line.Style.get() == options.destination_style)
+			destinations.push_back(&line);
+	}
+
+	size_t count = std::min(sources.size(), destinations.size());
+	if (sources.size() != destinations.size())
+		LOG_W("kanji_timer") << "Found " << sources.size() << " source lines and " << destinations.size()
+			<< " destination lines; only the first " << count << " of each will be matched";
+
+	std::atomic<size_t> next_line{0};
+	auto run = [&] {
+		for (size_t i; (i = next_line++) < count; ) {
+			auto dst = destinations[i];
+			dst->Text = CopyKaraoke(*sources[i], dst->Text);
+			// The syllable durations are relative to the source's start
+			dst->Start = sources[i]->Start;
+			dst->End = sources[i]->End;
+		}
+	};
+
+	size_t thread_count = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u), count);
+	std::vector<std::future<void>> workers;
+	for (size_t i = 1; i < thread_count; ++i)
+		workers.push_back(std::async(std::launch::async, run));
+	run();
+	for (auto& worker : workers)
+		worker.get();
+
+	LOG_I("kanji_timer") << "Copied karaoke timing to " << count << " lines";
+	if (count)
+		c->ass->Commit(/*"kanji timing",*/ AssFile::COMMIT_DIAG_TEXT | AssFile::COMMIT_DIAG_TIME);
+}
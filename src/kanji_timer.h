@@ -0,0 +1,46 @@
+// Copyright (c) 2026, Aegisub CLI contributors
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+// Aegisub Project http://www.aegisub.org/
+
+#include <libaegisub/fs_fwd.h>
+
+#include <boost/filesystem/path.hpp>
+#include <string>
+
+class AssDialogue;
+namespace agi { struct Context; }
+
+/// The styles of the lines to copy karaoke timing between
+struct KanjiTimerOptions {
+	/// Style of the lines with the karaoke timing, usually romaji
+	std::string source_style;
+	/// Style of the lines to time, usually kanji
+	std::string destination_style;
+};
+
+/// Read the options from a JSON file
+/// @throws agi::InvalidInputException if the file isn't a valid options object
+KanjiTimerOptions LoadKanjiTimerOptions(agi::fs::path const& filename);
+
+/// Split the plain text of text between the karaoke syllables of source
+/// @return text with karaoke tags in place of any it had, and its other
+///         override blocks, comments and drawings unchanged
+std::string CopyKaraoke(AssDialogue const& source, std::string const& text);
+
+/// Copy the karaoke timing of each line of the source style to the
+/// corresponding line of the destination style, pairing them in order. The
+/// destination lines are given the source lines' start and end times, as
+/// the syllable durations are measured from the start.
+void TimeKanji(agi::Context *c, KanjiTimerOptions const& options);
@@ -41,6 +41,7 @@
 #include "ass_file.h"
 #include "auto4_base.h"
 #include "auto4_lua_factory.h"
+#include "event_time_index.h"
 #include "include/aegisub/context.h"
 #include "libresrc/libresrc.h"
 #include "options.h"
@@ -115,6 +116,42 @@ std::set<int> parse_range(const std::string& s) {
 	return lines;
 }
 
+AssFile::SortKeys parse_sort_keys(const std::string& s) {
+	AssFile::SortKeys keys;
+	for (auto tok : agi::Split(s, ',')) {
+		auto name = agi::str(tok);
+		auto comp = AssFile::GetSortKey(name);
+		if (!comp) {
+			throw agi::InvalidInputException("Invalid sort key: " + name);
+		}
+		keys.push_back(comp);
+	}
+	return keys;
+}
+
+Automation4::LuaJitSettings parse_jit_settings(boost::program_options::variables_map const& vm) {
+	Automation4::LuaJitSettings jit;
+	if (vm.count("jit")) {
+		auto const& mode = vm["jit"].as<std::string>();
+		if (mode == "off")
+			jit.enabled = false;
+		else if (mode != "on")
+			throw agi::InvalidInputException("Invalid value for --jit, expected on or off: " + mode);
+	}
+
+	for (auto param : {"hotloop", "maxtrace", "maxmcode", "sizemcode"}) {
+		auto name = std::string("jit-") + param;
+		if (!vm.count(name)) continue;
+		auto value = vm[name].as<int>();
+		if (value < 1)
+			throw agi::InvalidInputException(agi::format("Invalid value for --%s: %d", name, value));
+		jit.options.push_back(agi::format("%s=%d", param, value));
+	}
+
+	jit.report = vm.count("jit-report") > 0;
+	return jit;
+}
+
 std::unique_ptr<Automation4::Script> find_script(const std::string& file)
 {
 	auto absolute = agi::fs::path(file);
@@ -262,9 +299,18 @@ int main(int argc, char **argv) {
 		("automation", boost::program_options::value<std::vector<std::string>>(), "an automation script to run")
 		("active-line", boost::program_options::value<int>()->default_value(-1), "the active line")
 		("selected-lines", boost::program_options::value<std::string>()->default_value(""), "the selected lines")
+		("select-overlaps", "select lines which begin while another line is active")
+		("sort", boost::program_options::value<std::string>(), "sort lines before saving by a comma-separated list of keys: start, end, style, actor, effect or layer")
 		("dialog", boost::program_options::value<std::vector<std::string>>(), "response to a dialog, in JSON")
 		("file", boost::program_options::value<std::vector<std::string>>(), "filename to supply to an open/save call")
 		("loglevel", boost::program_options::value<int>()->default_value(3), "0 = exception; 1 = assert; 2 = warning; 3 = info; 4 = debug")
+		("jit", boost::program_options::value<std::string>(), "turn the LuaJIT compiler on or off")
+		("jit-hotloop", boost::program_options::value<int>(), "number of iterations before a loop is compiled")
+		("jit-maxtrace", boost::program_options::value<int>(), "maximum number of traces in the trace cache")
+		("jit-maxmcode", boost::program_options::value<int>(), "maximum total size of machine code areas in KB")
+		("jit-sizemcode", boost::program_options::value<int>(), "size of each machine code area in KB")
+		("jit-report", "log trace aborts with their locations and reasons when scripts are unloaded")
+		("cache-size", boost::program_options::value<int>()->default_value(64), "maximum size of the aegisub.cache file in MB, or 0 to disable it")
 	;
 
 	cmdline.add(flags);
@@ -446,12 +492,38 @@ int main(int argc, char **argv) {
 			}
 		}
 
+		AssFile::SortKeys sort_keys;
+		if (vm.count("sort")) {
+			sort_keys = parse_sort_keys(vm["sort"].as<std::string>());
+		}
+
 		auto active_index = vm["active-line"].as<int>();
 		AssDialogue* active_line = nullptr;
 
 		auto selected_indices = parse_range(vm["selected-lines"].as<std::string>());
 		Selection selected_lines;
 
+		// Cleared when there's nothing for the macro to run on, in which case
+		// the file is still sorted and saved and the run succeeds
+		bool run_macro = true;
+		if (vm.count("select-overlaps")) {
+			std::vector<EventTimeIndex::Interval> intervals;
+			int i = 0;
+			for (auto const& line : context->ass->Events) {
+				if (!line.Comment && (selected_indices.size() <= 1 || selected_indices.count(i)))
+					intervals.push_back({(int)line.Start, (int)line.End, (size_t)i});
+				i++;
+			}
+
+			auto overlaps = EventTimeIndex(std::move(intervals)).Overlaps();
+			StartupLog(agi::format("Selecting %d overlapping lines", overlaps.size()));
+			selected_indices = std::set<int>(overlaps.begin(), overlaps.end());
+			if (selected_indices.empty()) {
+				LOG_I("main") << "No overlapping lines found, so the macro will not be run";
+				run_macro = false;
+			}
+		}
+
 		int i = 0;
 		for (auto& line : context->ass->Events) {
 			if (i == active_index) {
@@ -478,7 +550,10 @@ int main(int argc, char **argv) {
 			std::move(selected_lines), active_line);
 
 		// Load plugins
-		Automation4::ScriptFactory::Register(agi::make_unique<Automation4::LuaScriptFactory>());
+		auto cache_size = vm["cache-size"].as<int>();
+		if (cache_size < 0)
+			throw agi::InvalidInputException(agi::format("Invalid value for --cache-size: %d", cache_size));
+		Automation4::ScriptFactory::Register(agi::make_unique<Automation4::LuaScriptFactory>(parse_jit_settings(vm), static_cast<uint64_t>(cache_size) << 20));
 
 		if (vm.count("dialog")) {
 			for (auto& s : vm["dialog"].as<std::vector<std::string>>()) {
@@ -520,10 +595,18 @@ int main(int argc, char **argv) {
 		}
 
 		auto macro = vm["macro"].as<std::string>();
-		StartupLog("Calling: ") << macro;
-		if (!cmd::call(macro, context.get())) {
-			StartupError("Skipping automation because validation function returned false");
-			return 1;
+		if (run_macro) {
+			StartupLog("Calling: ") << macro;
+			if (!cmd::call(macro, context.get())) {
+				StartupError("Skipping automation because validation function returned false");
+				return 1;
+			}
+		}
+
+		if (!sort_keys.empty()) {
+			StartupLog("Sorting lines by ") << vm["sort"].as<std::string>();
+			context->ass->Sort(sort_keys);
+			context->ass->Commit(AssFile::COMMIT_ORDER);
 		}
 
 		// restore cwd for saving
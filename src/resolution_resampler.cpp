@@ -24,10 +24,9 @@
 #include "async_video_provider.h"
 #include "include/aegisub/context.h"
 
+#include <libaegisub/ass/drawing.h>
 #include <libaegisub/exception.h>
 #include <libaegisub/of_type_adaptor.h>
-#include <libaegisub/split.h>
-#include <libaegisub/util.h>
 #include <libaegisub/ycbcr_conv.h>
 #include <libaegisub/log.h>
 
@@ -68,35 +67,16 @@ std::vector<std::string> MatrixNames() {
 
 namespace {
 	std::string transform_drawing(std::string const& drawing, int shift_x, int shift_y, double scale_x, double scale_y) {
-		bool is_x = true;
-		std::string final;
-		final.reserve(drawing.size());
-
-		for (auto const& cur : agi::Split(drawing, ' ')) {
-			double val;
-			if (agi::util::try_parse(agi::str(cur), &val)) {
-				if (is_x)
-					val = (val + shift_x) * scale_x;
-				else
-					val = (val + shift_y) * scale_y;
-				val = round(val * 8) / 8.0; // round to eighth-pixels
-				final += float_to_string(val);
-				final += ' ';
-				is_x = !is_x;
-			}
-			else if (cur.size() == 1) {
-				char c = tolower(cur[0]);
-				if (c == 'm' || c == 'n' || c == 'l' || c == 'b' || c == 's' || c == 'p' || c == 'c') {
-					is_x = true;
-					final += c;
-					final += ' ';
-				}
-			}
-		}
-
-		if (final.size())
-			final.pop_back();
-		return final;
+		// Reused between calls so that resampling doesn't allocate for every
+		// drawing
+		thread_local agi::ass::Drawing parsed;
+		parsed.Parse(drawing);
+		// Shifted and scaled separately rather than as one composed transform
+		// so that values exactly between two eighths round as they always have
+		parsed.Apply(agi::ass::Transform::Translate(shift_x, shift_y));
+		parsed.Apply(agi::ass::Transform::Scale(scale_x, scale_y));
+		parsed.Round(1.0 / 8); // round to eighth-pixels
+		return parsed.Serialize();
 	}
 
 	struct resample_state {
@@ -73,7 +73,7 @@ bool SubtitleFormat::CanSave(const AssFile *subs) const {
 
 	auto def = boost::flyweight<std::string>("Default");
 	for (auto const& line : subs->Events) {
-		if (line.Style != def || line.GetStrippedText() != line.Text)
+		if (line.Style != def || !line.IsPlainText())
 			return false;
 	}
 
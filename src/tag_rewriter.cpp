@@ -0,0 +1,295 @@
+// Copyright (c) 2026, Aegisub CLI contributors
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+// Aegisub Project http://www.aegisub.org/
+
+/// @file tag_rewriter.cpp
+/// @brief Mechanical changes to override tags driven by a rule file
+///
+/// The rule file is a JSON array of rules such as:
+///
+///     [{"tags": ["fs", "bord", "shad"], "scale": 1.5},
+///      {"tags": ["pos", "move", "org"], "shift": [10, -20]},
+///      {"tags": ["t", "fad", "move"], "time_shift": 100},
+///      {"tags": ["blur"], "drop": true},
+///      {"tags": ["K"], "rename": "kf"}]
+///
+/// Rules apply in order, so a tag renamed by one rule is seen by the later
+/// rules under its new name. Tags inside \t are rewritten like any others.
+
+#include "tag_rewriter.h"
+
+#include "ass_dialogue.h"
+#include "ass_file.h"
+#include "include/aegisub/context.h"
+#include "selection_controller.h"
+
+#include <libaegisub/exception.h>
+#include <libaegisub/format_path.h>
+#include <libaegisub/io.h>
+#include <libaegisub/json.h>
+#include <libaegisub/log.h>
+
+#include <algorithm>
+#include <atomic>
+#include <boost/algorithm/string/predicate.hpp>
+#include <cmath>
+#include <future>
+#include <thread>
+
+namespace {
+/// Tag names may be given with or without the leading backslash
+std::string normalize_name(std::string name) {
+	if (name.empty() || name[0] != '\\')
+		name.insert(name.begin(), '\\');
+	return name;
+}
+
+/// Get an element as the given type, or nullptr if it's another type
+template<typename T>
+T const* as(json::UnknownElement const& elem) {
+	try {
+		return &static_cast<T const&>(elem);
+	}
+	catch (json::Exception const&) {
+		return nullptr;
+	}
+}
+
+double get_number(json::UnknownElement const& elem) {
+	if (auto value = as<json::Double>(elem))
+		return *value;
+	return static_cast<json::Integer const&>(elem);
+}
+
+TagRewriteRule parse_rule(json::Object const& obj) {
+	TagRewriteRule rule;
+	for (auto const& field : obj) {
+		auto const& key = field.first;
+		try {
+			if (key == "tags") {
+				for (std::string const& name : static_cast<json::Array const&>(field.second))
+					rule.tags.push_back(normalize_name(name));
+			}
+			else if (key == "scale")
+				rule.scale = get_number(field.second);
+			else if (key == "shift") {
+				json::Array const& shift = field.second;
+				if (shift.size() != 2)
+					throw agi::InvalidInputException("'shift' must be an array of x and y");
+				rule.shift_x = get_number(shift[0]);
+				rule.shift_y = get_number(shift[1]);
+			}
+			else if (key == "time_scale")
+				rule.time_scale = get_number(field.second);
+			else if (key == "time_shift")
+				rule.time_shift = get_number(field.second);
+			else if (key == "rename")
+				rule.rename = normalize_name(static_cast<json::String const&>(field.second));
+			else if (key == "drop")
+				rule.drop = static_cast<json::Boolean const&>(field.second);
+			else
+				throw agi::InvalidInputException("Unknown rule field '" + key + "'");
+		}
+		catch (json::Exception const&) {
+			throw agi::InvalidInputException("Invalid value for rule field '" + key + "'");
+		}
+	}
+
+	if (rule.tags.empty())
+		throw agi::InvalidInputException("Rule does not list any tags");
+	return rule;
+}
+
+/// Apply the numeric parts of a rule to a parameter
+/// @return Was the parameter changed?
+bool apply_numbers(TagRewriteRule const& rule, AssOverrideParameter& param) {
+	auto type = param.GetType();
+	if (param.omitted || (type != VariableDataType::INT && type != VariableDataType::FLOAT))
+		return false;
+
+	double old_value = param.Get<double>();
+	double value = old_value;
+	switch (param.classification) {
+		case AssParameterClass::RELATIVE_TIME_START:
+			value = value * rule.time_scale + rule.time_shift;
+			break;
+		case AssParameterClass::RELATIVE_TIME_END:
+		case AssParameterClass::KARAOKE:
+			value *= rule.time_scale;
+			break;
+		case AssParameterClass::ABSOLUTE_POS_X:
+			value = value * rule.scale + rule.shift_x;
+			break;
+		case AssParameterClass::ABSOLUTE_POS_Y:
+			value = value * rule.scale + rule.shift_y;
+			break;
+		default:
+			value *= rule.scale;
+			break;
+	}
+
+	// Leave parameters which don't change as they were written
+	if (value == old_value) return false;
+	if (type == VariableDataType::FLOAT)
+		param.Set(value);
+	else
+		param.Set<int>(std::lround(value));
+	return true;
+}
+
+template<typename Tags>
+bool rewrite_tags(std::vector<TagRewriteRule> const& rules, Tags&& tags, std::string& text);
+
+/// Apply the rules to a tag. Dropped tags are marked by clearing their
+/// name, which no parsed tag otherwise has.
+/// @return Was the tag changed?
+bool rewrite_tag(std::vector<TagRewriteRule> const& rules, AssOverrideTag& tag) {
+	bool changed = false;
+	for (auto const& rule : rules) {
+		if (std::find(rule.tags.begin(), rule.tags.end(), tag.Name) == rule.tags.end())
+			continue;
+
+		if (rule.drop) {
+			tag.Name.clear();
+			return true;
+		}
+
+		if (!rule.rename.empty()) {
+			std::string old_text = tag;
+			tag.SetText(rule.rename + old_text.substr(tag.Name.size()));
+			changed = true;
+		}
+
+		for (size_t i = 0; i < tag.Params.size(); ++i) {
+			// \t's acceleration is the shape of the curve, which scaling
+			// would change rather than resize
+			if (tag.Name == "\\t" && i == 2) continue;
+			changed |= apply_numbers(rule, tag.Params[i]);
+		}
+	}
+
+	for (auto& param : tag.Params) {
+		if (param.omitted || param.GetType() != VariableDataType::BLOCK) continue;
+		std::string text;
+		if (rewrite_tags(rules, param.Get<AssDialogueBlockOverride*>()->Tags, text)) {
+			param.Set(text);
+			changed = true;
+		}
+	}
+
+	return changed;
+}
+
+/// Apply the rules to the tags of a block
+/// @param[out] text New text of the block without braces, if it changed
+/// @return Was anything changed?
+template<typename Tags>
+bool rewrite_tags(std::vector<TagRewriteRule> const& rules, Tags&& tags, std::string& text) {
+	bool changed = false;
+	for (auto& tag : tags)
+		changed |= rewrite_tag(rules, tag);
+	if (!changed) return false;
+
+	for (auto const& tag : tags) {
+		if (!tag.Name.empty())
+			text += tag;
+	}
+	return true;
+}
+}
+
+std::vector<TagRewriteRule> LoadTagRewriteRules(agi::fs::path const& filename) {
+	std::vector<TagRewriteRule> rules;
+	try {
+		auto stream = agi::io::Open(filename);
+		auto root = agi::json_util::parse(*stream);
+		if (!as<json::Array>(root))
+			throw agi::InvalidInputException("Expected an array of rules");
+		for (auto const& rule : static_cast<json::Array const&>(root)) {
+			auto obj = as<json::Object>(rule);
+			if (!obj)
+				throw agi::InvalidInputException("Each rule must be an object");
+			rules.push_back(parse_rule(*obj));
+		}
+	}
+	catch (json::Exception const& e) {
+		throw agi::InvalidInputException(agi::format("Invalid tag rewrite rules in %s: %s", filename, e.what()));
+	}
+	catch (agi::InvalidInputException const& e) {
+		throw agi::InvalidInputException(agi::format("Invalid tag rewrite rules in %s: %s", filename, e.GetMessage()));
+	}
+	return rules;
+}
+
+bool RewriteTags(std::string& text, std::vector<TagRewriteRule> const& rules) {
+	// Kept between lines so that its storage is reused
+	thread_local AssBlockList blocks;
+	blocks.Parse(text);
+
+	std::string new_text;
+	bool changed = false;
+	for (size_t i = 0; i < blocks.size(); ++i) {
+		if (blocks[i].type == AssBlockType::OVERRIDE) {
+			std::string tags;
+			if (rewrite_tags(rules, blocks.Tags(i), tags)) {
+				// Blocks left empty are dropped entirely
+				if (!tags.empty())
+					new_text += "{" + tags + "}";
+				changed = true;
+				continue;
+			}
+		}
+		new_text.append(text, blocks[i].offset, blocks[i].length);
+	}
+
+	if (changed)
+		text = std::move(new_text);
+	return changed;
+}
+
+void RewriteTags(agi::Context *c, std::vector<TagRewriteRule> const& rules) {
+	std::vector<AssDialogue *> lines;
+	for (auto line : c->selectionController->GetSelectedSet()) {
+		// Karaoke templates are written for the unchanged script
+		if (line->Comment && (boost::starts_with(line->Effect.get(), "template") || boost::starts_with(line->Effect.get(), "code")))
+			continue;
+		lines.push_back(line);
+	}
+
+	std::atomic<size_t> next_line{0};
+	std::atomic<size_t> changed_lines{0};
+	auto run = [&] {
+		std::string text;
+		for (size_t i; (i = next_line++) < lines.size(); ) {
+			text = lines[i]->Text;
+			if (RewriteTags(text, rules)) {
+				lines[i]->Text = text;
+				++changed_lines;
+			}
+		}
+	};
+
+	size_t thread_count = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u), lines.size());
+	std::vector<std::future<void>> workers;
+	for (size_t i = 1; i < thread_count; ++i)
+		workers.push_back(std::async(std::launch::async, run));
+	run();
+	for (auto& worker : workers)
+		worker.get();
+
+	LOG_I("tag_rewriter") << "Rewrote tags in " << changed_lines << " of " << lines.size() << " lines";
+	if (changed_lines)
+		c->ass->Commit(/*"rewrite tags",*/ AssFile::COMMIT_DIAG_TEXT);
+}
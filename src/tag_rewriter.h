@@ -0,0 +1,55 @@
+// Copyright (c) 2026, Aegisub CLI contributors
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+// Aegisub Project http://www.aegisub.org/
+
+#include <libaegisub/fs_fwd.h>
+
+#include <boost/filesystem/path.hpp>
+#include <string>
+#include <vector>
+
+namespace agi { struct Context; }
+
+/// A change to make to every instance of some override tags
+struct TagRewriteRule {
+	/// Names of the tags the rule applies to, with the backslash
+	std::vector<std::string> tags;
+	/// Factor to multiply the numeric parameters other than times by
+	double scale = 1;
+	/// Amount to add to x and y positions, after scaling
+	double shift_x = 0;
+	double shift_y = 0;
+	/// Factor to multiply times and karaoke durations by
+	double time_scale = 1;
+	/// Milliseconds to add to times measured from the start of the line,
+	/// after scaling
+	double time_shift = 0;
+	/// Name to give the tags, with the backslash, or empty to keep it
+	std::string rename;
+	/// Remove the tags
+	bool drop = false;
+};
+
+/// Read a list of rules from a JSON file
+/// @throws agi::InvalidInputException if the file isn't a valid list of rules
+std::vector<TagRewriteRule> LoadTagRewriteRules(agi::fs::path const& filename);
+
+/// Apply rules to the override tags of a line's text, leaving the blocks
+/// which no rule applies to as they were
+/// @return Was the text changed?
+bool RewriteTags(std::string& text, std::vector<TagRewriteRule> const& rules);
+
+/// Apply rules to the selected lines, spread over all cores
+void RewriteTags(agi::Context *c, std::vector<TagRewriteRule> const& rules);
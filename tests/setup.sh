@@ -46,3 +46,10 @@ cp $d/vfr/* data/vfr/in/
 
 mkdir data/keyframe
 cp $d/keyframe/* data/keyframe
+
+mkdir -p data/dir_index/sub
+printf %s 'return 1' > data/dir_index/a.lua
+touch data/dir_index/sub/b.lua
+mkdir data/dir_index_loop
+touch data/dir_index_loop/a.lua
+ln -s . data/dir_index_loop/self
@@ -0,0 +1,109 @@
+// Copyright (c) 2026, Aegisub CLI contributors
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+// Aegisub Project http://www.aegisub.org/
+
+#include <main.h>
+
+#include <libaegisub/directory_index.h>
+#include <libaegisub/fs.h>
+
+#include <fstream>
+
+using agi::fs::DirectoryIndex;
+
+TEST(lagi_directory_index, finds_files_recursively) {
+	DirectoryIndex index;
+	index.Add("data/dir_index");
+
+	auto a = index.Find("data/dir_index/a.lua");
+	ASSERT_NE(nullptr, a);
+	EXPECT_EQ(8u, a->size);
+	EXPECT_EQ(agi::fs::ModifiedTime("data/dir_index/a.lua"), a->modified);
+
+	EXPECT_NE(nullptr, index.Find("data/dir_index/sub/b.lua"));
+	EXPECT_EQ(nullptr, index.Find("data/dir_index/c.lua"));
+	EXPECT_EQ(nullptr, index.Find("data/dir_index/sub"));
+}
+
+TEST(lagi_directory_index, normalizes_paths) {
+	DirectoryIndex index;
+	index.Add("data/dir_index/");
+
+	EXPECT_NE(nullptr, index.Find("data/dir_index//a.lua"));
+	EXPECT_NE(nullptr, index.Find("data/dir_index/./sub/b.lua"));
+}
+
+TEST(lagi_directory_index, covers) {
+	DirectoryIndex index;
+	index.Add("data/dir_index");
+
+	EXPECT_TRUE(index.Covers("data/dir_index/a.lua"));
+	EXPECT_TRUE(index.Covers("data/dir_index/missing.lua"));
+	EXPECT_FALSE(index.Covers("data/dir_index"));
+	EXPECT_FALSE(index.Covers("data/dir_index_other/a.lua"));
+	EXPECT_FALSE(index.Covers("data/file"));
+}
+
+TEST(lagi_directory_index, file_exists_falls_back_to_filesystem) {
+	DirectoryIndex index;
+	index.Add("data/dir_index");
+	index.Add("data/does_not_exist");
+
+	EXPECT_TRUE(index.FileExists("data/dir_index/a.lua"));
+	EXPECT_FALSE(index.FileExists("data/dir_index/c.lua"));
+	EXPECT_FALSE(index.Covers("data/does_not_exist/a.lua"));
+	EXPECT_TRUE(index.FileExists("data/file"));
+	EXPECT_FALSE(index.FileExists("data/dir"));
+}
+
+TEST(lagi_directory_index, finds_files_created_after_indexing) {
+	DirectoryIndex index;
+	index.Add("data/dir_index");
+
+	std::ofstream("data/dir_index/new.lua") << "return 2";
+	EXPECT_TRUE(index.FileExists("data/dir_index/new.lua"));
+	EXPECT_NE(nullptr, index.Find("data/dir_index/new.lua"));
+	agi::fs::Remove("data/dir_index/new.lua");
+}
+
+TEST(lagi_directory_index, remove) {
+	DirectoryIndex index;
+	index.Add("data/dir_index");
+
+	index.Remove("data/dir_index/a.lua");
+	EXPECT_EQ(nullptr, index.Find("data/dir_index/a.lua"));
+	EXPECT_NE(nullptr, index.Find("data/dir_index/sub/b.lua"));
+	// The file is still there, so the lookup finds it and fixes the index
+	EXPECT_TRUE(index.FileExists("data/dir_index/a.lua"));
+	EXPECT_NE(nullptr, index.Find("data/dir_index/a.lua"));
+}
+
+TEST(lagi_directory_index, does_not_follow_symlink_loops) {
+	DirectoryIndex index;
+	index.Add("data/dir_index_loop");
+
+	EXPECT_NE(nullptr, index.Find("data/dir_index_loop/a.lua"));
+	EXPECT_EQ(nullptr, index.Find("data/dir_index_loop/self/a.lua"));
+}
+
+#if defined(_WIN32) || defined(__APPLE__)
+TEST(lagi_directory_index, ignores_case) {
+	DirectoryIndex index;
+	index.Add("data/dir_index");
+
+	EXPECT_NE(nullptr, index.Find("data/dir_index/A.lua"));
+	EXPECT_NE(nullptr, index.Find("data/DIR_INDEX/Sub/b.LUA"));
+}
+#endif
@@ -0,0 +1,115 @@
+// Copyright (c) 2026, Aegisub CLI contributors
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+// Aegisub Project http://www.aegisub.org/
+
+#include <main.h>
+
+#include <libaegisub/ass/drawing.h>
+
+using agi::ass::Drawing;
+using agi::ass::Transform;
+
+TEST(lagi_drawing, round_trip) {
+	EXPECT_EQ("m 0 0 l 100 0 100 100 0 100", Drawing("m 0 0 l 100 0 100 100 0 100").Serialize());
+	EXPECT_EQ("m 0 0 b 1.5 -2.25 3 4 5 6 c", Drawing("m 0 0 b 1.5 -2.25 3 4 5 6 c").Serialize());
+}
+
+TEST(lagi_drawing, empty) {
+	EXPECT_EQ("", Drawing("").Serialize());
+	EXPECT_EQ("", Drawing("   ").Serialize());
+	EXPECT_TRUE(Drawing("").Commands().empty());
+}
+
+TEST(lagi_drawing, normalizes_text) {
+	EXPECT_EQ("m 1 2 l 3 4", Drawing("  M 1.000  2   L 3 4.0  ").Serialize());
+}
+
+TEST(lagi_drawing, drops_unknown_tokens) {
+	EXPECT_EQ("m 1 2 l 3 4", Drawing("m 1 x 2 foo l 3 4 1a").Serialize());
+}
+
+TEST(lagi_drawing, keeps_leading_coordinates) {
+	Drawing d("1 2 m 3 4");
+	ASSERT_EQ(2u, d.Commands().size());
+	EXPECT_EQ(0, d.Commands()[0].type);
+	EXPECT_EQ(2u, d.Commands()[0].count);
+	EXPECT_EQ("1 2 m 3 4", d.Serialize());
+}
+
+TEST(lagi_drawing, number_formatting) {
+	EXPECT_EQ("1.235 -0.5 1000000 0", Drawing("1.23456 -0.5 1e6 -0.0001").Serialize());
+}
+
+TEST(lagi_drawing, translate_and_scale) {
+	Drawing d("m 1 2 l 3 4");
+	d.Apply(Transform::Translate(10, 20));
+	EXPECT_EQ("m 11 22 l 13 24", d.Serialize());
+	d.Apply(Transform::Scale(2, 0.5));
+	EXPECT_EQ("m 22 11 l 26 12", d.Serialize());
+}
+
+TEST(lagi_drawing, rotate) {
+	Drawing d("m 10 0");
+	d.Apply(Transform::Rotate(90));
+	d.Round(0.001);
+	EXPECT_EQ("m 0 -10", d.Serialize());
+}
+
+TEST(lagi_drawing, shear) {
+	Drawing d("m 2 3");
+	d.Apply(Transform::Shear(1, 2));
+	EXPECT_EQ("m 5 7", d.Serialize());
+}
+
+TEST(lagi_drawing, composed_transform) {
+	Drawing a("m 1 2 l 5 -3");
+	Drawing b("m 1 2 l 5 -3");
+	auto first = Transform::Translate(3, 4), second = Transform::Scale(2, 3);
+	a.Apply(first);
+	a.Apply(second);
+	b.Apply(first.Then(second));
+	EXPECT_EQ(a.Serialize(), b.Serialize());
+	EXPECT_EQ("m 8 18 l 16 3", b.Serialize());
+}
+
+TEST(lagi_drawing, odd_coordinate_count) {
+	Drawing d("m 1 2 3 l 4 5");
+	d.Apply(Transform::Rotate(180));
+	d.Round(0.001);
+	EXPECT_EQ("m -1 -2 -3 l -4 -5", d.Serialize());
+}
+
+TEST(lagi_drawing, round) {
+	Drawing d("m 0.06 0.07 l 1.3 -1.3");
+	d.Round(0.125);
+	EXPECT_EQ("m 0 0.125 l 1.25 -1.25", d.Serialize());
+}
+
+TEST(lagi_drawing, bounding_box) {
+	double x1, y1, x2, y2;
+	ASSERT_TRUE(Drawing("m 0 0 l 10 20 b -5 3 2 2 1 1").BoundingBox(x1, y1, x2, y2));
+	EXPECT_EQ(-5, x1);
+	EXPECT_EQ(0, y1);
+	EXPECT_EQ(10, x2);
+	EXPECT_EQ(20, y2);
+}
+
+TEST(lagi_drawing, bounding_box_ignores_lone_x) {
+	double x1, y1, x2, y2;
+	ASSERT_TRUE(Drawing("m 1 1 100 l 2 2").BoundingBox(x1, y1, x2, y2));
+	EXPECT_EQ(2, x2);
+	EXPECT_FALSE(Drawing("m 5").BoundingBox(x1, y1, x2, y2));
+	EXPECT_FALSE(Drawing("").BoundingBox(x1, y1, x2, y2));
+}
@@ -0,0 +1,107 @@
+// Copyright (c) 2026, Aegisub CLI contributors
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+// Aegisub Project http://www.aegisub.org/
+
+#include <main.h>
+
+#include <libaegisub/gap_buffer.h>
+
+#include <vector>
+
+TEST(lagi_gap_buffer, empty) {
+	agi::gap_buffer<int> buf;
+	EXPECT_TRUE(buf.empty());
+	EXPECT_EQ(0u, buf.size());
+	EXPECT_TRUE(buf.to_vector().empty());
+}
+
+TEST(lagi_gap_buffer, push_back) {
+	agi::gap_buffer<int> buf;
+	for (int i = 0; i < 100; ++i)
+		buf.push_back(i);
+	ASSERT_EQ(100u, buf.size());
+	for (int i = 0; i < 100; ++i)
+		EXPECT_EQ(i, buf[i]);
+}
+
+TEST(lagi_gap_buffer, insert_in_middle) {
+	agi::gap_buffer<int> buf;
+	for (int i = 0; i < 10; ++i)
+		buf.push_back(i);
+	buf.insert(5, 100);
+	buf.insert(6, 101);
+	buf.insert(0, 102);
+
+	std::vector<int> expected{102, 0, 1, 2, 3, 4, 100, 101, 5, 6, 7, 8, 9};
+	EXPECT_EQ(expected, buf.to_vector());
+	for (size_t i = 0; i < expected.size(); ++i)
+		EXPECT_EQ(expected[i], buf[i]);
+}
+
+TEST(lagi_gap_buffer, insert_range) {
+	agi::gap_buffer<int> buf;
+	buf.push_back(0);
+	buf.push_back(3);
+	std::vector<int> range{1, 2};
+	buf.insert(1, range.begin(), range.end());
+	EXPECT_EQ((std::vector<int>{0, 1, 2, 3}), buf.to_vector());
+}
+
+TEST(lagi_gap_buffer, erase) {
+	agi::gap_buffer<int> buf;
+	for (int i = 0; i < 10; ++i)
+		buf.push_back(i);
+
+	buf.erase(2, 4);
+	EXPECT_EQ((std::vector<int>{0, 1, 4, 5, 6, 7, 8, 9}), buf.to_vector());
+	buf.erase(7);
+	EXPECT_EQ((std::vector<int>{0, 1, 4, 5, 6, 7, 8}), buf.to_vector());
+	buf.erase(0);
+	EXPECT_EQ((std::vector<int>{1, 4, 5, 6, 7, 8}), buf.to_vector());
+	buf.erase(3, 3);
+	EXPECT_EQ(6u, buf.size());
+}
+
+TEST(lagi_gap_buffer, interleaved_edits_match_vector) {
+	agi::gap_buffer<int> buf;
+	std::vector<int> vec;
+	unsigned seed = 1;
+	auto next = [&] { return seed = seed * 1103515245 + 12345; };
+
+	for (int i = 0; i < 2000; ++i) {
+		size_t pos = vec.empty() ? 0 : (next() >> 4) % (vec.size() + 1);
+		if (!vec.empty() && next() % 3 == 0) {
+			if (pos == vec.size()) --pos;
+			vec.erase(vec.begin() + pos);
+			buf.erase(pos);
+		}
+		else {
+			vec.insert(vec.begin() + pos, i);
+			buf.insert(pos, i);
+		}
+	}
+
+	EXPECT_EQ(vec, buf.to_vector());
+}
+
+TEST(lagi_gap_buffer, assign_through_index) {
+	agi::gap_buffer<int> buf;
+	for (int i = 0; i < 5; ++i)
+		buf.push_back(i);
+	buf.insert(2, 10);
+	buf[0] = 20;
+	buf[4] = 30;
+	EXPECT_EQ((std::vector<int>{20, 1, 10, 2, 30, 4}), buf.to_vector());
+}
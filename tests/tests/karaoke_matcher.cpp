@@ -195,3 +195,50 @@ TEST(lagi_karaoke_matcher, lookahead_is_case_insensitive) {
 	EXPECT_EQ((karaoke_match_result{1, 3}),
 	          auto_match_karaoke({"Oh... ", "Nan", "ka ", "ta", "ri", "nai"}, "Oh…なんか足りない"));
 }
+
+using agi::match_karaoke_line;
+
+TEST(lagi_karaoke_matcher, line_empty_src_gives_no_groups) {
+	EXPECT_TRUE(match_karaoke_line(std::vector<std::string>(), "abc").empty());
+}
+
+TEST(lagi_karaoke_matcher, line_empty_dest_gives_one_group) {
+	auto groups = match_karaoke_line({"a", "b"}, "");
+	ASSERT_EQ(1u, groups.size());
+	EXPECT_EQ(2u, groups[0].source_length);
+	EXPECT_EQ("", groups[0].destination);
+}
+
+TEST(lagi_karaoke_matcher, line_matches_every_syllable) {
+	auto groups = match_karaoke_line({"Bo", "ku", "wa ", "shi", "tta"}, "僕は 知った");
+	ASSERT_EQ(4u, groups.size());
+	EXPECT_EQ(2u, groups[0].source_length);
+	EXPECT_EQ("僕", groups[0].destination);
+	EXPECT_EQ(1u, groups[1].source_length);
+	EXPECT_EQ("は ", groups[1].destination);
+	EXPECT_EQ(1u, groups[2].source_length);
+	EXPECT_EQ("知", groups[2].destination);
+	EXPECT_EQ(1u, groups[3].source_length);
+	EXPECT_EQ("った", groups[3].destination);
+}
+
+TEST(lagi_karaoke_matcher, line_gives_leftover_dest_to_last_group) {
+	auto groups = match_karaoke_line({"a"}, "abc");
+	ASSERT_EQ(1u, groups.size());
+	EXPECT_EQ(1u, groups[0].source_length);
+	EXPECT_EQ("abc", groups[0].destination);
+}
+
+TEST(lagi_karaoke_matcher, line_agrees_with_auto_match) {
+	std::vector<std::string> src{"Oh... ", "Nan", "ka ", "ta", "ri", "nai"};
+	std::string dst = "Oh…なんか足りない";
+
+	for (auto const& group : match_karaoke_line(src, dst)) {
+		auto result = auto_match_karaoke(src, dst);
+		EXPECT_EQ(result.source_length, group.source_length);
+		src.erase(src.begin(), src.begin() + group.source_length);
+		dst.erase(0, group.destination.size());
+	}
+	EXPECT_TRUE(src.empty());
+	EXPECT_TRUE(dst.empty());
+}
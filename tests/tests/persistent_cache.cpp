@@ -0,0 +1,126 @@
+// Copyright (c) 2026, Aegisub CLI contributors
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+// Aegisub Project http://www.aegisub.org/
+
+#include <main.h>
+
+#include <libaegisub/fs.h>
+#include <libaegisub/io.h>
+#include <libaegisub/persistent_cache.h>
+
+using agi::PersistentCache;
+
+TEST(lagi_persistent_cache, get_missing) {
+	agi::fs::Remove("data/cache/missing");
+	PersistentCache cache("data/cache/missing", 1024 * 1024);
+	std::string value;
+	EXPECT_FALSE(cache.Get("key", value));
+}
+
+TEST(lagi_persistent_cache, put_get) {
+	agi::fs::Remove("data/cache/put_get");
+	PersistentCache cache("data/cache/put_get", 1024 * 1024);
+	cache.Put("a", "value a");
+	cache.Put("b", std::string("\0binary\0", 8));
+	cache.Put("empty", "");
+
+	std::string value;
+	ASSERT_TRUE(cache.Get("a", value));
+	EXPECT_EQ("value a", value);
+	ASSERT_TRUE(cache.Get("b", value));
+	EXPECT_EQ(std::string("\0binary\0", 8), value);
+	ASSERT_TRUE(cache.Get("empty", value));
+	EXPECT_EQ("", value);
+}
+
+TEST(lagi_persistent_cache, later_put_replaces_value) {
+	agi::fs::Remove("data/cache/replace");
+	PersistentCache cache("data/cache/replace", 1024 * 1024);
+	cache.Put("key", "first");
+	cache.Put("key", "second");
+
+	std::string value;
+	ASSERT_TRUE(cache.Get("key", value));
+	EXPECT_EQ("second", value);
+}
+
+TEST(lagi_persistent_cache, persists_across_instances) {
+	agi::fs::Remove("data/cache/persist");
+	{
+		PersistentCache cache("data/cache/persist", 1024 * 1024);
+		cache.Put("key", "value");
+	}
+
+	PersistentCache cache("data/cache/persist", 1024 * 1024);
+	std::string value;
+	ASSERT_TRUE(cache.Get("key", value));
+	EXPECT_EQ("value", value);
+}
+
+TEST(lagi_persistent_cache, sees_writes_from_other_instances) {
+	agi::fs::Remove("data/cache/shared");
+	PersistentCache a("data/cache/shared", 1024 * 1024);
+	PersistentCache b("data/cache/shared", 1024 * 1024);
+
+	std::string value;
+	EXPECT_FALSE(b.Get("key", value));
+	a.Put("key", "value");
+	ASSERT_TRUE(b.Get("key", value));
+	EXPECT_EQ("value", value);
+
+	// Grow the file past its initial size from one instance
+	std::string big(100 * 1024, 'x');
+	a.Put("big", big);
+	ASSERT_TRUE(b.Get("big", value));
+	EXPECT_EQ(big, value);
+}
+
+TEST(lagi_persistent_cache, compaction_keeps_recently_used) {
+	agi::fs::Remove("data/cache/compact");
+	PersistentCache cache("data/cache/compact", 256 * 1024);
+	std::string value(1000, 'v');
+	std::string out;
+
+	cache.Put("hot", value);
+	for (int i = 0; i < 1000; ++i) {
+		cache.Put(std::to_string(i), value);
+		ASSERT_TRUE(cache.Get("hot", out));
+	}
+
+	EXPECT_LE(agi::fs::Size("data/cache/compact"), 256u * 1024u);
+	EXPECT_TRUE(cache.Get("999", out));
+	EXPECT_FALSE(cache.Get("0", out));
+}
+
+TEST(lagi_persistent_cache, oversized_value_not_stored) {
+	agi::fs::Remove("data/cache/oversized");
+	PersistentCache cache("data/cache/oversized", 64 * 1024);
+	cache.Put("key", std::string(100 * 1024, 'x'));
+
+	std::string value;
+	EXPECT_FALSE(cache.Get("key", value));
+}
+
+TEST(lagi_persistent_cache, invalid_file_is_reset) {
+	agi::fs::CreateDirectory("data/cache");
+	agi::io::Save("data/cache/invalid").Get() << "not a cache file";
+
+	PersistentCache cache("data/cache/invalid", 1024 * 1024);
+	std::string value;
+	EXPECT_FALSE(cache.Get("key", value));
+	cache.Put("key", "value");
+	ASSERT_TRUE(cache.Get("key", value));
+	EXPECT_EQ("value", value);
+}